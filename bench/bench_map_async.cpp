@@ -0,0 +1,122 @@
+/**
+ * Random lookups on a map much larger than the caches, comparing plain
+ * map_get calls against interleaved lookups driven by map_lookup_run and by
+ * coroutines suspended on map_async::table::find_async.
+ *
+ * Usage: bench_map_async [keys] [lookups] [in flight]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <map/map.hpp>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+std::uint64_t xorshift64(std::uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+double seconds_since(clock_type::time_point start) {
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+struct handler_state {
+    const std::vector<std::string>* trace;
+    std::size_t found;
+};
+
+// Each handler walks its own stride of the trace, one awaited lookup at a time
+map_async::task handler(map_async::table<std::uint64_t>& table, handler_state& state, std::size_t first,
+                        std::size_t stride) {
+    const std::vector<std::string>& trace = *state.trace;
+    for (std::size_t i = first; i < trace.size(); i += stride) {
+        if (auto value = co_await table.find_async(trace[i])) {
+            state.found += *value == 0 ? 0 : 1;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t keys      = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    std::size_t lookups   = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4000000;
+    std::size_t in_flight = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 16;
+
+    if (keys == 0 || lookups == 0 || in_flight == 0) {
+        std::fprintf(stderr, "usage: %s [keys] [lookups] [in flight]\n", argv[0]);
+        return 1;
+    }
+
+    map_t* map = map_create(sizeof(std::uint64_t));
+    if (map == nullptr) {
+        return 1;
+    }
+
+    for (std::uint64_t i = 0; i < keys; i++) {
+        std::string key = "key:" + std::to_string(i);
+        std::uint64_t value = i + 1;
+        map_put(map, key.data(), key.size(), &value);
+    }
+
+    std::vector<std::string> trace;
+    trace.reserve(lookups);
+    std::uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (std::size_t i = 0; i < lookups; i++) {
+        trace.push_back("key:" + std::to_string(xorshift64(seed) % keys));
+    }
+
+    // Baseline: one lookup at a time
+    std::size_t found = 0;
+    auto start        = clock_type::now();
+    for (const std::string& key : trace) {
+        std::uint64_t value = 0;
+        found += map_get(map, key.data(), key.size(), &value) == 0;
+    }
+    double sequential = seconds_since(start);
+
+    // Interleaved state machines, in groups of in_flight
+    std::vector<map_lookup_t> group(in_flight);
+    std::vector<std::uint64_t> values(in_flight);
+    std::size_t found_interleaved = 0;
+    start                         = clock_type::now();
+    for (std::size_t i = 0; i < lookups; i += in_flight) {
+        std::size_t count = lookups - i < in_flight ? lookups - i : in_flight;
+        for (std::size_t j = 0; j < count; j++) {
+            map_lookup_start(&group[j], map, trace[i + j].data(), trace[i + j].size(), &values[j]);
+        }
+        found_interleaved += map_lookup_run(group.data(), count);
+    }
+    double interleaved = seconds_since(start);
+
+    // Coroutine handlers, in_flight of them suspended at any time
+    map_async::scheduler scheduler;
+    map_async::table<std::uint64_t> table(map, scheduler);
+    handler_state state{&trace, 0};
+    start = clock_type::now();
+    for (std::size_t i = 0; i < in_flight; i++) {
+        handler(table, state, i, in_flight);
+    }
+    scheduler.run();
+    double coroutines = seconds_since(start);
+
+    std::printf("keys=%zu lookups=%zu in_flight=%zu\n", keys, lookups, in_flight);
+    std::printf("map_get:        %6.1f ns/lookup\n", sequential * 1e9 / static_cast<double>(lookups));
+    std::printf("map_lookup_run: %6.1f ns/lookup (%.2fx)\n", interleaved * 1e9 / static_cast<double>(lookups),
+                sequential / interleaved);
+    std::printf("coroutines:     %6.1f ns/lookup (%.2fx)\n", coroutines * 1e9 / static_cast<double>(lookups),
+                sequential / coroutines);
+
+    map_free(map);
+    return found == found_interleaved && found == state.found ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/**
+ * Zipfian read benchmark comparing map_get against map_cache_get on a map
+ * shared between reader threads.
+ *
+ * Usage: bench_map_cache [threads] [keys] [lookups per thread]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map/map.h>
+
+#define ZIPF_SKEW (0.99)
+
+typedef char key_t[24];
+
+typedef struct {
+    map_t* map;
+    const key_t* trace;
+    size_t lookups;
+    int cached;
+    double seconds;
+} bench_args_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift64(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * Materializes the lookup sequence as consecutive key strings, so the timed
+ * loop streams through it the way a server reads keys out of request buffers.
+ */
+static key_t* zipf_trace(size_t nkeys, size_t length, uint64_t seed) {
+    double* cdf  = malloc(nkeys * sizeof(*cdf));
+    key_t* trace = malloc(length * sizeof(*trace));
+    if (cdf == NULL || trace == NULL) {
+        free(cdf);
+        free(trace);
+        return NULL;
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < nkeys; i++) {
+        sum += 1.0 / pow((double)(i + 1), ZIPF_SKEW);
+        cdf[i] = sum;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        double u = (double)(xorshift64(&seed) >> 11) / 9007199254740992.0 * sum;
+        size_t lo = 0, hi = nkeys - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        snprintf(trace[i], sizeof(trace[i]), "metric.%zu", lo);
+    }
+
+    free(cdf);
+    return trace;
+}
+
+static void* reader(void* arg) {
+    bench_args_t* args = arg;
+    map_cache_t* cache = args->cached ? map_cache_create(args->map, 1024) : NULL;
+    uint64_t checksum  = 0;
+
+    double start = now_seconds();
+    for (size_t i = 0; i < args->lookups; i++) {
+        const char* key = args->trace[i];
+        size_t len      = strlen(key) + 1;
+        uint64_t value  = 0;
+
+        if (cache != NULL) {
+            map_cache_get(cache, key, len, &value);
+        } else {
+            map_get(args->map, key, len, &value);
+        }
+        checksum += value;
+    }
+    args->seconds = now_seconds() - start;
+
+    map_cache_free(cache);
+    return (void*)(uintptr_t)(checksum == 0);
+}
+
+static double run(map_t* map, key_t** traces, int threads, size_t lookups, int cached) {
+    pthread_t tids[threads];
+    bench_args_t args[threads];
+    double total = 0.0;
+
+    for (int t = 0; t < threads; t++) {
+        args[t] = (bench_args_t){.map = map, .trace = traces[t], .lookups = lookups, .cached = cached};
+        pthread_create(&tids[t], NULL, reader, &args[t]);
+    }
+
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        total += args[t].seconds;
+    }
+
+    return total / (double)threads / (double)lookups * 1e9;
+}
+
+int main(int argc, char** argv) {
+    int threads    = argc > 1 ? atoi(argv[1]) : 4;
+    size_t nkeys   = argc > 2 ? (size_t)atol(argv[2]) : 100000;
+    size_t lookups = argc > 3 ? (size_t)atol(argv[3]) : 1000000;
+
+    map_t* map = map_create_ex(sizeof(uint64_t), MAP_FLAG_CONCURRENT);
+    if (map == NULL || threads <= 0) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < nkeys; i++) {
+        key_t key;
+        uint64_t value = i + 1;
+        snprintf(key, sizeof(key), "metric.%zu", i);
+        map_put(map, key, strlen(key) + 1, &value);
+    }
+
+    key_t* traces[threads];
+    for (int t = 0; t < threads; t++) {
+        traces[t] = zipf_trace(nkeys, lookups, 0x9e3779b97f4a7c15ull + (uint64_t)t);
+        if (traces[t] == NULL) {
+            return 1;
+        }
+    }
+
+    double direct = run(map, traces, threads, lookups, 0);
+    double cached = run(map, traces, threads, lookups, 1);
+
+    printf("threads=%d keys=%zu skew=%.2f\n", threads, nkeys, ZIPF_SKEW);
+    printf("map_get        %8.1f ns/op\n", direct);
+    printf("map_cache_get  %8.1f ns/op (%.2fx)\n", cached, direct / cached);
+
+    for (int t = 0; t < threads; t++) {
+        free(traces[t]);
+    }
+    map_free(map);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * Hash-flooding benchmark: inserts and looks up keys crafted so that they all
+ * share one murmur_hash2 value, next to as many ordinary keys of the same
+ * length. Without a defense every colliding insert walks the whole chain.
+ *
+ * Usage: bench_map_flood [keys]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map/map.h>
+
+#define MURMUR_M (0x5bd1e995u)
+#define KEY_LEN (8)
+
+typedef char flood_key_t[KEY_LEN + 1];
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t murmur_mix(uint32_t k) {
+    k *= MURMUR_M;
+    k ^= k >> 24;
+    return k * MURMUR_M;
+}
+
+static uint32_t murmur_unmix(uint32_t k) {
+    uint32_t inverse = MURMUR_M;
+
+    // Newton's iteration for the inverse of m modulo 2^32
+    for (int i = 0; i < 5; i++) {
+        inverse *= 2 - MURMUR_M * inverse;
+    }
+
+    k *= inverse;
+    k ^= k >> 24;
+    return k * inverse;
+}
+
+static int has_nul(uint32_t block) {
+    return (block & 0xff) == 0 || (block & 0xff00) == 0 || (block & 0xff0000) == 0 || (block & 0xff000000) == 0;
+}
+
+static void store_block(char* out, uint32_t block) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (char)(block >> (8 * i));
+    }
+}
+
+/**
+ * The mixing step of each block is a bijection, so for any first block there
+ * is a second block that brings the state to a fixed target. Every key built
+ * that way has the same hash, whatever the table size.
+ */
+static void colliding_keys(flood_key_t* keys, size_t count) {
+    size_t made = 0;
+
+    for (uint32_t seed = 1; made < count; seed++) {
+        uint32_t first  = 0x61616161u + (seed % 26) + (seed / 26 % 26 << 8) + (seed / 676 % 26 << 16) +
+                         (seed / 17576 % 26 << 24);
+        uint32_t second = murmur_unmix(0x5eed1234u ^ (murmur_mix(first) * MURMUR_M));
+
+        if (has_nul(second)) {
+            continue;
+        }
+
+        store_block(keys[made], first);
+        store_block(keys[made] + 4, second);
+        keys[made][KEY_LEN] = '\0';
+        made++;
+    }
+}
+
+static void random_keys(flood_key_t* keys, size_t count) {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < KEY_LEN; j++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            keys[i][j] = (char)('a' + state % 26);
+        }
+        keys[i][KEY_LEN] = '\0';
+    }
+}
+
+static int run(const char* name, const flood_key_t* keys, size_t count) {
+    map_t* map = map_create_ex(sizeof(size_t), MAP_FLAG_ADAPTIVE);
+    if (map == NULL) {
+        return -1;
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        if (map_put(map, keys[i], KEY_LEN, &i) != 0) {
+            fprintf(stderr, "%s: insert %zu failed\n", name, i);
+            map_free(map);
+            return -1;
+        }
+    }
+    double inserted = now_seconds();
+
+    map_stats_t before;
+    map_stats(map, &before);
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t value;
+        found += map_get(map, keys[i], KEY_LEN, &value) == 0 && value == i;
+    }
+    double looked_up = now_seconds();
+
+    map_stats_t after;
+    map_stats(map, &after);
+
+    printf("%-10s insert %8.1f ns/op  lookup %8.1f ns/op  probes/lookup %5.2f  rekeys %llu  found %zu\n", name,
+           (inserted - start) / (double)count * 1e9, (looked_up - inserted) / (double)count * 1e9,
+           (double)(after.probes - before.probes) / (double)count, (unsigned long long)after.rekeys, found);
+
+    map_free(map);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+    flood_key_t* flood  = malloc(count * sizeof(*flood));
+    flood_key_t* normal = malloc(count * sizeof(*normal));
+    if (flood == NULL || normal == NULL) {
+        free(flood);
+        free(normal);
+        return 1;
+    }
+
+    colliding_keys(flood, count);
+    random_keys(normal, count);
+
+    int result = run("random", (const flood_key_t*)normal, count) | run("colliding", (const flood_key_t*)flood, count);
+
+    free(flood);
+    free(normal);
+    return result == 0 ? 0 : 1;
+}
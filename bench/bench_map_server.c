@@ -0,0 +1,243 @@
+/**
+ * Pipelined load generator for map_server, in the spirit of redis-benchmark:
+ * each client connection sends batches of SET and then GET requests over
+ * random keys and checks every reply.
+ *
+ * Usage: bench_map_server [port] [clients] [requests per client] [pipeline] [keys] [value size]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint16_t port;
+    size_t requests;
+    size_t pipeline;
+    size_t keys;
+    size_t value_size;
+    uint64_t seed;
+    size_t errors;
+    double set_seconds;
+    double get_seconds;
+} bench_args_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift64(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int bench_connect(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Reads replies until `count` complete ones have arrived. Counts replies that
+ * are errors or misses as errors.
+ */
+static int read_replies(int fd, char* buffer, size_t size, size_t count, size_t* errors) {
+    size_t len = 0;
+    size_t pos = 0;
+
+    while (count > 0) {
+        char* line = pos < len ? memchr(buffer + pos, '\n', len - pos) : NULL;
+        if (line != NULL) {
+            size_t skip = 0;
+            if (buffer[pos] == '$') {
+                long bulk = strtol(buffer + pos + 1, NULL, 10);
+                if (bulk < 0) {
+                    (*errors)++;
+                } else {
+                    skip = (size_t)bulk + 2;
+                }
+            } else if (buffer[pos] != '+') {
+                (*errors)++;
+            }
+
+            size_t next = (size_t)(line - buffer) + 1 + skip;
+            if (next <= len) {
+                pos = next;
+                count--;
+                continue;
+            }
+        }
+
+        memmove(buffer, buffer + pos, len - pos);
+        len -= pos;
+        pos = 0;
+        if (len == size) {
+            return -1;
+        }
+
+        ssize_t n = recv(fd, buffer + len, size - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t)n;
+    }
+
+    return 0;
+}
+
+static size_t format_request(char* out, const char* command, size_t key, const char* value, size_t value_size) {
+    char name[32];
+    int key_len = snprintf(name, sizeof(name), "key:%012zu", key);
+
+    if (value == NULL) {
+        return (size_t)sprintf(out, "*2\r\n$%zu\r\n%s\r\n$%d\r\n%s\r\n", strlen(command), command, key_len, name);
+    }
+
+    int len = sprintf(out, "*3\r\n$%zu\r\n%s\r\n$%d\r\n%s\r\n$%zu\r\n", strlen(command), command, key_len, name,
+                      value_size);
+    memcpy(out + len, value, value_size);
+    memcpy(out + (size_t)len + value_size, "\r\n", 2);
+    return (size_t)len + value_size + 2;
+}
+
+static double run_phase(bench_args_t* args, int fd, const char* command, const char* value) {
+    size_t request_size = 96 + args->value_size;
+    size_t buffer_size  = args->pipeline * request_size + 65536;
+    char* requests      = malloc(args->pipeline * request_size);
+    char* replies       = malloc(buffer_size);
+    uint64_t state      = args->seed;
+    double start        = now_seconds();
+
+    for (size_t done = 0; done < args->requests && requests != NULL && replies != NULL;) {
+        size_t batch = args->requests - done < args->pipeline ? args->requests - done : args->pipeline;
+        size_t len   = 0;
+
+        for (size_t i = 0; i < batch; i++) {
+            size_t key = (size_t)(xorshift64(&state) % args->keys);
+            len += format_request(requests + len, command, key, value, args->value_size);
+        }
+
+        if (send_all(fd, requests, len) != 0 || read_replies(fd, replies, buffer_size, batch, &args->errors) != 0) {
+            args->errors += args->requests - done;
+            break;
+        }
+        done += batch;
+    }
+
+    free(requests);
+    free(replies);
+    return now_seconds() - start;
+}
+
+static void* bench_client(void* arg) {
+    bench_args_t* args = arg;
+
+    int fd = bench_connect(args->port);
+    if (fd < 0) {
+        args->errors = args->requests * 2;
+        return NULL;
+    }
+
+    char* value = malloc(args->value_size);
+    if (value != NULL) {
+        memset(value, 'x', args->value_size);
+
+        // Both phases replay the same keys, so every GET must hit
+        args->set_seconds = run_phase(args, fd, "SET", value);
+        args->get_seconds = run_phase(args, fd, "GET", NULL);
+    }
+
+    free(value);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    uint16_t port     = (uint16_t)(argc > 1 ? atoi(argv[1]) : 6379);
+    size_t clients    = argc > 2 ? (size_t)atol(argv[2]) : 8;
+    size_t requests   = argc > 3 ? (size_t)atol(argv[3]) : 100000;
+    size_t pipeline   = argc > 4 ? (size_t)atol(argv[4]) : 16;
+    size_t keys       = argc > 5 ? (size_t)atol(argv[5]) : 100000;
+    size_t value_size = argc > 6 ? (size_t)atol(argv[6]) : 64;
+
+    if (clients == 0 || requests == 0 || pipeline == 0 || keys == 0 || value_size == 0) {
+        fprintf(stderr, "usage: %s [port] [clients] [requests] [pipeline] [keys] [value size]\n", argv[0]);
+        return 1;
+    }
+
+    pthread_t* threads = calloc(clients, sizeof(*threads));
+    bench_args_t* args = calloc(clients, sizeof(*args));
+    if (threads == NULL || args == NULL) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < clients; i++) {
+        args[i] = (bench_args_t){
+            .port       = port,
+            .requests   = requests,
+            .pipeline   = pipeline,
+            .keys       = keys,
+            .value_size = value_size,
+            .seed       = 0x9e3779b97f4a7c15ull * (i + 1),
+        };
+        pthread_create(&threads[i], NULL, bench_client, &args[i]);
+    }
+
+    size_t errors = 0;
+    double set    = 0;
+    double get    = 0;
+    for (size_t i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        errors += args[i].errors;
+        set = args[i].set_seconds > set ? args[i].set_seconds : set;
+        get = args[i].get_seconds > get ? args[i].get_seconds : get;
+    }
+
+    double total = (double)(clients * requests);
+    printf("clients=%zu pipeline=%zu value=%zuB\n", clients, pipeline, value_size);
+    printf("SET: %.0f requests/s\n", set > 0 ? total / set : 0.0);
+    printf("GET: %.0f requests/s\n", get > 0 ? total / get : 0.0);
+    printf("errors: %zu\n", errors);
+
+    free(threads);
+    free(args);
+    return errors == 0 ? 0 : 1;
+}
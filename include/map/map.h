@@ -6,24 +6,525 @@
 #ifndef MAP_H
 #define MAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * @brief Maximum allowed length for keys
  */
 #define MAP_KEY_MAX_LEN (128)
 
+/**
+ * @brief Guard every map operation with an internal lock so the map can be
+ *        shared between threads
+ */
+#define MAP_FLAG_CONCURRENT (1u << 0)
+
+/**
+ * @brief Grow and shrink the table on a dedicated worker thread instead of
+ *        inside map_put/map_remove (implies MAP_FLAG_CONCURRENT)
+ *
+ * The worker allocates the new table off-lock, flips it in and then migrates
+ * buckets in small batches; lookups consult both tables in the meantime, so
+ * foreground latency no longer depends on the size of the map.
+ */
+#define MAP_FLAG_BACKGROUND_RESIZE (1u << 1)
+
+/**
+ * @brief One writer thread, any number of lock-free reader threads
+ *
+ * Every call that modifies the map must come from the writer thread: not only
+ * map_put and map_remove but also map_putv/map_removev, map_txn_commit,
+ * map_handle_put_value/map_handle_remove, map_set_hooks,
+ * map_changes_create/map_changes_free and map_repl_poll on a follower. The
+ * map has no lock for them to take, so a second writer would corrupt the
+ * sequence counter readers rely on. map_get and map_count may be called from
+ * any thread; they read optimistically under a sequence counter and retry if
+ * the writer intervened, so readers never write to shared memory. Memory the
+ * writer unlinks is reclaimed once no reader can still observe it. Cannot be
+ * combined with MAP_FLAG_CONCURRENT.
+ */
+#define MAP_FLAG_SINGLE_WRITER (1u << 2)
+
+/**
+ * @brief Batch concurrent writes through flat combining (implies
+ *        MAP_FLAG_CONCURRENT)
+ *
+ * map_put/map_remove claim one of 64 slots shared by all threads with a
+ * compare-and-swap and publish their mutation there instead of each taking the
+ * lock; each thread starts its search at a different slot, so threads rarely
+ * contend for one. Whichever writer gets the lock applies every published
+ * mutation in one pass, ordered by bucket, and hands each caller its result
+ * back through its slot. When every slot is taken the caller applies its
+ * mutation under the lock itself. Hooks and change-stream records for a
+ * mutation run on whichever thread is combining, which need not be the thread
+ * that called map_put or map_remove.
+ */
+#define MAP_FLAG_COMBINING (1u << 3)
+
+/**
+ * @brief Tune the map to its workload (cannot be combined with
+ *        MAP_FLAG_SINGLE_WRITER)
+ *
+ * The map counts lookups, hits, writes and probed entries, and every
+ * MAP_ADAPT_WINDOW operations picks a profile from the mix. The profile sets
+ * the load factors at which the table grows and shrinks, and whether the map
+ * may return to the inline small engine. Parameters only take effect at the
+ * next resize or shrink, so no operation pays for a decision. map_stats reports
+ * the counters and the current decisions.
+ */
+#define MAP_FLAG_ADAPTIVE (1u << 4)
+
+/**
+ * @brief Treat keys that differ only in the case of ASCII letters as equal
+ *
+ * Case is folded inside the hash and the key comparison, so lookups need no
+ * lowercased copy of the key. Bytes outside A-Z/a-z, including UTF-8
+ * sequences, must match exactly. Entries keep the spelling they were first
+ * inserted with, which is what iteration and change notifications report.
+ */
+#define MAP_FLAG_CASE_INSENSITIVE (1u << 5)
+
+/**
+ * @brief Every key is exactly 16 bytes (UUIDs, 128-bit digests)
+ *
+ * Keys are binary: zero bytes are ordinary bytes. They are stored inside the
+ * entry instead of in a separate allocation, compared with a single vector
+ * compare and hashed by folding their bytes, which are assumed to be random
+ * already; a map whose chains grow suspiciously long still switches to its
+ * keyed hash. Operations on keys of any other length fail with -EINVAL.
+ * Cannot be combined with MAP_FLAG_CASE_INSENSITIVE or another key width.
+ */
+#define MAP_FLAG_KEY_16 (1u << 6)
+
+/**
+ * @brief Every key is exactly 32 bytes (SHA-256 digests); see MAP_FLAG_KEY_16
+ */
+#define MAP_FLAG_KEY_32 (1u << 7)
+
+/**
+ * @brief Every key is a uint64_t, passed as its 8 bytes in host byte order
+ *
+ * Keys are stored and compared like those of MAP_FLAG_KEY_16. A map no other
+ * thread touches also watches the range its keys span: when they are nearly
+ * consecutive, as IDs handed out by a counter are, it drops hashing and keeps
+ * entry `key` in slot `key - first` of a direct-addressed array, where a
+ * lookup is a single load. An insert outside the array widens it while the
+ * keys stay dense, and returns the map to hashing once they no longer are.
+ * map_set_key_range announces the range up front.
+ */
+#define MAP_FLAG_KEY_64 (1u << 8)
+
+/**
+ * @brief Number of operations between two decisions of an adaptive map
+ */
+#define MAP_ADAPT_WINDOW (4096)
+
 /**
  * @brief Opaque map structure
  */
 typedef struct map map_t;
 
+/**
+ * @brief Bytes of storage a map_storage_t reserves for a map
+ *
+ * Checked against the real structure when the library is built, so a map
+ * initialized with map_init always fits.
+ */
+#define MAP_STORAGE_SIZE (640)
+
+/**
+ * @brief Storage for a map embedded in another object or on the stack
+ *
+ * Initialized by map_init and released by map_destroy. The map points into
+ * itself, so the storage must not be moved or copied while it is in use.
+ */
+typedef union map_storage {
+    unsigned char bytes[MAP_STORAGE_SIZE];
+    max_align_t align;
+} map_storage_t;
+
+/**
+ * @brief Opaque allocator shared by a family of maps
+ */
+typedef struct map_family map_family_t;
+
 /**
  * @brief Opaque map iterator structure
  */
 typedef struct map_iter map_iter_t;
 
+/**
+ * @brief Opaque per-thread read cache structure
+ */
+typedef struct map_cache map_cache_t;
+
+/**
+ * @brief Opaque change stream structure
+ */
+typedef struct map_changes map_changes_t;
+
+/**
+ * @brief Kind of mutation reported to hooks and change streams
+ */
+typedef enum map_change_kind {
+    MAP_CHANGE_INSERT,
+    MAP_CHANGE_UPDATE,
+    MAP_CHANGE_REMOVE,
+} map_change_kind_t;
+
+/**
+ * @brief Callbacks invoked for every mutation of a map
+ *
+ * Hooks run inside the map's write section, on the thread that applies the
+ * mutation, which may be another writer's thread: on MAP_FLAG_COMBINING maps
+ * whichever writer holds the lock applies every published mutation, and a
+ * transaction reports all of its mutations from the thread that commits it.
+ * Hooks must not call back into the same map. Any hook may be NULL.
+ */
+typedef struct map_hooks {
+    /**
+     * @brief Called after a new key has been inserted
+     */
+    void (*on_insert)(void* ctx, const char* key, size_t len, const void* value);
+
+    /**
+     * @brief Called before an existing key's value is overwritten
+     */
+    void (*on_update)(void* ctx, const char* key, size_t len, const void* old_value, const void* new_value);
+
+    /**
+     * @brief Called before a key is removed, with the value it held
+     */
+    void (*on_remove)(void* ctx, const char* key, size_t len, const void* value);
+
+    /**
+     * @brief User context passed to every hook
+     */
+    void* ctx;
+} map_hooks_t;
+
+/**
+ * @brief Representation a map currently uses
+ */
+typedef enum map_engine {
+    /**
+     * @brief Up to 16 entries in inline slots, no hashing
+     */
+    MAP_ENGINE_SMALL,
+
+    /**
+     * @brief Chained hash table
+     */
+    MAP_ENGINE_HASHED,
+
+    /**
+     * @brief Array indexed by the key's offset in its range (MAP_FLAG_KEY_64)
+     */
+    MAP_ENGINE_DIRECT,
+
+    /**
+     * @brief Fixed-capacity open addressing in a caller's buffer (map_init_static)
+     */
+    MAP_ENGINE_STATIC,
+} map_engine_t;
+
+/**
+ * @brief Workload profile an adaptive map last chose
+ */
+typedef enum map_profile {
+    /**
+     * @brief Not enough operations seen yet, or no dominant pattern
+     */
+    MAP_PROFILE_BALANCED,
+
+    /**
+     * @brief Mostly inserts and removals: shrink late so churn does not resize
+     */
+    MAP_PROFILE_WRITE_HEAVY,
+
+    /**
+     * @brief Mostly lookups of absent keys, or long chains: grow early so a
+     *        miss walks fewer entries
+     */
+    MAP_PROFILE_MISS_HEAVY,
+
+    /**
+     * @brief Mostly lookups that hit: pack the table densely
+     */
+    MAP_PROFILE_READ_HEAVY,
+} map_profile_t;
+
+/**
+ * @brief Snapshot of a map's shape, counters and tuning
+ *
+ * Operation counters are only maintained by MAP_FLAG_ADAPTIVE maps and read 0
+ * otherwise.
+ */
+typedef struct map_stats {
+    /**
+     * @brief Number of entries
+     */
+    size_t count;
+
+    /**
+     * @brief Number of inline slots or table buckets
+     */
+    size_t capacity;
+
+    /**
+     * @brief Representation in use
+     */
+    map_engine_t engine;
+
+    /**
+     * @brief Profile chosen by the last decision
+     */
+    map_profile_t profile;
+
+    /**
+     * @brief Load factor, in percent, above which the table grows
+     */
+    uint32_t grow_load;
+
+    /**
+     * @brief Load factor, in percent, below which the table shrinks
+     */
+    uint32_t shrink_load;
+
+    /**
+     * @brief Entry count at or below which the map returns to the small
+     *        engine, 0 if it stays hashed
+     */
+    size_t small_limit;
+
+    /**
+     * @brief Number of map_get calls
+     */
+    uint64_t gets;
+
+    /**
+     * @brief Number of map_get calls that found their key
+     */
+    uint64_t hits;
+
+    /**
+     * @brief Number of map_put calls
+     */
+    uint64_t puts;
+
+    /**
+     * @brief Number of map_remove calls
+     */
+    uint64_t removes;
+
+    /**
+     * @brief Number of stored keys compared against a looked up key
+     */
+    uint64_t probes;
+
+    /**
+     * @brief Number of times the table was reallocated or the engine switched
+     */
+    uint64_t resizes;
+
+    /**
+     * @brief Number of decisions taken by an adaptive map
+     */
+    uint64_t adaptations;
+
+    /**
+     * @brief Number of times an insert found a chain longer than any uniform
+     *        hash produces and the map switched to a freshly keyed hash
+     */
+    uint64_t rekeys;
+
+    /**
+     * @brief Number of buckets whose chain grew long enough to be searched
+     *        through a sorted index
+     */
+    size_t indexed_buckets;
+
+    /**
+     * @brief Number of slabs holding entries moved there by map_compact
+     */
+    size_t slabs;
+} map_stats_t;
+
+/**
+ * @brief A single record drained from a change stream
+ */
+typedef struct map_change {
+    /**
+     * @brief Per-map sequence number; a gap means records were dropped
+     */
+    uint64_t seq;
+
+    /**
+     * @brief Kind of mutation
+     */
+    map_change_kind_t kind;
+
+    /**
+     * @brief The key that changed
+     */
+    const char* key;
+
+    /**
+     * @brief Length of the key
+     */
+    size_t len;
+
+    /**
+     * @brief New value for inserts and updates, last value for removals
+     */
+    const void* value;
+} map_change_t;
+
+/**
+ * @brief Callback invoked for every record by map_changes_drain
+ *
+ * @param ctx User context passed to map_changes_drain
+ * @param change The record, valid only for the duration of the call
+ */
+typedef void (*map_change_fn)(void* ctx, const map_change_t* change);
+
+/**
+ * @brief Callbacks and value comparison used by map_diff
+ *
+ * Any callback may be NULL. When `compare` is NULL values are compared with
+ * memcmp.
+ */
+typedef struct map_diff_ops {
+    /**
+     * @brief Called for keys present only in the second map
+     */
+    void (*on_added)(void* ctx, const char* key, size_t len, const void* value);
+
+    /**
+     * @brief Called for keys present only in the first map
+     */
+    void (*on_removed)(void* ctx, const char* key, size_t len, const void* value);
+
+    /**
+     * @brief Called for keys present in both maps with different values
+     */
+    void (*on_changed)(void* ctx, const char* key, size_t len, const void* old_value, const void* new_value);
+
+    /**
+     * @brief Returns zero when two values are equal
+     */
+    int (*compare)(void* ctx, const void* a, const void* b, size_t size);
+
+    /**
+     * @brief User context passed to every callback
+     */
+    void* ctx;
+} map_diff_ops_t;
+
+/**
+ * @brief Opaque replication endpoint, either a primary or a follower
+ */
+typedef struct map_repl map_repl_t;
+
+/**
+ * @brief Opaque multi-key transaction structure
+ */
+typedef struct map_txn map_txn_t;
+
+/**
+ * @brief Opaque work-stealing thread pool structure
+ */
+typedef struct map_pool map_pool_t;
+
+/**
+ * @brief Loop body run by map_pool_parallel_for
+ *
+ * @param arg User argument passed to map_pool_parallel_for
+ * @param index Loop index in [0, count)
+ */
+typedef void (*map_pool_fn)(void* arg, size_t index);
+
+/**
+ * @brief Callbacks that let a pool hand its tasks to an existing executor
+ */
+typedef struct map_executor {
+    /**
+     * @brief Runs `task(arg)` on some thread of the executor
+     *
+     * @return 0 if the task was accepted, non-zero to have it run inline
+     */
+    int (*submit)(void* ctx, void (*task)(void* arg), void* arg);
+
+    /**
+     * @brief User context passed to submit
+     */
+    void* ctx;
+} map_executor_t;
+
+/**
+ * @brief Callback invoked for every entry by map_foreach_parallel
+ *
+ * @param ctx User context passed to map_foreach_parallel
+ * @param key The entry's key
+ * @param len Length of the key
+ * @param value Pointer to the entry's value, which may be modified in place
+ */
+typedef void (*map_foreach_fn)(void* ctx, const char* key, size_t len, void* value);
+
+/**
+ * @brief Link of an intrusive map, embedded in the objects it stores
+ *
+ * The fields are private. An object can sit in several intrusive maps at once
+ * through several embedded nodes.
+ */
+typedef struct map_node {
+    struct map_node* next;
+    uint32_t hash;
+} map_node_t;
+
+/**
+ * @brief Returns the object a map_node_t is embedded in, as `type*`
+ */
+#define map_node_entry(node, type, member) ((type*)(void*)((char*)(node) - offsetof(type, member)))
+
+/**
+ * @brief Opaque intrusive map structure
+ */
+typedef struct map_intrusive map_intrusive_t;
+
+/**
+ * @brief How an intrusive map reads the keys of its objects
+ */
+typedef struct map_intrusive_ops {
+    /**
+     * @brief Returns the key of the object `node` is embedded in and stores its
+     *        length in `len`; the key must not change while the node is linked
+     */
+    const char* (*key)(const map_node_t* node, size_t* len);
+
+    /**
+     * @brief Returns true if the object's key equals `key`; may be NULL to
+     *        compare the bytes returned by `key`
+     */
+    bool (*equal)(const map_node_t* node, const char* key, size_t len);
+} map_intrusive_ops_t;
+
+/**
+ * @brief Callback invoked for every node by map_intrusive_foreach
+ *
+ * @param ctx User context passed to map_intrusive_foreach
+ * @param node The linked node, whose object may be freed by the callback
+ */
+typedef void (*map_intrusive_fn)(void* ctx, map_node_t* node);
+
 /**
  * @brief Creates a new map
  *
@@ -32,10 +533,131 @@ typedef struct map_iter map_iter_t;
  */
 map_t* map_create(size_t size);
 
+/**
+ * @brief Creates a new map with behaviour flags
+ *
+ * @param size Size in bytes of the values to be stored
+ * @param flags Bitwise OR of MAP_FLAG_* values, 0 behaves like map_create
+ * @return Pointer to the newly created map, or NULL on failure or unknown flags
+ */
+map_t* map_create_ex(size_t size, uint32_t flags);
+
+/**
+ * @brief Initializes a map in caller-provided storage
+ *
+ * Behaves like map_create_ex, but the map structure itself lives in
+ * `storage`, so a map embedded in a larger object costs no allocation of its
+ * own and no pointer hop to reach it. Combined with the inline slots of a
+ * small map, a map of up to 16 entries allocates only its entries. The map
+ * must be released with map_destroy, not map_free.
+ *
+ * @param storage Storage for the map, which must outlive it
+ * @param size Size in bytes of the values to be stored
+ * @param flags Bitwise OR of MAP_FLAG_* values
+ * @return Pointer to the map, which is `storage` itself, or NULL on failure
+ *         or unknown flags
+ */
+map_t* map_init(map_storage_t* storage, size_t size, uint32_t flags);
+
+/**
+ * @brief Releases everything a map initialized with map_init holds
+ *
+ * The storage is left zeroed and can be passed to map_init again.
+ *
+ * @param storage Storage initialized with map_init
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter, or storage not holding a map
+ */
+ssize_t map_destroy(map_storage_t* storage);
+
+/**
+ * @brief Creates an allocator for a family of maps
+ *
+ * A family owns arenas carved into size-classed pools. Maps created with
+ * map_create_in take their structure, bucket arrays and entries from those
+ * pools and return them there, instead of making separate heap allocations
+ * for each. The family is not thread-safe: all of its maps must be used by
+ * one thread at a time.
+ *
+ * @return Pointer to the new family, or NULL on failure
+ */
+map_family_t* map_family_create(void);
+
+/**
+ * @brief Creates a map whose memory comes from a family
+ *
+ * The map behaves like one created by map_create_ex and may be freed with
+ * map_free, which returns its memory to the family's pools. Flags that share
+ * the map with other threads (MAP_FLAG_CONCURRENT, MAP_FLAG_SINGLE_WRITER,
+ * MAP_FLAG_BACKGROUND_RESIZE and MAP_FLAG_COMBINING) are refused.
+ *
+ * @param family Family to allocate from
+ * @param size Size in bytes of the values to be stored
+ * @param flags Bitwise OR of MAP_FLAG_* values
+ * @return Pointer to the new map, or NULL on failure or unsupported flags
+ */
+map_t* map_create_in(map_family_t* family, size_t size, uint32_t flags);
+
+/**
+ * @brief Frees a family together with every map still created from it
+ *
+ * Takes time proportional to the number of arenas, not of maps or entries.
+ * Maps of the family must not be used afterwards, and iterators, caches,
+ * change streams, transactions and replicas of them must be freed first.
+ *
+ * @param family Family to free
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_family_free(map_family_t* family);
+
+/**
+ * @brief Longest distance, in slots, between a static map entry and the slot
+ *        its hash points at
+ */
+#define MAP_STATIC_PROBE_LIMIT (32)
+
+/**
+ * @brief Returns the buffer size map_init_static needs
+ *
+ * @param size Size in bytes of the values to be stored
+ * @param max_entries Number of entries the map must be able to hold
+ * @return Size in bytes, including room to align the buffer, or 0 if it does
+ *         not fit in a size_t
+ */
+size_t map_static_size(size_t size, size_t max_entries);
+
+/**
+ * @brief Builds a fixed-capacity map inside a caller-provided buffer
+ *
+ * The map, its slots and every key and value live in `buffer`; no operation
+ * on it ever allocates. Entries are stored by Robin Hood open addressing
+ * under a keyed hash, with room for keys of up to MAP_KEY_MAX_LEN bytes in
+ * every slot. map_put fails with -ENOSPC once `max_entries` are stored, or if
+ * storing the key would leave some entry more than MAP_STATIC_PROBE_LIMIT
+ * slots from home, so no lookup ever walks further; with the table kept at
+ * most three quarters full, that second case needs colliding keys.
+ *
+ * map_put, map_get, map_remove, their vector forms, map_count, map_stats,
+ * map_lookup_start and iteration work as on any map; map_iter_create
+ * allocates the iterator itself. Features that need allocations per entry,
+ * such as hooks, change streams, transactions, replication, read caches,
+ * diffs and parallel walks, refuse static maps. The map is not thread-safe.
+ * map_free returns without touching the buffer, which stays the caller's.
+ *
+ * @param buffer Memory for the map, of any alignment
+ * @param bytes Size of `buffer`, at least map_static_size(size, max_entries)
+ * @param size Size in bytes of the values to be stored
+ * @param max_entries Number of entries the map can hold
+ * @return Pointer to the map, somewhere inside `buffer`, or NULL if the
+ *         parameters are invalid or the buffer is too small
+ */
+map_t* map_init_static(void* buffer, size_t bytes, size_t size, size_t max_entries);
+
 /**
  * @brief Inserts a key-value pair into the map
  *
- * @param this Pointer to the map
+ * @param map Pointer to the map
  * @param key The key string
  * @param len Length of the key (including null terminator if needed)
  * @param element Pointer to the value to be stored
@@ -44,13 +666,14 @@ map_t* map_create(size_t size);
  *         -EEXIST: Key already exists
  *         -ENOMEM: Memory allocation failed
  *         -EOVERFLOW: Key too long
+ *         -ENOSPC: A static map is full
  */
-ssize_t map_put(map_t* this, const char* key, size_t len, void* element);
+ssize_t map_put(map_t* map, const char* key, size_t len, void* element);
 
 /**
  * @brief Retrieves a value from the map
  *
- * @param this Pointer to the map
+ * @param map Pointer to the map
  * @param key The key string
  * @param len Length of the key (including null terminator if needed)
  * @param out Pointer where the value will be stored
@@ -58,12 +681,12 @@ ssize_t map_put(map_t* this, const char* key, size_t len, void* element);
  *         -EINVAL: Invalid parameters
  *         -ENOENT: Key not found
  */
-ssize_t map_get(map_t* this, const char* key, size_t len, void* out);
+ssize_t map_get(map_t* map, const char* key, size_t len, void* out);
 
 /**
  * @brief Removes a key-value pair from the map
  *
- * @param this Pointer to the map
+ * @param map Pointer to the map
  * @param key The key string
  * @param len Length of the key (including null terminator if needed)
  * @param out Pointer where the removed value will be stored
@@ -71,53 +694,700 @@ ssize_t map_get(map_t* this, const char* key, size_t len, void* out);
  *         -EINVAL: Invalid parameters
  *         -ENOENT: Key not found
  */
-ssize_t map_remove(map_t* this, const char* key, size_t len, void* out);
+ssize_t map_remove(map_t* map, const char* key, size_t len, void* out);
+
+/**
+ * @brief Inserts a key-value pair whose key is the concatenation of `parts`
+ *
+ * The parts are hashed and compared where they lie; only the stored copy of a
+ * new key joins them. The entry is the same one map_put would create for the
+ * concatenated key.
+ *
+ * @param map Pointer to the map
+ * @param parts Pieces of the key, in order
+ * @param count Number of pieces
+ * @param element Pointer to the value to be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters or an empty key
+ *         -EEXIST: Key already exists
+ *         -ENOMEM: Memory allocation failed
+ *         -EOVERFLOW: Key too long
+ *         -ENOSPC: A static map is full
+ */
+ssize_t map_putv(map_t* map, const struct iovec* parts, size_t count, void* element);
+
+/**
+ * @brief Retrieves the value stored under the concatenation of `parts`
+ *
+ * @param map Pointer to the map
+ * @param parts Pieces of the key, in order
+ * @param count Number of pieces
+ * @param out Pointer where the value will be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters or an empty key
+ *         -ENOENT: Key not found
+ */
+ssize_t map_getv(map_t* map, const struct iovec* parts, size_t count, void* out);
+
+/**
+ * @brief Removes the entry stored under the concatenation of `parts`
+ *
+ * @param map Pointer to the map
+ * @param parts Pieces of the key, in order
+ * @param count Number of pieces
+ * @param out Pointer where the removed value will be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters or an empty key
+ *         -ENOENT: Key not found
+ */
+ssize_t map_removev(map_t* map, const struct iovec* parts, size_t count, void* out);
 
 /**
  * @brief Returns the number of key-value pairs in the map
  *
- * @param this Pointer to the map
+ * @param map Pointer to the map
  * @return Number of entries in the map
  */
-size_t map_count(const map_t* this);
+size_t map_count(const map_t* map);
 
 /**
- * @brief Frees all memory associated with the map
+ * @brief Tells a MAP_FLAG_KEY_64 map that its keys fall within [first, last]
+ *
+ * The map switches to a direct-addressed array covering the range and its
+ * current keys right away, and keeps it while entries are removed. Keys
+ * outside the range are still accepted, under the same rules as for a map
+ * that found its range by itself.
  *
- * @param this Pointer to the map
+ * @param map Pointer to a map created with MAP_FLAG_KEY_64 and without any
+ *            flag that shares it between threads
+ * @param first Smallest expected key
+ * @param last Largest expected key
  * @return 0 on success, negative error code on failure:
- *         -EINVAL: Invalid parameter
+ *         -EINVAL: Invalid parameters, or the map is shared or not keyed by uint64_t
+ *         -ERANGE: The range has more than UINT32_MAX keys
+ *         -ENOMEM: Memory allocation failed
  */
-ssize_t map_free(map_t* this);
+ssize_t map_set_key_range(map_t* map, uint64_t first, uint64_t last);
 
 /**
- * @brief Creates an iterator for the map
+ * @brief Moves entries into dense slabs and returns emptied memory to the OS
+ *
+ * Entries are normally allocated one by one, so after heavy removals the
+ * survivors sit scattered among freed blocks the allocator keeps. A compaction
+ * pass copies every entry, with its key, into slabs mapped from the OS, in
+ * bucket order, so that a chain and the entries an iterator visits next lie
+ * side by side. Each slab is unmapped as soon as its last entry is removed or
+ * moved on by a later pass. With glibc, the end of a pass also asks malloc to
+ * return the free pages the entries left behind. A pass can be spread over
+ * several calls: each call moves at most `budget` entries and resumes where the
+ * previous one stopped. Like any write, compaction invalidates iterators and
+ * unfinished lookups.
  *
  * @param map Pointer to the map
- * @return Pointer to the newly created iterator, or NULL on failure
+ * @param budget Largest number of entries to move in this call
+ * @return 0 once the pass is complete, negative error code otherwise:
+ *         -EAGAIN: The budget ran out; call again to continue the pass
+ *         -EINVAL: Invalid parameters, or a single-writer, static or family
+ *                  map
+ *         -ENOMEM: Memory allocation failed; the pass can be resumed
  */
-map_iter_t* map_iter_create(map_t* map);
+ssize_t map_compact(map_t* map, size_t budget);
 
 /**
- * @brief Gets the next key-value pair from the iterator
+ * @brief Fills `out` with a snapshot of the map's shape, counters and tuning
  *
- * @param iter Pointer to the iterator
- * @param key_out Pointer where the key will be stored
- * @param key_len_out Pointer where the key length will be stored
- * @param value_out Pointer where the value will be stored
- * @return 0 on success, negative error code on failure or end of iteration:
+ * @param map Pointer to the map
+ * @param out Pointer to the snapshot to fill
+ * @return 0 on success, negative error code on failure:
  *         -EINVAL: Invalid parameters
- *         -ENOENT: No more elements
  */
-ssize_t map_iter_next(map_iter_t* iter, void* key_out, size_t* key_len_out, void* value_out);
+ssize_t map_stats(const map_t* map, map_stats_t* out);
 
 /**
- * @brief Frees the iterator
+ * @brief State of one lookup that advances a memory access at a time
  *
- * @param iter Pointer to the iterator
+ * The fields are private. The structure is public so lookups can live on the
+ * caller's stack or inside a coroutine frame without an allocation.
+ */
+typedef struct map_lookup {
+    map_t* map;
+    const char* key;
+    size_t len;
+    void* out;
+    const void* node;
+    uint32_t hash;
+    int state;
+    ssize_t result;
+} map_lookup_t;
+
+/**
+ * @brief Reference to one entry that skips hashing and probing on access
+ *
+ * The fields are private. Entries stay where they are when the table is
+ * resized or switches engines, so a handle keeps working across those. Each
+ * map counts the entries it frees or moves, and a handle is only honoured
+ * while that count is unchanged since map_find_handle: after any removal, or
+ * a map_compact pass, every handle of the map reports -ESTALE and must be
+ * found again. A stale handle is detected without touching the entry it
+ * referred to, whose memory may be gone.
+ */
+typedef struct map_handle {
+    map_t* map;
+    void* node;
+    uint64_t generation;
+} map_handle_t;
+
+/**
+ * @brief Looks up `key` and returns a handle to its entry
+ *
+ * @param map Pointer to a map that is not static
+ * @param key The key string
+ * @param len Length of the key (including null terminator if needed)
+ * @param out Pointer to the handle to fill
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters, or a static map
+ *         -ENOENT: Key not found
+ */
+ssize_t map_find_handle(map_t* map, const char* key, size_t len, map_handle_t* out);
+
+/**
+ * @brief Copies the value of a handle's entry
+ *
+ * @param handle Handle filled by map_find_handle
+ * @param out Pointer where the value will be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ESTALE: The map has freed or moved entries since the handle was
+ *                  taken
+ */
+ssize_t map_handle_get(const map_handle_t* handle, void* out);
+
+/**
+ * @brief Overwrites the value of a handle's entry in place
+ *
+ * Reported to hooks and change streams as an update. On single-writer maps,
+ * call it from the writer thread.
+ *
+ * @param handle Handle filled by map_find_handle
+ * @param value Pointer to the new value
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ESTALE: The handle is stale; see map_handle_get
+ */
+ssize_t map_handle_put_value(const map_handle_t* handle, const void* value);
+
+/**
+ * @brief Removes a handle's entry
+ *
+ * Like every removal, this makes all handles of the map stale. On
+ * single-writer maps, call it from the writer thread.
+ *
+ * @param handle Handle filled by map_find_handle
+ * @param out Pointer where the removed value will be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ESTALE: The handle is stale; see map_handle_get
+ */
+ssize_t map_handle_remove(const map_handle_t* handle, void* out);
+
+/**
+ * @brief Starts a lookup and prefetches the bucket it needs first
+ *
+ * Every call to map_lookup_step then touches only memory that an earlier step
+ * prefetched, and prefetches what the next step needs. Interleaving the steps
+ * of many lookups overlaps their cache misses. Concurrent and single-writer
+ * maps complete the lookup immediately through map_get.
+ *
+ * @param lookup Lookup state to initialise
+ * @param map Pointer to the map
+ * @param key The key string, which must stay valid until the lookup is done
+ * @param len Length of the key (including null terminator if needed)
+ * @param out Pointer where the value will be stored if found
+ */
+void map_lookup_start(map_lookup_t* lookup, map_t* map, const char* key, size_t len, void* out);
+
+/**
+ * @brief Advances a lookup by one memory access
+ *
+ * @param lookup Lookup state
+ * @return true once the lookup has finished and its result is available
+ */
+bool map_lookup_step(map_lookup_t* lookup);
+
+/**
+ * @brief Returns the result of a finished lookup
+ *
+ * @param lookup Lookup state
+ * @return 0 if the key was found, negative error code otherwise:
+ *         -EINVAL: Invalid parameters
+ *         -ENOENT: Key not found
+ *         -EAGAIN: The lookup has not finished yet
+ */
+ssize_t map_lookup_result(const map_lookup_t* lookup);
+
+/**
+ * @brief Runs a group of started lookups round-robin until all have finished
+ *
+ * @param lookups Array of lookups started with map_lookup_start
+ * @param count Number of lookups
+ * @return Number of lookups that found their key
+ */
+size_t map_lookup_run(map_lookup_t* lookups, size_t count);
+
+/**
+ * @brief Frees all memory associated with the map
+ *
+ * @param map Pointer to the map
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter, or a map initialized with map_init
+ */
+ssize_t map_free(map_t* map);
+
+/**
+ * @brief Creates an iterator for the map
+ *
+ * Iteration is not synchronized: on concurrent maps no other thread may modify
+ * the map while the iterator is in use, and on single-writer maps only the
+ * writer thread may iterate.
+ *
+ * @param map Pointer to the map
+ * @return Pointer to the newly created iterator, or NULL on failure
+ */
+map_iter_t* map_iter_create(map_t* map);
+
+/**
+ * @brief Gets the next key-value pair from the iterator
+ *
+ * @param iter Pointer to the iterator
+ * @param key_out Pointer where the key will be stored
+ * @param key_len_out Pointer where the key length will be stored
+ * @param value_out Pointer where the value will be stored
+ * @return 0 on success, negative error code on failure or end of iteration:
+ *         -EINVAL: Invalid parameters
+ *         -ENOENT: No more elements
+ */
+ssize_t map_iter_next(map_iter_t* iter, void* key_out, size_t* key_len_out, void* value_out);
+
+/**
+ * @brief Frees the iterator
+ *
+ * @param iter Pointer to the iterator
  * @return 0 on success, negative error code on failure:
  *         -EINVAL: Invalid parameter
  */
 ssize_t map_iter_free(map_iter_t* iter);
 
+/**
+ * @brief Installs mutation hooks on the map
+ *
+ * @param map Pointer to the map
+ * @param hooks Hooks to copy into the map, or NULL to remove them
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_set_hooks(map_t* map, const map_hooks_t* hooks);
+
+/**
+ * @brief Attaches a change stream to the map
+ *
+ * Every mutation is appended to a lock-free single-producer/single-consumer
+ * ring buffer that one consumer thread drains in batches. When the ring is
+ * full new records are dropped; consumers notice the gap in sequence numbers
+ * and resynchronize. A map has at most one change stream.
+ *
+ * @param map Pointer to the map
+ * @param capacity Number of records the ring holds, rounded up to a power of two
+ * @return Pointer to the stream, or NULL on failure or if one is attached
+ */
+map_changes_t* map_changes_create(map_t* map, size_t capacity);
+
+/**
+ * @brief Hands up to `max` pending records to `fn`, oldest first
+ *
+ * @param changes Pointer to the stream
+ * @param fn Callback invoked once per record
+ * @param ctx User context passed to fn
+ * @param max Maximum number of records to drain
+ * @return Number of records drained, or negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ */
+ssize_t map_changes_drain(map_changes_t* changes, map_change_fn fn, void* ctx, size_t max);
+
+/**
+ * @brief Returns how many records were dropped because the ring was full
+ *
+ * Lets a consumer notice overflow even when no later record arrives to reveal
+ * the gap in sequence numbers.
+ *
+ * @param changes Pointer to the stream
+ * @return Number of dropped records, or 0 if changes is NULL
+ */
+uint64_t map_changes_dropped(const map_changes_t* changes);
+
+/**
+ * @brief Detaches the stream from its map and frees it
+ *
+ * @param changes Pointer to the stream
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_changes_free(map_changes_t* changes);
+
+/**
+ * @brief Reports the differences that turn map `a` into map `b`
+ *
+ * Lookups reuse the hashes stored with each entry, and both maps are walked
+ * bucket by bucket so that equally sized tables are compared with sequential
+ * access. Both maps are locked for the duration; callbacks must not call back
+ * into either map. Single-writer maps have no lock to take, so a
+ * single-writer map may only be diffed on its writer thread.
+ *
+ * @param a Pointer to the old map
+ * @param b Pointer to the new map
+ * @param ops Callbacks receiving the differences
+ * @return Number of differences reported, or negative error code on failure:
+ *         -EINVAL: Invalid parameters or maps with different value sizes
+ */
+ssize_t map_diff(map_t* a, map_t* b, const map_diff_ops_t* ops);
+
+/**
+ * @brief Creates the primary end of a replication link
+ *
+ * Attaches a change stream of `capacity` records to the map. Each call to
+ * map_repl_flush sends the changes recorded since the previous call as one
+ * batch. When the follower falls so far behind that the stream overflows, the
+ * primary sends a full snapshot instead. The descriptor must be a connected
+ * Unix or TCP stream socket; it is not closed by map_repl_free. Records use
+ * host byte order, so both ends must share an architecture.
+ *
+ * @param map Pointer to the map to replicate
+ * @param fd Connected stream socket to the follower
+ * @param capacity Number of changes buffered between flushes
+ * @return Pointer to the endpoint, or NULL on failure
+ */
+map_repl_t* map_repl_primary_create(map_t* map, int fd, size_t capacity);
+
+/**
+ * @brief Creates the follower end of a replication link
+ *
+ * @param map Pointer to the map that mirrors the primary
+ * @param fd Connected stream socket to the primary
+ * @return Pointer to the endpoint, or NULL on failure
+ */
+map_repl_t* map_repl_follower_create(map_t* map, int fd);
+
+/**
+ * @brief Sends the pending changes, or a snapshot when the follower needs one
+ *
+ * The first flush always sends a snapshot. Sending blocks while the socket is
+ * full, which pushes back on the primary without stalling its writers. For
+ * single-writer maps, call it on the writer thread.
+ *
+ * @param repl Pointer to a primary endpoint
+ * @return Number of records sent, or negative error code on failure:
+ *         -EINVAL: Invalid parameter or not a primary
+ *         -ENOMEM: Memory allocation failed
+ *         -EOVERFLOW: Batch larger than 4 GiB
+ *         Other negative errno values reported by send()
+ */
+ssize_t map_repl_flush(map_repl_t* repl);
+
+/**
+ * @brief Receives one batch from the primary and applies it to the map
+ *
+ * Blocks until a batch arrives. The batch is applied in a single write
+ * section, so readers of the follower never see part of it.
+ *
+ * @param repl Pointer to a follower endpoint
+ * @return Number of records applied, or negative error code on failure:
+ *         -EINVAL: Invalid parameter or not a follower
+ *         -ECONNRESET: The primary closed the connection
+ *         -EPROTO: Malformed batch, mismatched value size, or missing changes
+ *         -ENOMEM: Memory allocation failed
+ *         Other negative errno values reported by recv()
+ */
+ssize_t map_repl_poll(map_repl_t* repl);
+
+/**
+ * @brief Returns the sequence number of the last change sent or applied
+ *
+ * @param repl Pointer to the endpoint
+ * @return The sequence number, or 0 if nothing was replicated yet
+ */
+uint64_t map_repl_seq(const map_repl_t* repl);
+
+/**
+ * @brief Frees the endpoint, leaving the map and the socket open
+ *
+ * @param repl Pointer to the endpoint
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_repl_free(map_repl_t* repl);
+
+/**
+ * @brief Starts a transaction that updates several keys atomically
+ *
+ * Operations are staged privately and only reach the map on commit, where they
+ * are applied together in one write section. Readers never observe part of a
+ * committed transaction.
+ *
+ * @param map Pointer to the map
+ * @return Pointer to the new transaction, or NULL on failure
+ */
+map_txn_t* map_txn_begin(map_t* map);
+
+/**
+ * @brief Stages an insert or overwrite of a key
+ *
+ * Unlike map_put an existing key is overwritten on commit. The key and value
+ * are copied, so the caller's buffers may be reused right away.
+ *
+ * @param txn Pointer to the transaction
+ * @param key The key string
+ * @param len Length of the key (including null terminator if needed)
+ * @param element Pointer to the value to be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOMEM: Memory allocation failed
+ *         -EOVERFLOW: Key too long
+ */
+ssize_t map_txn_put(map_txn_t* txn, const char* key, size_t len, const void* element);
+
+/**
+ * @brief Stages the removal of a key
+ *
+ * On commit the key must exist in the map, unless it was put earlier in the
+ * same transaction.
+ *
+ * @param txn Pointer to the transaction
+ * @param key The key string
+ * @param len Length of the key (including null terminator if needed)
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOMEM: Memory allocation failed
+ *         -EOVERFLOW: Key too long
+ */
+ssize_t map_txn_remove(map_txn_t* txn, const char* key, size_t len);
+
+/**
+ * @brief Applies every staged operation atomically and frees the transaction
+ *
+ * Either all operations take effect or, on failure, none do. The transaction
+ * is freed in both cases.
+ *
+ * @param txn Pointer to the transaction
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ *         -ENOENT: A removed key does not exist
+ *         -ENOMEM: Memory allocation failed
+ */
+ssize_t map_txn_commit(map_txn_t* txn);
+
+/**
+ * @brief Discards every staged operation and frees the transaction
+ *
+ * @param txn Pointer to the transaction
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_txn_abort(map_txn_t* txn);
+
+/**
+ * @brief Creates a read cache in front of a map
+ *
+ * The cache is a small direct-mapped table of recently read entries owned by
+ * the calling thread; create one per reader thread. Entries are tagged with the
+ * map's write version, so any write to the map invalidates them all without
+ * touching the caches themselves.
+ *
+ * @param map Pointer to the map, which must outlive the cache
+ * @param slots Number of cache slots, rounded up to a power of two
+ * @return Pointer to the newly created cache, or NULL on failure
+ */
+map_cache_t* map_cache_create(map_t* map, size_t slots);
+
+/**
+ * @brief Retrieves a value through the read cache
+ *
+ * Behaves like map_get, but hits are served from the cache without touching
+ * the map's table or lock.
+ *
+ * @param cache Pointer to the cache
+ * @param key The key string
+ * @param len Length of the key (including null terminator if needed)
+ * @param out Pointer where the value will be stored
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOENT: Key not found
+ */
+ssize_t map_cache_get(map_cache_t* cache, const char* key, size_t len, void* out);
+
+/**
+ * @brief Frees the read cache
+ *
+ * @param cache Pointer to the cache
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_cache_free(map_cache_t* cache);
+
+/**
+ * @brief Creates a work-stealing thread pool
+ *
+ * Each worker owns a Chase-Lev deque; idle workers steal from the others, so
+ * parallel map operations share the cores instead of spawning threads per call.
+ *
+ * @param threads Number of worker threads, 0 for one per online CPU
+ * @return Pointer to the newly created pool, or NULL on failure
+ */
+map_pool_t* map_pool_create(size_t threads);
+
+/**
+ * @brief Creates a pool that runs its tasks on an external executor
+ *
+ * @param executor Callbacks used to submit tasks, copied into the pool
+ * @param concurrency Number of tasks the executor can run at once, used to
+ *        decide how finely work is split
+ * @return Pointer to the newly created pool, or NULL on failure
+ */
+map_pool_t* map_pool_create_external(const map_executor_t* executor, size_t concurrency);
+
+/**
+ * @brief Runs fn(arg, i) for every i in [0, count) on the pool and waits
+ *
+ * The calling thread takes part in the work. May be called from inside a task
+ * running on the same pool.
+ *
+ * @param pool Pointer to the pool
+ * @param count Number of loop iterations
+ * @param fn Loop body
+ * @param arg User argument passed to fn
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOMEM: Memory allocation failed
+ */
+ssize_t map_pool_parallel_for(map_pool_t* pool, size_t count, map_pool_fn fn, void* arg);
+
+/**
+ * @brief Stops the workers and frees the pool
+ *
+ * @param pool Pointer to the pool
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_pool_free(map_pool_t* pool);
+
+/**
+ * @brief Calls fn for every entry of the map, spread over the pool's threads
+ *
+ * The map must not be modified while this runs; concurrent maps are kept
+ * locked for the duration. fn must not call into the map at all, not even
+ * map_get or map_count: on a concurrent map they would wait for the lock this
+ * call holds.
+ *
+ * @param map Pointer to the map
+ * @param pool Pointer to the pool
+ * @param fn Callback invoked once per entry, from any pool thread
+ * @param ctx User context passed to fn
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOMEM: Memory allocation failed
+ */
+ssize_t map_foreach_parallel(map_t* map, map_pool_t* pool, map_foreach_fn fn, void* ctx);
+
+/**
+ * @brief Creates an intrusive map
+ *
+ * An intrusive map stores objects the caller has already allocated: each
+ * embeds a map_node_t, which the map links into its buckets as is. Inserting
+ * allocates nothing but the occasional larger bucket array, and a lookup
+ * returns the caller's own object. The map never owns, copies or frees the
+ * objects. Like a map created without flags, it is not thread-safe.
+ *
+ * @param ops Key callbacks, copied into the map
+ * @return Pointer to the newly created map, or NULL on failure
+ */
+map_intrusive_t* map_intrusive_create(const map_intrusive_ops_t* ops);
+
+/**
+ * @brief Links `node` under the key its object currently holds
+ *
+ * @param map Pointer to the intrusive map
+ * @param node Unlinked node embedded in the object to store
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -EEXIST: An object with the same key is already linked
+ *         -ENOMEM: The bucket array could not grow
+ */
+ssize_t map_intrusive_insert(map_intrusive_t* map, map_node_t* node);
+
+/**
+ * @brief Finds the node of the object stored under `key`
+ *
+ * @param map Pointer to the intrusive map
+ * @param key The key bytes
+ * @param len Length of the key
+ * @return The node, or NULL if no object has this key
+ */
+map_node_t* map_intrusive_find(const map_intrusive_t* map, const char* key, size_t len);
+
+/**
+ * @brief Unlinks the object stored under `key`
+ *
+ * @param map Pointer to the intrusive map
+ * @param key The key bytes
+ * @param len Length of the key
+ * @return The unlinked node, now owned by the caller again, or NULL if no
+ *         object has this key
+ */
+map_node_t* map_intrusive_remove(map_intrusive_t* map, const char* key, size_t len);
+
+/**
+ * @brief Unlinks a node the caller already holds, without a key lookup
+ *
+ * @param map Pointer to the intrusive map
+ * @param node Node linked into this map
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ *         -ENOENT: The node is not linked into this map
+ */
+ssize_t map_intrusive_unlink(map_intrusive_t* map, map_node_t* node);
+
+/**
+ * @brief Returns the number of linked nodes
+ *
+ * @param map Pointer to the intrusive map
+ * @return Number of linked nodes
+ */
+size_t map_intrusive_count(const map_intrusive_t* map);
+
+/**
+ * @brief Calls fn for every linked node
+ *
+ * fn must not link or unlink nodes. It may free the object it is handed,
+ * which is how an owner tears its objects down before map_intrusive_free; the
+ * map must not be used for anything else after that.
+ *
+ * @param map Pointer to the intrusive map
+ * @param fn Callback invoked once per node
+ * @param ctx User context passed to fn
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameters
+ */
+ssize_t map_intrusive_foreach(map_intrusive_t* map, map_intrusive_fn fn, void* ctx);
+
+/**
+ * @brief Frees the intrusive map, leaving the objects it linked alone
+ *
+ * @param map Pointer to the intrusive map
+ * @return 0 on success, negative error code on failure:
+ *         -EINVAL: Invalid parameter
+ */
+ssize_t map_intrusive_free(map_intrusive_t* map);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* MAP_H */
@@ -0,0 +1,230 @@
+/**
+ * @file map.hpp
+ * @brief C++20 coroutine wrapper around the interleaved lookup API
+ *
+ * Handlers written as coroutines await lookups one key at a time:
+ *
+ * @code
+ * map_async::task handle(map_async::table<int>& users, std::string_view name) {
+ *     std::optional<int> id = co_await users.find_async(name);
+ *     ...
+ * }
+ *
+ * map_async::scheduler scheduler;
+ * map_async::table<int> users(raw_map, scheduler);
+ * for (auto& request : requests) {
+ *     handle(users, request.name);
+ * }
+ * scheduler.run();
+ * @endcode
+ *
+ * Each co_await prefetches the first bucket and suspends. The scheduler steps
+ * every suspended lookup in turn, so while one lookup waits for its cache miss
+ * the others make progress, and resumes each coroutine when its result is in.
+ * Coroutines and the scheduler must stay on one thread.
+ */
+
+#ifndef MAP_HPP
+#define MAP_HPP
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "map.h"
+
+namespace map_async {
+
+class scheduler;
+
+/**
+ * @brief Awaitable for a single lookup that writes its value to `out`
+ */
+class find_awaiter {
+public:
+    find_awaiter(scheduler& sched, map_t* map, std::string_view key, void* out) noexcept
+        : scheduler_(&sched), map_(map), key_(key), out_(out) {}
+
+    // The scheduler keeps a pointer to the awaiter while it is suspended
+    find_awaiter(const find_awaiter&) = delete;
+    find_awaiter& operator=(const find_awaiter&) = delete;
+
+    bool await_ready() noexcept {
+        map_lookup_start(&lookup_, map_, key_.data(), key_.size(), out_);
+        return map_lookup_result(&lookup_) != -EAGAIN;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept;
+
+    /**
+     * @return 0 if the key was found, negative error code otherwise
+     */
+    ssize_t await_resume() const noexcept {
+        return map_lookup_result(&lookup_);
+    }
+
+private:
+    friend class scheduler;
+
+    scheduler* scheduler_;
+    map_t* map_;
+    std::string_view key_;
+    void* out_;
+    map_lookup_t lookup_{};
+    std::coroutine_handle<> handle_{};
+};
+
+/**
+ * @brief Drives suspended lookups until every one of them has completed
+ */
+class scheduler {
+public:
+    scheduler() = default;
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    /**
+     * @brief Steps the suspended lookups round-robin, resuming each coroutine
+     *        as soon as its lookup is done
+     *
+     * Lookups started by resumed coroutines join the next pass, giving the
+     * prefetch they issued a full pass to land.
+     */
+    void run() {
+        while (!inflight_.empty() || !incoming_.empty()) {
+            inflight_.insert(inflight_.end(), incoming_.begin(), incoming_.end());
+            incoming_.clear();
+
+            // Keep unfinished lookups in order so each one waits a whole pass
+            std::size_t kept = 0;
+            for (find_awaiter* op : inflight_) {
+                if (map_lookup_step(&op->lookup_)) {
+                    op->handle_.resume();
+                } else {
+                    inflight_[kept++] = op;
+                }
+            }
+            inflight_.resize(kept);
+        }
+    }
+
+    /**
+     * @return Number of lookups currently suspended
+     */
+    std::size_t pending() const noexcept {
+        return inflight_.size() + incoming_.size();
+    }
+
+private:
+    friend class find_awaiter;
+
+    void enqueue(find_awaiter* op) {
+        incoming_.push_back(op);
+    }
+
+    std::vector<find_awaiter*> inflight_;
+    std::vector<find_awaiter*> incoming_;
+};
+
+inline void find_awaiter::await_suspend(std::coroutine_handle<> handle) noexcept {
+    handle_ = handle;
+    scheduler_->enqueue(this);
+}
+
+/**
+ * @brief Awaitable that yields the value as std::optional<T>
+ */
+template <typename T>
+class typed_find_awaiter {
+public:
+    typed_find_awaiter(scheduler& sched, map_t* map, std::string_view key) noexcept
+        : inner_(sched, map, key, &value_) {}
+
+    typed_find_awaiter(const typed_find_awaiter&) = delete;
+    typed_find_awaiter& operator=(const typed_find_awaiter&) = delete;
+
+    bool await_ready() noexcept {
+        return inner_.await_ready();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+        inner_.await_suspend(handle);
+    }
+
+    std::optional<T> await_resume() const noexcept {
+        if (inner_.await_resume() != 0) {
+            return std::nullopt;
+        }
+        return value_;
+    }
+
+private:
+    T value_{};
+    find_awaiter inner_;
+};
+
+/**
+ * @brief Non-owning view of a map whose values are of type T
+ *
+ * T must be trivially copyable and exactly as large as the map's value size.
+ */
+template <typename T>
+class table {
+    static_assert(std::is_trivially_copyable_v<T>, "map values are copied bytewise");
+
+public:
+    table(map_t* map, scheduler& sched) noexcept : map_(map), scheduler_(&sched) {}
+
+    /**
+     * @brief Looks up `key`; the key's bytes must outlive the co_await
+     */
+    typed_find_awaiter<T> find_async(std::string_view key) const noexcept {
+        return typed_find_awaiter<T>(*scheduler_, map_, key);
+    }
+
+    map_t* get() const noexcept {
+        return map_;
+    }
+
+private:
+    map_t* map_;
+    scheduler* scheduler_;
+};
+
+/**
+ * @brief Minimal eager coroutine for handlers whose result nobody awaits
+ *
+ * It starts running immediately, frees itself when it finishes, and
+ * terminates the program if the body throws.
+ */
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+} // namespace map_async
+
+#endif /* MAP_HPP */
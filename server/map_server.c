@@ -0,0 +1,1023 @@
+/**
+ * RESP server sharing sharded maps between clients. Supports the GET, SET,
+ * DEL, MGET and SCAN subset of the Redis protocol plus PING and QUIT, so
+ * redis-benchmark and redis-cli can drive it.
+ *
+ * Every core runs its own epoll loop and owns one shard map; keys are spread
+ * over the shards by hash and any loop may touch any shard. Values live in
+ * separately allocated blobs whose pointers are stored in the maps, so replies
+ * point straight at them. Blobs replaced or removed by a write are retired
+ * through the maps' hooks and freed once every loop has finished the batch
+ * it was working on.
+ *
+ * Usage: map_server [port] [threads]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <map/map.h>
+
+#define SERVER_DEFAULT_PORT (6379)
+#define SERVER_MAX_ARGS     (1024)
+#define SERVER_MAX_BULK     (512u * 1024u * 1024u)
+#define SERVER_BATCH        (64)
+#define SERVER_EVENTS       (128)
+#define SERVER_READ_CHUNK   (16384)
+#define SERVER_PENDING_MAX  (64u * 1024u * 1024u)
+#define SERVER_OFFLINE      (UINT64_MAX)
+
+typedef struct blob {
+    uint32_t len;
+    char data[];
+} blob_t;
+
+typedef struct buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+} buffer_t;
+
+/**
+ * A piece of a reply: either bytes in the connection's header buffer (base is
+ * NULL and off is an offset) or a value blob referenced in place.
+ */
+typedef struct segment {
+    const char* base;
+    size_t off;
+    size_t len;
+} segment_t;
+
+typedef struct arg {
+    const char* ptr;
+    size_t len;
+} arg_t;
+
+typedef struct conn {
+    struct conn* prev;
+    struct conn* next;
+    int fd;
+    buffer_t in;
+    size_t parsed;
+    buffer_t out;
+    buffer_t pending;
+    size_t pending_off;
+    segment_t* segments;
+    size_t segment_count;
+    size_t segment_cap;
+    bool closing;
+} conn_t;
+
+typedef struct staged {
+    size_t shard;
+    const char* key;
+    size_t len;
+    blob_t* blob;
+} staged_t;
+
+typedef struct retired {
+    blob_t* blob;
+    uint64_t tag;
+} retired_t;
+
+typedef struct worker {
+    pthread_t thread;
+    int epoll_fd;
+    conn_t* conns;
+    _Alignas(64) _Atomic uint64_t epoch;
+    retired_t* retired;
+    size_t retired_count;
+    size_t retired_cap;
+    staged_t staged[SERVER_BATCH];
+    size_t staged_count;
+    arg_t args[SERVER_MAX_ARGS];
+} worker_t;
+
+static map_t** shards;
+static size_t shard_count;
+static worker_t* workers;
+static size_t worker_count;
+static int listen_fd = -1;
+static _Atomic uint64_t global_epoch = 1;
+static atomic_bool stopping;
+static _Thread_local worker_t* current_worker;
+
+static void on_signal(int sig) {
+    (void)sig;
+    atomic_store(&stopping, true);
+}
+
+static uint64_t fnv1a(const char* key, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static size_t shard_of(const char* key, size_t len) {
+    return (size_t)(fnv1a(key, len) % shard_count);
+}
+
+/* ----------------------------------------------------------------------------
+ * Blob reclamation
+ *
+ * A loop is online while it handles a batch of events and offline while it
+ * waits in epoll. Blobs are retired with the global epoch they were unlinked
+ * in and freed once every online loop has announced a later epoch.
+ * ------------------------------------------------------------------------- */
+
+static void blob_retire(const void* value) {
+    blob_t* blob = NULL;
+    memcpy(&blob, value, sizeof(blob));
+
+    worker_t* self = current_worker;
+    if (self->retired_count == self->retired_cap) {
+        size_t cap         = self->retired_cap ? self->retired_cap * 2 : 256;
+        retired_t* retired = realloc(self->retired, cap * sizeof(*retired));
+        if (retired == NULL) {
+            // Leaking one blob beats freeing it under a reader
+            return;
+        }
+        self->retired     = retired;
+        self->retired_cap = cap;
+    }
+
+    self->retired[self->retired_count++] = (retired_t){
+        .blob = blob,
+        .tag  = atomic_fetch_add(&global_epoch, 1),
+    };
+}
+
+static void on_update(void* ctx, const char* key, size_t len, const void* old_value, const void* new_value) {
+    (void)ctx;
+    (void)key;
+    (void)len;
+    (void)new_value;
+    blob_retire(old_value);
+}
+
+static void on_remove(void* ctx, const char* key, size_t len, const void* value) {
+    (void)ctx;
+    (void)key;
+    (void)len;
+    blob_retire(value);
+}
+
+static void worker_reclaim(worker_t* self) {
+    uint64_t oldest = SERVER_OFFLINE;
+    for (size_t i = 0; i < worker_count; i++) {
+        uint64_t epoch = atomic_load(&workers[i].epoch);
+        if (epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < self->retired_count; i++) {
+        if (self->retired[i].tag < oldest) {
+            free(self->retired[i].blob);
+        } else {
+            self->retired[kept++] = self->retired[i];
+        }
+    }
+    self->retired_count = kept;
+}
+
+/* ----------------------------------------------------------------------------
+ * Reply building
+ * ------------------------------------------------------------------------- */
+
+static bool buffer_reserve(buffer_t* buffer, size_t extra) {
+    if (buffer->len + extra <= buffer->cap) {
+        return true;
+    }
+
+    size_t cap = buffer->cap ? buffer->cap : 4096;
+    while (cap < buffer->len + extra) {
+        cap *= 2;
+    }
+
+    char* data = realloc(buffer->data, cap);
+    if (data == NULL) {
+        return false;
+    }
+
+    buffer->data = data;
+    buffer->cap  = cap;
+    return true;
+}
+
+static bool conn_segment(conn_t* conn, const char* base, size_t off, size_t len) {
+    // Extend the previous header segment when the bytes are adjacent
+    if (base == NULL && conn->segment_count > 0) {
+        segment_t* last = &conn->segments[conn->segment_count - 1];
+        if (last->base == NULL && last->off + last->len == off) {
+            last->len += len;
+            return true;
+        }
+    }
+
+    if (conn->segment_count == conn->segment_cap) {
+        size_t cap          = conn->segment_cap ? conn->segment_cap * 2 : 64;
+        segment_t* segments = realloc(conn->segments, cap * sizeof(*segments));
+        if (segments == NULL) {
+            return false;
+        }
+        conn->segments    = segments;
+        conn->segment_cap = cap;
+    }
+
+    conn->segments[conn->segment_count++] = (segment_t){.base = base, .off = off, .len = len};
+    return true;
+}
+
+static bool reply_raw(conn_t* conn, const char* bytes, size_t len) {
+    if (!buffer_reserve(&conn->out, len)) {
+        return false;
+    }
+
+    size_t off = conn->out.len;
+    memcpy(conn->out.data + off, bytes, len);
+    conn->out.len += len;
+    return conn_segment(conn, NULL, off, len);
+}
+
+static bool reply_str(conn_t* conn, const char* text) {
+    return reply_raw(conn, text, strlen(text));
+}
+
+static bool reply_prefix(conn_t* conn, char type, uint64_t value) {
+    char line[32];
+    int len = snprintf(line, sizeof(line), "%c%llu\r\n", type, (unsigned long long)value);
+    return reply_raw(conn, line, (size_t)len);
+}
+
+static bool reply_bulk(conn_t* conn, const char* bytes, size_t len) {
+    return reply_prefix(conn, '$', len) && reply_raw(conn, bytes, len) && reply_raw(conn, "\r\n", 2);
+}
+
+/**
+ * Replies with a value without copying it; the blob stays alive until this
+ * loop goes offline, by which time the bytes are sent or copied.
+ */
+static bool reply_blob(conn_t* conn, const blob_t* blob) {
+    return reply_prefix(conn, '$', blob->len) && conn_segment(conn, blob->data, 0, blob->len) &&
+           reply_raw(conn, "\r\n", 2);
+}
+
+/* ----------------------------------------------------------------------------
+ * Commands
+ * ------------------------------------------------------------------------- */
+
+static bool arg_is(const arg_t* arg, const char* name) {
+    size_t len = strlen(name);
+    if (arg->len != len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        char c = arg->ptr[i];
+        if (c >= 'a' && c <= 'z') {
+            c = (char)(c - 'a' + 'A');
+        }
+        if (c != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool key_valid(const arg_t* key) {
+    return key->len > 0 && key->len <= MAP_KEY_MAX_LEN;
+}
+
+/**
+ * Commits the pipelined SETs, one transaction per shard, and queues their
+ * replies. Replies to SETs are always the last ones queued because any other
+ * command flushes first.
+ */
+static bool flush_sets(worker_t* self, conn_t* conn) {
+    if (self->staged_count == 0) {
+        return true;
+    }
+
+    ssize_t status[SERVER_BATCH];
+    for (size_t i = 0; i < self->staged_count; i++) {
+        status[i] = 1;
+    }
+
+    for (size_t i = 0; i < self->staged_count; i++) {
+        if (status[i] != 1) {
+            continue;
+        }
+
+        size_t shard   = self->staged[i].shard;
+        map_txn_t* txn = map_txn_begin(shards[shard]);
+        ssize_t result = txn != NULL ? 0 : -ENOMEM;
+
+        for (size_t j = i; j < self->staged_count && result == 0; j++) {
+            if (self->staged[j].shard == shard) {
+                result = map_txn_put(txn, self->staged[j].key, self->staged[j].len, &self->staged[j].blob);
+            }
+        }
+
+        if (result == 0) {
+            result = map_txn_commit(txn);
+        } else if (txn != NULL) {
+            map_txn_abort(txn);
+        }
+
+        for (size_t j = i; j < self->staged_count; j++) {
+            if (self->staged[j].shard == shard) {
+                status[j] = result;
+            }
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < self->staged_count; i++) {
+        if (status[i] == 0) {
+            ok = ok && reply_str(conn, "+OK\r\n");
+        } else {
+            free(self->staged[i].blob);
+            ok = ok && reply_str(conn, "-ERR out of memory\r\n");
+        }
+    }
+
+    self->staged_count = 0;
+    return ok;
+}
+
+static bool cmd_set(worker_t* self, conn_t* conn, const arg_t* args, size_t argc) {
+    if (argc != 3) {
+        return flush_sets(self, conn) && reply_str(conn, "-ERR syntax error\r\n");
+    }
+
+    if (!key_valid(&args[1]) || args[2].len > UINT32_MAX) {
+        return flush_sets(self, conn) && reply_str(conn, "-ERR invalid key or value\r\n");
+    }
+
+    // A transaction keeps only the last value staged per key, so a repeated
+    // key or a full batch commits what is staged first
+    size_t shard = shard_of(args[1].ptr, args[1].len);
+    bool flush   = self->staged_count == SERVER_BATCH;
+    for (size_t i = 0; i < self->staged_count && !flush; i++) {
+        flush = self->staged[i].len == args[1].len && memcmp(self->staged[i].key, args[1].ptr, args[1].len) == 0;
+    }
+    if (flush && !flush_sets(self, conn)) {
+        return false;
+    }
+
+    blob_t* blob = malloc(sizeof(*blob) + args[2].len);
+    if (blob == NULL) {
+        return flush_sets(self, conn) && reply_str(conn, "-ERR out of memory\r\n");
+    }
+    blob->len = (uint32_t)args[2].len;
+    memcpy(blob->data, args[2].ptr, args[2].len);
+
+    self->staged[self->staged_count++] = (staged_t){
+        .shard = shard,
+        .key   = args[1].ptr,
+        .len   = args[1].len,
+        .blob  = blob,
+    };
+    return true;
+}
+
+static bool reply_get(conn_t* conn, const arg_t* key) {
+    blob_t* blob = NULL;
+    if (!key_valid(key) || map_get(shards[shard_of(key->ptr, key->len)], key->ptr, key->len, &blob) != 0) {
+        return reply_str(conn, "$-1\r\n");
+    }
+    return reply_blob(conn, blob);
+}
+
+static bool cmd_get(conn_t* conn, const arg_t* args, size_t argc) {
+    if (argc != 2) {
+        return reply_str(conn, "-ERR wrong number of arguments for 'get' command\r\n");
+    }
+    return reply_get(conn, &args[1]);
+}
+
+static bool cmd_mget(conn_t* conn, const arg_t* args, size_t argc) {
+    if (argc < 2) {
+        return reply_str(conn, "-ERR wrong number of arguments for 'mget' command\r\n");
+    }
+
+    bool ok = reply_prefix(conn, '*', argc - 1);
+    for (size_t i = 1; i < argc && ok; i++) {
+        ok = reply_get(conn, &args[i]);
+    }
+    return ok;
+}
+
+static bool cmd_del(conn_t* conn, const arg_t* args, size_t argc) {
+    if (argc < 2) {
+        return reply_str(conn, "-ERR wrong number of arguments for 'del' command\r\n");
+    }
+
+    uint64_t removed = 0;
+    for (size_t i = 1; i < argc; i++) {
+        blob_t* blob = NULL;
+        if (key_valid(&args[i]) &&
+            map_remove(shards[shard_of(args[i].ptr, args[i].len)], args[i].ptr, args[i].len, &blob) == 0) {
+            removed++;
+        }
+    }
+    return reply_prefix(conn, ':', removed);
+}
+
+typedef struct scan_ctx {
+    buffer_t keys;
+    size_t count;
+    bool ok;
+} scan_ctx_t;
+
+static void scan_key(void* ctx, const char* key, size_t len, void* value) {
+    (void)value;
+    scan_ctx_t* scan = ctx;
+
+    char prefix[32];
+    int width = snprintf(prefix, sizeof(prefix), "$%zu\r\n", len);
+    if (!scan->ok || !buffer_reserve(&scan->keys, (size_t)width + len + 2)) {
+        scan->ok = false;
+        return;
+    }
+
+    char* out = scan->keys.data + scan->keys.len;
+    memcpy(out, prefix, (size_t)width);
+    memcpy(out + width, key, len);
+    memcpy(out + (size_t)width + len, "\r\n", 2);
+    scan->keys.len += (size_t)width + len + 2;
+    scan->count++;
+}
+
+static int run_inline(void* ctx, void (*task)(void*), void* arg) {
+    (void)ctx;
+    (void)task;
+    (void)arg;
+    return -EAGAIN;
+}
+
+/**
+ * The cursor is a shard index: each call returns one whole shard, walked
+ * under its lock, and COUNT is accepted but ignored.
+ */
+static bool cmd_scan(conn_t* conn, const arg_t* args, size_t argc) {
+    if (argc < 2 || argc % 2 != 0) {
+        return reply_str(conn, "-ERR syntax error\r\n");
+    }
+
+    for (size_t i = 2; i < argc; i += 2) {
+        if (!arg_is(&args[i], "COUNT")) {
+            return reply_str(conn, "-ERR only COUNT is supported\r\n");
+        }
+    }
+
+    char digits[24] = {0};
+    size_t cursor   = 0;
+    for (size_t i = 0; i < args[1].len; i++) {
+        if (args[1].ptr[i] < '0' || args[1].ptr[i] > '9' || cursor > SIZE_MAX / 10) {
+            return reply_str(conn, "-ERR invalid cursor\r\n");
+        }
+        cursor = cursor * 10 + (size_t)(args[1].ptr[i] - '0');
+    }
+    if (cursor >= shard_count) {
+        cursor = shard_count;
+    }
+
+    size_t next = cursor + 1 < shard_count ? cursor + 1 : 0;
+    int len     = snprintf(digits, sizeof(digits), "%zu", next);
+    if (!reply_str(conn, "*2\r\n") || !reply_bulk(conn, digits, (size_t)len)) {
+        return false;
+    }
+
+    if (cursor == shard_count) {
+        return reply_str(conn, "*0\r\n");
+    }
+
+    // The array length is only known afterwards, so collect the keys first
+    const map_executor_t inline_executor = {.submit = run_inline, .ctx = NULL};
+    map_pool_t* pool                     = map_pool_create_external(&inline_executor, 1);
+    scan_ctx_t scan                      = {.count = 0, .ok = pool != NULL};
+
+    if (pool != NULL) {
+        map_foreach_parallel(shards[cursor], pool, scan_key, &scan);
+        map_pool_free(pool);
+    }
+
+    bool ok = scan.ok && reply_prefix(conn, '*', scan.count) &&
+              (scan.keys.len == 0 || reply_raw(conn, scan.keys.data, scan.keys.len));
+    free(scan.keys.data);
+    return ok;
+}
+
+static bool conn_execute(worker_t* self, conn_t* conn, const arg_t* args, size_t argc) {
+    if (arg_is(&args[0], "SET")) {
+        return cmd_set(self, conn, args, argc);
+    }
+
+    if (!flush_sets(self, conn)) {
+        return false;
+    }
+
+    if (arg_is(&args[0], "GET")) {
+        return cmd_get(conn, args, argc);
+    }
+    if (arg_is(&args[0], "MGET")) {
+        return cmd_mget(conn, args, argc);
+    }
+    if (arg_is(&args[0], "DEL")) {
+        return cmd_del(conn, args, argc);
+    }
+    if (arg_is(&args[0], "SCAN")) {
+        return cmd_scan(conn, args, argc);
+    }
+    if (arg_is(&args[0], "PING")) {
+        return argc > 1 ? reply_bulk(conn, args[1].ptr, args[1].len) : reply_str(conn, "+PONG\r\n");
+    }
+    if (arg_is(&args[0], "QUIT")) {
+        conn->closing = true;
+        return reply_str(conn, "+OK\r\n");
+    }
+    if (arg_is(&args[0], "CONFIG") || arg_is(&args[0], "COMMAND")) {
+        // Clients probe these on connect; an empty answer keeps them going
+        return reply_str(conn, "*0\r\n");
+    }
+
+    return reply_str(conn, "-ERR unknown command\r\n");
+}
+
+/* ----------------------------------------------------------------------------
+ * Protocol parsing
+ * ------------------------------------------------------------------------- */
+
+/**
+ * Parses "<prefix><digits>\r\n" at `pos`. Returns the position after the line,
+ * 0 if the line is incomplete, or SIZE_MAX if it is malformed.
+ */
+static size_t parse_number(const buffer_t* in, size_t pos, char prefix, size_t* value) {
+    if (pos >= in->len) {
+        return 0;
+    }
+    if (in->data[pos] != prefix) {
+        return SIZE_MAX;
+    }
+
+    size_t number = 0;
+    for (size_t i = pos + 1; i < in->len; i++) {
+        char c = in->data[i];
+        if (c == '\r') {
+            if (i + 1 >= in->len) {
+                return 0;
+            }
+            if (in->data[i + 1] != '\n' || i == pos + 1) {
+                return SIZE_MAX;
+            }
+            *value = number;
+            return i + 2;
+        }
+        if (c < '0' || c > '9' || number > SERVER_MAX_BULK) {
+            return SIZE_MAX;
+        }
+        number = number * 10 + (size_t)(c - '0');
+    }
+    return 0;
+}
+
+/**
+ * Parses one command starting at `conn->parsed`. Returns the argument count,
+ * 0 if more bytes are needed, or -1 on a protocol error.
+ */
+static ssize_t conn_parse(worker_t* self, conn_t* conn, size_t* end) {
+    const buffer_t* in = &conn->in;
+    size_t pos         = conn->parsed;
+
+    if (in->data[pos] != '*') {
+        // Inline command, as typed into telnet or nc
+        const char* line = memchr(in->data + pos, '\n', in->len - pos);
+        if (line == NULL) {
+            return in->len - pos > SERVER_READ_CHUNK ? -1 : 0;
+        }
+
+        size_t stop = (size_t)(line - in->data);
+        size_t argc = 0;
+        size_t i    = pos;
+        while (i < stop && argc < SERVER_MAX_ARGS) {
+            while (i < stop && (in->data[i] == ' ' || in->data[i] == '\r')) {
+                i++;
+            }
+            size_t start = i;
+            while (i < stop && in->data[i] != ' ' && in->data[i] != '\r') {
+                i++;
+            }
+            if (i > start) {
+                self->args[argc++] = (arg_t){.ptr = in->data + start, .len = i - start};
+            }
+        }
+
+        *end = stop + 1;
+        return (ssize_t)argc;
+    }
+
+    size_t argc = 0;
+    pos         = parse_number(in, pos, '*', &argc);
+    if (pos == 0 || pos == SIZE_MAX) {
+        return pos == 0 ? 0 : -1;
+    }
+    if (argc == 0 || argc > SERVER_MAX_ARGS) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < argc; i++) {
+        size_t len = 0;
+        pos        = parse_number(in, pos, '$', &len);
+        if (pos == 0 || pos == SIZE_MAX) {
+            return pos == 0 ? 0 : -1;
+        }
+        if (in->len - pos < len + 2) {
+            return 0;
+        }
+        self->args[i] = (arg_t){.ptr = in->data + pos, .len = len};
+        pos += len + 2;
+    }
+
+    *end = pos;
+    return (ssize_t)argc;
+}
+
+/* ----------------------------------------------------------------------------
+ * Connections
+ * ------------------------------------------------------------------------- */
+
+static void conn_free(worker_t* self, conn_t* conn) {
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        self->conns = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->pending.data);
+    free(conn->segments);
+    free(conn);
+}
+
+static bool conn_throttled(const conn_t* conn) {
+    return conn->pending.len - conn->pending_off >= SERVER_PENDING_MAX;
+}
+
+/**
+ * Waits for input unless too many replies are queued, and for the socket to
+ * drain while any are.
+ */
+static bool conn_watch(worker_t* self, conn_t* conn) {
+    uint32_t events = EPOLLRDHUP;
+    events |= conn_throttled(conn) ? 0u : (uint32_t)EPOLLIN;
+    events |= conn->pending.len > 0 ? (uint32_t)EPOLLOUT : 0u;
+
+    struct epoll_event event = {
+        .events   = events,
+        .data.ptr = conn,
+    };
+    return epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == 0;
+}
+
+/**
+ * Writes whatever is still pending from an earlier batch. Returns false on
+ * error; leaves bytes in `pending` when the socket is full.
+ */
+static bool conn_drain(conn_t* conn) {
+    while (conn->pending_off < conn->pending.len) {
+        ssize_t n = send(conn->fd, conn->pending.data + conn->pending_off, conn->pending.len - conn->pending_off,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        conn->pending_off += (size_t)n;
+    }
+
+    conn->pending.len = 0;
+    conn->pending_off = 0;
+    return true;
+}
+
+/**
+ * Sends the queued reply segments with writev. Anything the socket does not
+ * take is copied into `pending` so no blob is referenced past this batch.
+ */
+static bool conn_send(conn_t* conn) {
+    size_t index  = 0;
+    size_t offset = 0;
+    bool blocked  = conn->pending.len > 0;
+
+    while (index < conn->segment_count && !blocked) {
+        struct iovec iov[IOV_MAX];
+        int count = 0;
+
+        for (size_t i = index; i < conn->segment_count && count < IOV_MAX; i++) {
+            const segment_t* segment = &conn->segments[i];
+            const char* base         = segment->base != NULL ? segment->base : conn->out.data + segment->off;
+            size_t skip              = i == index ? offset : 0;
+
+            iov[count++] = (struct iovec){.iov_base = (void*)(uintptr_t)(base + skip), .iov_len = segment->len - skip};
+        }
+
+        ssize_t n = writev(conn->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                return false;
+            }
+            blocked = true;
+            break;
+        }
+
+        size_t written = (size_t)n;
+        while (index < conn->segment_count && written >= conn->segments[index].len - offset) {
+            written -= conn->segments[index].len - offset;
+            offset = 0;
+            index++;
+        }
+        offset += written;
+    }
+
+    for (size_t i = index; i < conn->segment_count; i++) {
+        const segment_t* segment = &conn->segments[i];
+        const char* base         = segment->base != NULL ? segment->base : conn->out.data + segment->off;
+        size_t skip              = i == index ? offset : 0;
+
+        if (!buffer_reserve(&conn->pending, segment->len - skip)) {
+            return false;
+        }
+        memcpy(conn->pending.data + conn->pending.len, base + skip, segment->len - skip);
+        conn->pending.len += segment->len - skip;
+    }
+
+    conn->segment_count = 0;
+    conn->out.len       = 0;
+    return true;
+}
+
+/**
+ * Executes every complete command in the input buffer as one pipelined batch.
+ */
+static bool conn_process(worker_t* self, conn_t* conn) {
+    bool ok = true;
+
+    while (ok && !conn->closing && conn->parsed < conn->in.len) {
+        size_t end   = 0;
+        ssize_t argc = conn_parse(self, conn, &end);
+        if (argc < 0) {
+            flush_sets(self, conn);
+            reply_str(conn, "-ERR Protocol error\r\n");
+            conn->closing = true;
+            break;
+        }
+        if (end == 0) {
+            break;
+        }
+
+        conn->parsed = end;
+        if (argc > 0) {
+            ok = conn_execute(self, conn, self->args, (size_t)argc);
+        }
+    }
+
+    ok = flush_sets(self, conn) && ok;
+
+    // Arguments and staged keys pointed into the input; drop what was consumed
+    memmove(conn->in.data, conn->in.data + conn->parsed, conn->in.len - conn->parsed);
+    conn->in.len -= conn->parsed;
+    conn->parsed = 0;
+
+    return conn_send(conn) && ok;
+}
+
+static void conn_event(worker_t* self, conn_t* conn, uint32_t events) {
+    bool ok = !(events & (EPOLLERR | EPOLLHUP)) && conn_drain(conn);
+
+    // Past the queued reply limit, leave new requests in the socket
+    while (ok && !conn_throttled(conn) && !conn->closing) {
+        if (!buffer_reserve(&conn->in, SERVER_READ_CHUNK)) {
+            ok = false;
+            break;
+        }
+
+        ssize_t n = recv(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len, 0);
+        if (n == 0) {
+            ok = false;
+            break;
+        }
+        if (n < 0) {
+            ok = errno == EAGAIN || errno == EINTR;
+            break;
+        }
+
+        conn->in.len += (size_t)n;
+        ok = conn_process(self, conn);
+    }
+
+    if (!ok || (conn->closing && conn->pending.len == 0)) {
+        conn_free(self, conn);
+        return;
+    }
+
+    conn_watch(self, conn);
+}
+
+static void worker_accept(worker_t* self) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn_t* conn = calloc(1, sizeof(*conn));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn};
+        if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = self->conns;
+        if (self->conns != NULL) {
+            self->conns->prev = conn;
+        }
+        self->conns = conn;
+    }
+}
+
+static void* worker_main(void* arg) {
+    worker_t* self = arg;
+    current_worker = self;
+
+    struct epoll_event events[SERVER_EVENTS];
+    while (!atomic_load(&stopping)) {
+        atomic_store(&self->epoch, SERVER_OFFLINE);
+        worker_reclaim(self);
+
+        int ready = epoll_wait(self->epoll_fd, events, SERVER_EVENTS, 200);
+        atomic_store(&self->epoch, atomic_load(&global_epoch));
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == NULL) {
+                worker_accept(self);
+            } else {
+                conn_event(self, events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+
+    while (self->conns != NULL) {
+        conn_free(self, self->conns);
+    }
+
+    atomic_store(&self->epoch, SERVER_OFFLINE);
+    return NULL;
+}
+
+static int server_listen(uint16_t port) {
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one  = 1;
+    int zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    struct sockaddr_in6 addr = {.sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any};
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    long port    = argc > 1 ? strtol(argv[1], NULL, 10) : SERVER_DEFAULT_PORT;
+    long threads = argc > 2 ? strtol(argv[2], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (port <= 0 || port > 65535 || threads <= 0) {
+        fprintf(stderr, "usage: %s [port] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_fd = server_listen((uint16_t)port);
+    if (listen_fd < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    worker_count = (size_t)threads;
+    shard_count  = (size_t)threads;
+    shards       = calloc(shard_count, sizeof(*shards));
+    workers      = calloc(worker_count, sizeof(*workers));
+    if (shards == NULL || workers == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    const map_hooks_t hooks = {.on_update = on_update, .on_remove = on_remove};
+    for (size_t i = 0; i < shard_count; i++) {
+        shards[i] = map_create_ex(sizeof(blob_t*), MAP_FLAG_CONCURRENT);
+        if (shards[i] == NULL || map_set_hooks(shards[i], &hooks) != 0) {
+            fprintf(stderr, "failed to create shard %zu\n", i);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        atomic_init(&workers[i].epoch, SERVER_OFFLINE);
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        workers[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        // Exclusive wakeups hand each new connection to a single loop
+        struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL};
+        if (workers[i].epoll_fd < 0 || epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0 ||
+            pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            perror("worker");
+            return 1;
+        }
+    }
+
+    printf("map_server listening on port %ld with %zu shards\n", port, shard_count);
+    fflush(stdout);
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // Every loop has stopped: free retired and live blobs directly
+    for (size_t i = 0; i < worker_count; i++) {
+        for (size_t j = 0; j < workers[i].retired_count; j++) {
+            free(workers[i].retired[j].blob);
+        }
+        free(workers[i].retired);
+        close(workers[i].epoll_fd);
+    }
+
+    for (size_t i = 0; i < shard_count; i++) {
+        map_iter_t* iter = map_iter_create(shards[i]);
+        const char* key  = NULL;
+        size_t len       = 0;
+        blob_t* blob     = NULL;
+
+        while (iter != NULL && map_iter_next(iter, &key, &len, &blob) == 0) {
+            free(blob);
+        }
+        map_iter_free(iter);
+        map_free(shards[i]);
+    }
+
+    free(shards);
+    free(workers);
+    close(listen_fd);
+    return 0;
+}
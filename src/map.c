@@ -1,30 +1,25 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "map.h"
 
+#include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
-typedef struct string {
-    size_t size;
-    char bytes[];
-} string_t;
-
-typedef struct map_kv {
-    struct map_kv* next;
-    uint32_t hash;
-    string_t* key;
-    uint8_t value[];
-} map_kv_t;
-
-typedef struct map {
-    map_kv_t** elements;
-    size_t capacity;
-    size_t count;
-    size_t size;
-} map_t;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "map_epoch.h"
+#include "map_internal.h"
 
 typedef struct map_iter {
     map_t* map;
@@ -32,6 +27,10 @@ typedef struct map_iter {
     map_kv_t* current;
 } map_iter_t;
 
+#define MAP_FLAGS_KNOWN                                                                            \
+    (MAP_FLAG_CONCURRENT | MAP_FLAG_BACKGROUND_RESIZE | MAP_FLAG_SINGLE_WRITER | MAP_FLAG_COMBINING |           \
+     MAP_FLAG_ADAPTIVE | MAP_FLAG_CASE_INSENSITIVE | MAP_FLAG_KEY_16 | MAP_FLAG_KEY_32 | MAP_FLAG_KEY_64)
+
 static const size_t precomputed_prime_table[] = {
     31,
     67,
@@ -51,54 +50,6 @@ static const size_t precomputed_prime_table[] = {
     1147921,
 };
 
-static inline uint32_t murmur_hash2(const char* str, size_t len) {
-    uint32_t h          = 0;
-    const uint32_t m    = 0x5bd1e995;
-    const uint32_t r    = 24;
-    const uint8_t* ustr = (const uint8_t*)str;
-
-    while (len >= 4) {
-        uint32_t k = ((uint32_t)ustr[0]) | ((uint32_t)ustr[1] << 8) | ((uint32_t)ustr[2] << 16) |
-                     ((uint32_t)ustr[3] << 24);
-
-        k *= m;
-        k ^= k >> r;
-        k *= m;
-
-        h *= m;
-        h ^= k;
-
-        ustr += 4;
-        len -= 4;
-    }
-
-    switch (len) {
-        case 3:
-            h ^= (uint32_t)ustr[2] << 16;
-            h ^= (uint32_t)ustr[1] << 8;
-            h ^= (uint32_t)ustr[0];
-            h *= m;
-            break;
-        case 2:
-            h ^= (uint32_t)ustr[1] << 8;
-            h ^= (uint32_t)ustr[0];
-            h *= m;
-            break;
-        case 1:
-            h ^= (uint32_t)ustr[0];
-            h *= m;
-            break;
-        default:
-            break;
-    }
-
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
-
-    return h;
-}
-
 static inline ssize_t map_next_prime_size(const map_t* map) {
     if (map == NULL) {
         return -EINVAL;
@@ -155,21 +106,131 @@ static inline ssize_t map_prev_prime_size(const map_t* map) {
     return (ssize_t)result;
 }
 
+/**
+ * Smallest table size that holds `count` entries under the grow load factor.
+ */
+static size_t map_fit_prime_size(const map_t* map, size_t count) {
+    const size_t primes = sizeof(precomputed_prime_table) / sizeof(*precomputed_prime_table);
+
+    for (size_t i = 0; i < primes - 1; i++) {
+        if (count * 100 <= precomputed_prime_table[i] * map->grow_load) {
+            return precomputed_prime_table[i];
+        }
+    }
+
+    return precomputed_prime_table[primes - 1];
+}
+
+/**
+ * Frees memory the writer has unlinked, `bytes` long. On single-writer maps
+ * optimistic readers may still be looking at it, so it is parked until their
+ * epoch ends.
+ */
+static void map_release(map_t* map, void* ptr, size_t bytes) {
+    if ((map->flags & MAP_FLAG_SINGLE_WRITER) == 0) {
+        map_dealloc(map, ptr, bytes);
+        return;
+    }
+
+    uint64_t tag = map_epoch_retire_tag();
+
+    if (map->retired_count == map->retired_capacity) {
+        size_t capacity        = map->retired_capacity ? map->retired_capacity * 2 : MAP_RECLAIM_BATCH;
+        map_retired_t* retired = realloc(map->retired, capacity * sizeof(*retired));
+
+        if (retired == NULL) {
+            // Out of bookkeeping space, wait out the readers instead
+            while (map_epoch_oldest() <= tag) {
+                sched_yield();
+            }
+
+            free(ptr);
+            return;
+        }
+
+        map->retired          = retired;
+        map->retired_capacity = capacity;
+    }
+
+    map->retired[map->retired_count++] = (map_retired_t){.ptr = ptr, .tag = tag};
+}
+
+static void map_reclaim(map_t* map) {
+    if (map->retired_count < MAP_RECLAIM_BATCH) {
+        return;
+    }
+
+    uint64_t oldest = map_epoch_oldest();
+    size_t kept     = 0;
+
+    for (size_t i = 0; i < map->retired_count; i++) {
+        if (map->retired[i].tag < oldest) {
+            free(map->retired[i].ptr);
+        } else {
+            map->retired[kept++] = map->retired[i];
+        }
+    }
+
+    map->retired_count = kept;
+}
+
+/**
+ * Every write bumps the sequence counter to odd on entry and back to even on
+ * exit; optimistic readers and read caches use it to detect changes.
+ */
+static inline void map_seq_begin(map_t* map) {
+    uint64_t seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+    atomic_store_explicit(&map->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void map_seq_end(map_t* map) {
+    uint64_t seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+    atomic_store_explicit(&map->seq, seq + 1, memory_order_release);
+
+    if (map->flags & MAP_FLAG_SINGLE_WRITER) {
+        map_reclaim(map);
+    }
+}
+
+void map_write_begin(map_t* map) {
+    map_lock(map);
+    map_seq_begin(map);
+}
+
+void map_write_end(map_t* map) {
+    map_seq_end(map);
+    map_unlock(map);
+}
+
 static ssize_t map_resize(map_t* map, size_t new_capacity) {
     if (map == NULL || map->elements == NULL || new_capacity == 0) {
         return -EINVAL;
     }
 
     // Allocate new elements array
-    map_kv_t** new_elements = calloc(new_capacity, sizeof(map_kv_t*));
+    map_kv_t** new_elements = map_zalloc(map, new_capacity * sizeof(map_kv_t*));
     if (new_elements == NULL) {
         return -ENOMEM;
     }
 
+    map_index_reset(map);
+
+    // Entries of a small map were stored without hashing, those of a
+    // direct-addressed one under their slot
+    const bool small  = map_is_small(map);
+    const bool rehash = small || map->dense;
+
+    map->dense = false;
+
     for (size_t i = 0; i < map->capacity; i++) {
         map_kv_t* current = map->elements[i];
 
         while (current != NULL) {
+            if (rehash) {
+                current->hash = map_hash(map, current->key->bytes, current->key->size);
+            }
+
             map_kv_t* next          = current->next;
             uint32_t new_index      = current->hash % (uint32_t)new_capacity;
 
@@ -180,243 +241,1575 @@ static ssize_t map_resize(map_t* map, size_t new_capacity) {
     }
 
     // Free old elements array and update map
-    free(map->elements);
-    map->elements = new_elements;
-    map->capacity = new_capacity;
+    if (small) {
+        memset(&map->small, 0, sizeof(map->small));
+    } else {
+        map_release(map, map->elements, map->capacity * sizeof(map_kv_t*));
+    }
+
+    map_dealloc(map, map->occupied, map_occupied_bytes(map->capacity));
+    map->occupied    = NULL;
+    map->dense_floor = 0;
+    map->elements    = new_elements;
+    map->capacity    = new_capacity;
+    map->resizes++;
 
     return 0;
 }
 
-ssize_t map_put(map_t* map, const char* key, size_t size, void* element) {
-    if (map == NULL || key == NULL || size == 0 || element == NULL) {
-        return -EINVAL;
-    }
+/**
+ * Moves every entry of a hashed table into the inline slots and frees the
+ * table. The caller checks that they fit.
+ */
+static void map_demote(map_t* map) {
+    map_small_t* small = &map->small;
+    size_t slot        = 0;
 
-    if (size > MAP_KEY_MAX_LEN) {
-        return -EOVERFLOW;
-    }
+    map_index_reset(map);
+    memset(small, 0, sizeof(*small));
 
-    if (map->count >= (map->capacity * 3) / 4) {
-        ssize_t new_capacity = map_next_prime_size(map);
-        if (new_capacity < 0) {
-            return new_capacity;
-        }
+    for (size_t i = 0; i < map->capacity; i++) {
+        map_kv_t* current = map->elements[i];
 
-        ssize_t resize_result = map_resize(map, (size_t)new_capacity);
-        if (resize_result < 0) {
-            return resize_result;
+        while (current != NULL) {
+            map_kv_t* next     = current->next;
+
+            current->next      = NULL;
+            small->nodes[slot] = current;
+            small->lens[slot]  = (uint8_t)current->key->size;
+            small->tags[slot]  = map_small_tag(current->key->bytes, current->key->size);
+            slot++;
+            current = next;
         }
     }
 
-    uint32_t hash     = murmur_hash2(key, size);
-    uint32_t index    = hash % (uint32_t)map->capacity;
-    map_kv_t* current = map->elements[index];
+    map_dealloc(map, map->elements, map->capacity * sizeof(map_kv_t*));
+    map_dealloc(map, map->occupied, map_occupied_bytes(map->capacity));
+    map->occupied    = NULL;
+    map->dense       = false;
+    map->dense_floor = 0;
+    map->elements    = small->nodes;
+    map->capacity    = MAP_SMALL_SLOTS;
+    map->resizes++;
+}
 
-    // Check for existing entry with the key
-    while (current != NULL) {
-        if (current->key->size == size && strncmp(current->key->bytes, key, size) == 0) {
-            return -EEXIST;
-        }
+/**
+ * Smallest and largest key of a map of 64-bit keys holding at least one entry.
+ */
+static void map_key_bounds(const map_t* map, uint64_t* first, uint64_t* last) {
+    *first = UINT64_MAX;
+    *last  = 0;
 
-        current = current->next;
+    for (size_t i = 0; i < map->capacity; i++) {
+        for (const map_kv_t* current = map->elements[i]; current != NULL; current = current->next) {
+            const uint64_t key = map_load_u64(current->key->bytes);
+            *first             = key < *first ? key : *first;
+            *last              = key > *last ? key : *last;
+        }
     }
+}
 
-    // Allocate bucket with space for the flexible array member
-    map_kv_t* bck = malloc(sizeof(map_kv_t) + map->size);
-    if (bck == NULL) {
+/**
+ * Moves every entry into a direct-addressed array of `capacity` slots starting
+ * at key `base`, whatever the map used before. The caller checks that every
+ * key has a slot.
+ */
+static ssize_t map_dense_build(map_t* map, uint64_t base, size_t capacity) {
+    map_kv_t** elements = map_zalloc(map, capacity * sizeof(map_kv_t*));
+    uint64_t* occupied  = map_zalloc(map, map_occupied_bytes(capacity));
+    if (elements == NULL || occupied == NULL) {
+        map_dealloc(map, elements, capacity * sizeof(map_kv_t*));
+        map_dealloc(map, occupied, map_occupied_bytes(capacity));
         return -ENOMEM;
     }
 
-    string_t* str = malloc(sizeof(string_t) + size + 1);
-    if (str == NULL) {
-        free(bck);
-        return -ENOMEM;
-    }
+    map_index_reset(map);
 
-    memcpy(str->bytes, key, size);
-    str->bytes[size] = '\0';
-    str->size        = size;
-    bck->hash        = hash;
-    bck->key         = str;
-    bck->next        = map->elements[index];
+    for (size_t i = 0; i < map->capacity; i++) {
+        map_kv_t* current = map->elements[i];
 
-    // Copy the element data into the flexible array member
-    memcpy(bck->value, element, map->size);
+        while (current != NULL) {
+            map_kv_t* next  = current->next;
+            uint64_t offset = map_load_u64(current->key->bytes) - base;
+
+            current->hash          = (uint32_t)offset;
+            current->next          = NULL;
+            elements[offset]       = current;
+            occupied[offset / 64] |= 1ULL << (offset % 64);
+            current                = next;
+        }
+    }
 
-    map->elements[index] = bck;
-    map->count++;
+    if (map_is_small(map)) {
+        memset(&map->small, 0, sizeof(map->small));
+    } else {
+        map_dealloc(map, map->elements, map->capacity * sizeof(map_kv_t*));
+    }
+
+    map_dealloc(map, map->occupied, map_occupied_bytes(map->capacity));
+    map->elements   = elements;
+    map->capacity   = capacity;
+    map->occupied   = occupied;
+    map->dense      = true;
+    map->dense_base = base;
+    map->resizes++;
 
     return 0;
 }
 
-ssize_t map_get(map_t* map, const char* key, size_t size, void* out) {
-    if (map == NULL || key == NULL || size == 0 || out == NULL) {
-        return -EINVAL;
+/**
+ * Switches a map of 64-bit keys that is about to grow its table to direct
+ * addressing if its keys are dense enough. Returns true if it did.
+ */
+static bool map_dense_detect(map_t* map) {
+    if (map->key_width != 8 || map->dense || map_is_shared(map) || map->count == 0) {
+        return false;
     }
 
-    uint32_t hash     = murmur_hash2(key, size);
-    uint32_t index    = hash % (uint32_t)map->capacity;
-    map_kv_t* element = map->elements[index];
+    uint64_t first;
+    uint64_t last;
+    map_key_bounds(map, &first, &last);
 
-    while (element != NULL) {
-        if (element->key->size == size && strncmp(element->key->bytes, key, size) == 0) {
-            memcpy(out, element->value, map->size);
-            return 0;
-        }
+    if (last - first >= map->count * MAP_DENSE_ENTER) {
+        return false;
+    }
 
-        element = element->next;
+    return map_dense_build(map, first, (size_t)(last - first) + 1) == 0;
+}
+
+ssize_t map_dense_cover(map_t* map, const char* key, size_t count) {
+    if (!map->dense || map_dense_offset(map, key) < map->capacity) {
+        return 0;
+    }
+
+    const uint64_t value = map_load_u64(key);
+    const uint64_t end   = map->dense_base + map->capacity - 1;
+    const uint64_t first = value < map->dense_base ? value : map->dense_base;
+    const uint64_t last  = value > end ? value : end;
+
+    // Too far out: the array would be mostly holes
+    if (last - first >= count * MAP_DENSE_WIDEN || last - first >= UINT32_MAX) {
+        return map_resize(map, map_fit_prime_size(map, count));
+    }
+
+    // Widen at least twofold, towards the new key, so keys handed out in
+    // order rebuild the array a logarithmic number of times
+    size_t capacity = (size_t)(last - first) + 1;
+    if (capacity < map->capacity * 2) {
+        capacity = map->capacity * 2 < UINT32_MAX ? map->capacity * 2 : UINT32_MAX;
+    }
+
+    uint64_t base = first;
+    if (value < map->dense_base) {
+        base = last + 1 >= capacity ? last + 1 - capacity : 0;
+    } else if (capacity - 1 > UINT64_MAX - base) {
+        capacity = (size_t)(UINT64_MAX - base) + 1;
     }
 
-    return -ENOENT;
+    return map_dense_build(map, base, capacity);
 }
 
-ssize_t map_remove(map_t* map, const char* key, size_t len, void* out) {
-    if (map == NULL || key == NULL || len == 0 || out == NULL) {
+ssize_t map_set_key_range(map_t* map, uint64_t first, uint64_t last) {
+    if (map == NULL || map->key_width != 8 || map_is_shared(map) || first > last) {
         return -EINVAL;
     }
 
-    uint32_t hash      = murmur_hash2(key, len);
-    uint32_t index     = hash % (uint32_t)map->capacity;
-    map_kv_t* current  = map->elements[index];
-    map_kv_t* previous = NULL;
+    if (last - first >= UINT32_MAX) {
+        return -ERANGE;
+    }
 
-    while (current != NULL) {
-        if (current->key->size == len && strncmp(current->key->bytes, key, len) == 0) {
-            memcpy(out, current->value, map->size);
+    map_write_begin(map);
 
-            if (previous == NULL) {
-                map->elements[index] = current->next;
-            } else {
-                previous->next = current->next;
-            }
+    // The entries already stored must keep a slot
+    if (map->count > 0) {
+        uint64_t lowest;
+        uint64_t highest;
+        map_key_bounds(map, &lowest, &highest);
 
-            free(current->key);
-            free(current);
-            map->count--;
+        first = lowest < first ? lowest : first;
+        last  = highest > last ? highest : last;
+    }
 
-            if (map->count < map->capacity / 4 && map->capacity > precomputed_prime_table[0]) {
-                ssize_t new_capacity = map_prev_prime_size(map);
-                if (new_capacity > 0) {
-                    map_resize(map, (size_t)new_capacity);
-                }
-            }
+    ssize_t result = last - first >= UINT32_MAX ? -ERANGE : map_dense_build(map, first, (size_t)(last - first) + 1);
+    if (result == 0) {
+        map->dense_floor = map->capacity;
+    }
+
+    map_write_end(map);
+
+    return result;
+}
+
+void map_migrate(map_t* map, size_t budget) {
+    if (map->old_elements == NULL) {
+        return;
+    }
+
+    while (budget > 0 && map->migrate_index < map->old_capacity) {
+        map_kv_t* current = map->old_elements[map->migrate_index];
 
-            return 0;
+        while (current != NULL) {
+            map_kv_t* next       = current->next;
+            uint32_t index       = current->hash % (uint32_t)map->capacity;
+
+            current->next        = map->elements[index];
+            map->elements[index] = current;
+            current              = next;
         }
 
-        previous = current;
-        current  = current->next;
+        map->old_elements[map->migrate_index] = NULL;
+        map->migrate_index++;
+        budget--;
     }
 
-    return -ENOENT;
+    if (map->migrate_index >= map->old_capacity) {
+        map_dealloc(map, map->old_elements, map->old_capacity * sizeof(map_kv_t*));
+        map->old_elements  = NULL;
+        map->old_capacity  = 0;
+        map->migrate_index = 0;
+    }
 }
 
-size_t map_count(const map_t* this) {
-    return this->count;
-}
+/**
+ * Hands a grow or shrink to the resize worker if the load factor calls for one.
+ * Must be called with the map lock held.
+ */
+static void map_request_resize(map_t* map) {
+    map_sync_t* sync = map->sync;
+    if (sync->target != 0 || map->old_elements != NULL) {
+        return;
+    }
 
-ssize_t map_free(map_t* map) {
-    if (map == NULL || map->elements == NULL) {
-        return -EINVAL;
+    ssize_t new_capacity = 0;
+    if (map->count * 100 >= map->capacity * map->grow_load) {
+        new_capacity = map_next_prime_size(map);
+    } else if (map->count * 100 < map->capacity * map->shrink_load && map->capacity > precomputed_prime_table[0]) {
+        new_capacity = map_prev_prime_size(map);
     }
 
-    for (size_t i = 0; i < map->capacity; i++) {
-        map_kv_t* current = map->elements[i];
-        while (current != NULL) {
-            map_kv_t* next = current->next;
-            free(current->key);
-            free(current);
-            current = next;
+    if (new_capacity > 0) {
+        sync->target = (size_t)new_capacity;
+        pthread_cond_signal(&sync->wake);
+    }
+}
+
+static void* map_resize_worker(void* arg) {
+    map_t* map       = arg;
+    map_sync_t* sync = map->sync;
+
+    pthread_mutex_lock(&sync->lock);
+    while (!sync->stop) {
+        if (sync->target == 0) {
+            pthread_cond_wait(&sync->wake, &sync->lock);
+            continue;
+        }
+
+        const size_t capacity = sync->target;
+        pthread_mutex_unlock(&sync->lock);
+
+        // Zeroing the new table is the only step proportional to its size, so it
+        // happens while foreground operations keep running against the old one
+        map_kv_t** elements = calloc(capacity, sizeof(map_kv_t*));
+
+        pthread_mutex_lock(&sync->lock);
+        sync->target = 0;
+
+        if (elements == NULL || sync->stop) {
+            free(elements);
+            continue;
+        }
+
+        // Flip to the new table; lookups consult both until migration completes
+        map->old_elements  = map->elements;
+        map->old_capacity  = map->capacity;
+        map->migrate_index = 0;
+        map->elements      = elements;
+        map->capacity      = capacity;
+        map->resizes++;
+
+        while (map->old_elements != NULL && !sync->stop) {
+            map_migrate(map, MAP_RESIZE_BATCH);
+
+            pthread_mutex_unlock(&sync->lock);
+            sched_yield();
+            pthread_mutex_lock(&sync->lock);
+        }
+
+        // Inserts or removals during migration may have crossed a threshold again
+        if (!sync->stop) {
+            map_request_resize(map);
         }
     }
+    pthread_mutex_unlock(&sync->lock);
 
-    free(map->elements);
-    free(map);
-    return 0;
+    return NULL;
 }
 
-map_t* map_create(size_t size) {
-    map_t* map = malloc(sizeof(*map));
-    if (map == NULL) {
-        return NULL;
-    }
+static map_kv_t** map_bucket_find(map_kv_t** link, uint32_t hash, const map_key_t* key, uint64_t* probes) {
+    while (*link != NULL) {
+        const map_kv_t* current = *link;
+        (*probes)++;
+        if (current->hash == hash && current->key->size == key->len &&
+            map_key_equal(key, current->key->bytes)) {
+            return link;
+        }
 
-    map->elements = calloc(precomputed_prime_table[0], sizeof(map_kv_t*));
-    if (map->elements == NULL) {
-        return NULL;
+        link = &(*link)->next;
     }
 
-    map->capacity = precomputed_prime_table[0];
-    map->size     = size;
-    map->count    = 0;
-    return map;
+    return NULL;
 }
 
-ssize_t map_iter_next(map_iter_t* iter, void* key_out, size_t* key_len_out, void* value_out) {
-    if (iter == NULL || key_out == NULL || key_len_out == NULL || value_out == NULL) {
-        return -EINVAL;
+/**
+ * Finds `key` among the inline slots of a small map. Slots whose length or
+ * tag differ are ruled out sixteen at a time before any key is read.
+ */
+static map_kv_t** map_small_find(map_t* map, const map_key_t* key, uint64_t* probes) {
+    map_small_t* small = &map->small;
+
+#if defined(__SSE2__)
+    const __m128i lens  = _mm_loadu_si128((const __m128i*)small->lens);
+    const __m128i tags  = _mm_loadu_si128((const __m128i*)small->tags);
+    const __m128i match = _mm_and_si128(_mm_cmpeq_epi8(lens, _mm_set1_epi8((char)key->len)),
+                                        _mm_cmpeq_epi8(tags, _mm_set1_epi8((char)map_key_tag(key))));
+    unsigned mask       = (unsigned)_mm_movemask_epi8(match);
+
+    while (mask != 0) {
+        const unsigned slot = (unsigned)__builtin_ctz(mask);
+        (*probes)++;
+        if (map_key_equal(key, small->nodes[slot]->key->bytes)) {
+            return &small->nodes[slot];
+        }
+
+        mask &= mask - 1;
     }
+#else
+    const uint8_t tag = map_key_tag(key);
 
-    // Check if we're at the end of the map
-    if (iter->index >= iter->map->capacity) {
-        return -ENOENT;
+    for (size_t slot = 0; slot < MAP_SMALL_SLOTS; slot++) {
+        if (small->lens[slot] != key->len || small->tags[slot] != tag) {
+            continue;
+        }
+
+        (*probes)++;
+        if (map_key_equal(key, small->nodes[slot]->key->bytes)) {
+            return &small->nodes[slot];
+        }
     }
+#endif
 
-    // Copy current element's data
-    char** key_out_ptr = (char**)key_out;
-    *key_out_ptr       = iter->current->key->bytes;
-    *key_len_out       = iter->current->key->size;
-    memcpy(value_out, iter->current->value, iter->map->size);
+    return NULL;
+}
 
-    // Move to the next element
-    if (iter->current->next != NULL) {
-        // Move to the next element in the current bucket
-        iter->current = iter->current->next;
+/**
+ * Returns the link pointing at the entry for `key`, looking in the table being
+ * retired as well while a background resize is in flight. Small and
+ * direct-addressed maps ignore `hash`.
+ */
+static map_kv_t** map_find_key(map_t* map, uint32_t hash, const map_key_t* key) {
+    uint64_t probes = 0;
+    map_kv_t** link;
+
+    if (map_is_small(map)) {
+        link = map_small_find(map, key, &probes);
+    } else if (map->dense) {
+        // Slot i can only ever hold key base + i, so an occupied slot is a hit
+        const uint64_t offset = map_dense_offset(map, key->bytes);
+        link                  = offset < map->capacity && map->elements[offset] != NULL ? &map->elements[offset] : NULL;
+        probes++;
     } else {
-        // Move to the next non-empty bucket
-        iter->current = NULL;
-        iter->index++;
+        hash          = map_table_hash(map, hash, key);
+        size_t bucket = hash % (uint32_t)map->capacity;
 
-        while (iter->index < iter->map->capacity && iter->map->elements[iter->index] == NULL) {
-            iter->index++;
+        if (map->indexes != NULL && map->indexes[bucket] != NULL) {
+            link = map_index_find(map, bucket, hash, key, &probes);
+        } else {
+            link = map_bucket_find(&map->elements[bucket], hash, key, &probes);
         }
 
-        if (iter->index < iter->map->capacity) {
-            iter->current = iter->map->elements[iter->index];
+        if (link == NULL && map->old_elements != NULL) {
+            link = map_bucket_find(&map->old_elements[hash % (uint32_t)map->old_capacity], hash, key, &probes);
         }
     }
 
-    return 0;
+    map->counters.probes += probes;
+    return link;
 }
 
-ssize_t map_iter_free(map_iter_t* iter) {
-    if (iter == NULL) {
-        return -EINVAL;
+map_kv_t** map_find(map_t* map, uint32_t hash, const char* key, size_t len) {
+    if (map->key_width != 0 && len != map->key_width) {
+        return NULL;
     }
 
-    free(iter);
-    return 0;
+    const map_key_t view = map_key_of(map, key, len);
+    return map_find_key(map, hash, &view);
 }
 
-map_iter_t* map_iter_create(map_t* map) {
-    if (map == NULL) {
+/**
+ * Bytes of the allocation holding `kv`, and of its key when stored apart.
+ */
+static inline size_t map_kv_bytes(const map_t* map, const map_kv_t* kv) {
+    return kv->key_inline ? map_kv_key_offset(map) + sizeof(string_t) + kv->key->size + 1
+                          : sizeof(map_kv_t) + map->size;
+}
+
+static inline size_t map_kv_key_bytes(const map_kv_t* kv) {
+    return sizeof(string_t) + kv->key->size + 1;
+}
+
+/**
+ * map_kv_create for a key view; a scattered key is gathered into the node's
+ * own copy, the only place its parts are ever joined. Keys of a fixed-width
+ * map, and every key of a family map, live behind the value in the node's
+ * own allocation, so comparing one costs no extra cache miss.
+ */
+static map_kv_t* map_kv_create_key(const map_t* map, uint32_t hash, const map_key_t* key, const void* element) {
+    const size_t size       = key->len;
+    const bool key_inline   = (map->key_width != 0 && size == map->key_width) || map->family != NULL;
+    const size_t key_offset = map_kv_key_offset(map);
+
+    // Allocate bucket with space for the flexible array member
+    const size_t bytes = key_inline ? key_offset + sizeof(string_t) + size + 1 : sizeof(map_kv_t) + map->size;
+    map_kv_t* bck      = map_alloc(map, bytes);
+    if (bck == NULL) {
         return NULL;
     }
 
-    map_iter_t* iter = malloc(sizeof(*iter));
-    if (iter == NULL) {
+    string_t* str = key_inline ? (string_t*)((char*)bck + key_offset) : map_alloc(map, sizeof(string_t) + size + 1);
+    if (str == NULL) {
+        map_dealloc(map, bck, sizeof(map_kv_t) + map->size);
         return NULL;
     }
 
-    iter->map     = map;
-    iter->index   = 0;
-    iter->current = NULL;
+    map_key_gather(key, str->bytes);
+    str->bytes[size] = '\0';
+    str->size        = size;
+    bck->hash        = hash;
+    bck->key_inline  = key_inline;
+    bck->in_slab     = false;
+    bck->key         = str;
+    bck->next        = NULL;
 
-    // Find the first non-empty bucket
-    while (iter->index < map->capacity && map->elements[iter->index] == NULL) {
-        iter->index++;
+    // Copy the element data into the flexible array member
+    if (element != NULL) {
+        memcpy(bck->value, element, map->size);
+    }
+
+    return bck;
+}
+
+map_kv_t* map_kv_create(const map_t* map, uint32_t hash, const char* key, size_t size, const void* element) {
+    return map_kv_create_key(map, hash, &(map_key_t){.bytes = key, .len = size}, element);
+}
+
+void map_kv_release(map_t* map, map_kv_t* kv) {
+    // Handles may refer to any entry that is freed
+    map->handle_gen++;
+
+    // Maps whose readers could still see the entry are never compacted
+    if (kv->in_slab) {
+        map_slab_release(map, kv);
+        return;
+    }
+
+    const size_t bytes = map_kv_bytes(map, kv);
+
+    if (!kv->key_inline) {
+        map_release(map, kv->key, map_kv_key_bytes(kv));
+    }
+
+    map_release(map, kv, bytes);
+}
+
+void map_kv_discard(const map_t* map, map_kv_t* kv) {
+    if (kv->in_slab) {
+        map_slab_release(map, kv);
+        return;
+    }
+
+    const size_t bytes = map_kv_bytes(map, kv);
+
+    if (!kv->key_inline) {
+        map_dealloc(map, kv->key, map_kv_key_bytes(kv));
+    }
+
+    map_dealloc(map, kv, bytes);
+}
+
+void map_link(map_t* map, map_kv_t* kv) {
+    if (map_is_small(map)) {
+        map_small_t* small = &map->small;
+        size_t slot        = 0;
+
+        // map_reserve has made sure a slot is free
+        while (small->lens[slot] != 0) {
+            slot++;
+        }
+
+        kv->next           = NULL;
+        small->nodes[slot] = kv;
+        small->lens[slot]  = (uint8_t)kv->key->size;
+        small->tags[slot]  = map_small_tag(kv->key->bytes, kv->key->size);
+        map->count++;
+        return;
+    }
+
+    const map_key_t view = map_key_of(map, kv->key->bytes, kv->key->size);
+    kv->hash             = map_table_hash(map, kv->hash, &view);
+    uint32_t index       = kv->hash % (uint32_t)map->capacity;
+
+    if (map->indexes != NULL && map->indexes[index] != NULL && map_index_insert(map, index, kv)) {
+        map->count++;
+        return;
     }
 
+    if (map->dense) {
+        map->occupied[index / 64] |= 1ULL << (index % 64);
+    }
+
+    kv->next             = map->elements[index];
+    map->elements[index] = kv;
+    map->count++;
+}
+
+void map_unlink(map_t* map, map_kv_t** link) {
+    map_kv_t* current = *link;
+    map_notify(map, MAP_CHANGE_REMOVE, current, current->value);
+
+    if (map_is_small(map)) {
+        map->small.lens[link - map->small.nodes] = 0;
+    } else if (map->dense) {
+        map->occupied[current->hash / 64] &= ~(1ULL << (current->hash % 64));
+    } else if (map->indexes != NULL) {
+        size_t bucket = current->hash % (uint32_t)map->capacity;
+        if (map->indexes[bucket] != NULL) {
+            map_index_remove(map, bucket, current);
+        }
+    }
+
+    *link = current->next;
+
+    map_kv_release(map, current);
+    map->count--;
+}
+
+void map_notify(map_t* map, map_change_kind_t kind, const map_kv_t* kv, const void* value) {
+    const map_hooks_t* hooks = &map->hooks;
+
+    switch (kind) {
+        case MAP_CHANGE_INSERT:
+            if (hooks->on_insert != NULL) {
+                hooks->on_insert(hooks->ctx, kv->key->bytes, kv->key->size, value);
+            }
+            break;
+        case MAP_CHANGE_UPDATE:
+            if (hooks->on_update != NULL) {
+                hooks->on_update(hooks->ctx, kv->key->bytes, kv->key->size, kv->value, value);
+            }
+            break;
+        case MAP_CHANGE_REMOVE:
+            if (hooks->on_remove != NULL) {
+                hooks->on_remove(hooks->ctx, kv->key->bytes, kv->key->size, value);
+            }
+            break;
+        default:
+            break;
+    }
+
+    map->change_seq++;
+    if (map->changes != NULL) {
+        map_changes_publish(map->changes, map->change_seq, kind, kv->key, value, map->size);
+    }
+}
+
+ssize_t map_set_hooks(map_t* map, const map_hooks_t* hooks) {
+    if (map == NULL || map_is_static(map)) {
+        return -EINVAL;
+    }
+
+    map_write_begin(map);
+    if (hooks != NULL) {
+        map->hooks = *hooks;
+    } else {
+        memset(&map->hooks, 0, sizeof(map->hooks));
+    }
+    map_write_end(map);
+
+    return 0;
+}
+
+ssize_t map_reserve(map_t* map, size_t count) {
+    // The resize worker grows the table after the fact
+    if (map->sync != NULL && map->sync->has_worker) {
+        return 0;
+    }
+
+    // Small maps fill every slot, then switch to the smallest hashed table;
+    // direct-addressed ones only grow to cover a key, see map_dense_cover
+    if ((map_is_small(map) && count <= MAP_SMALL_SLOTS) || map->dense) {
+        return 0;
+    }
+
+    // Nearly consecutive keys need no hashing at all
+    if ((count * 100 > map->capacity * map->grow_load || map_is_small(map)) && map_dense_detect(map)) {
+        return 0;
+    }
+
+    while (count * 100 > map->capacity * map->grow_load || map_is_small(map)) {
+        ssize_t new_capacity = map_next_prime_size(map);
+        if (new_capacity < 0) {
+            return new_capacity;
+        }
+
+        ssize_t resize_result = map_resize(map, (size_t)new_capacity);
+        if (resize_result < 0) {
+            return resize_result;
+        }
+    }
+
+    return 0;
+}
+
+void map_rebalance(map_t* map) {
+    if (map->sync != NULL && map->sync->has_worker) {
+        map_request_resize(map);
+    } else if (map_is_small(map)) {
+        return;
+    } else if (map->dense && (map->capacity <= map->dense_floor || map->count * MAP_DENSE_SPARSE >= map->capacity)) {
+        // A direct-addressed map keeps its array until the keys thin out
+        return;
+    } else if (!map_is_shared(map) && map->small_limit != 0 && map->count <= map->small_limit) {
+        map_demote(map);
+    } else if (map->dense) {
+        map_resize(map, map_fit_prime_size(map, map->count));
+    } else if (map->count * 100 < map->capacity * map->shrink_load && map->capacity > precomputed_prime_table[0]) {
+        ssize_t new_capacity = map_prev_prime_size(map);
+        if (new_capacity > 0) {
+            map_resize(map, (size_t)new_capacity);
+        }
+    }
+}
+
+/**
+ * Switches the map to its keyed hash under a fresh random key and rehashes
+ * every entry. A keyed map that still sees long chains draws a new key, at
+ * most once per `count` inserts so rehashing stays amortized O(1).
+ */
+static ssize_t map_rekey(map_t* map) {
+    map_kv_t** elements = map_zalloc(map, map->capacity * sizeof(map_kv_t*));
+    if (elements == NULL) {
+        return -ENOMEM;
+    }
+
+    // Rehash a single table
+    map_migrate(map, SIZE_MAX);
+    map_index_reset(map);
+    map_hash_key_init(&map->hash_key);
+    map->keyed = true;
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        map_kv_t* current = map->elements[i];
+
+        while (current != NULL) {
+            map_kv_t* next      = current->next;
+            current->hash       = map_hash(map, current->key->bytes, current->key->size);
+            uint32_t index      = current->hash % (uint32_t)map->capacity;
+
+            current->next       = elements[index];
+            elements[index]     = current;
+            current             = next;
+        }
+    }
+
+    map_release(map, map->elements, map->capacity * sizeof(map_kv_t*));
+    map->elements = elements;
+    map->rekeys++;
+
+    return 0;
+}
+
+void map_watch_chain(map_t* map, const map_kv_t* kv, uint64_t probes) {
+    if (map_is_small(map) || map->dense) {
+        return;
+    }
+
+    size_t bucket = kv->hash % (uint32_t)map->capacity;
+    bool indexed  = map->indexes != NULL && map->indexes[bucket] != NULL;
+    size_t length = indexed ? map->indexes[bucket]->count : (size_t)probes + 1;
+
+    // Only crafted keys pile this many entries into one bucket; a failed
+    // switch leaves the map working as before
+    if (length > MAP_CHAIN_LIMIT && map->rekey_credit == 0) {
+        if (map_rekey(map) == 0) {
+            map->rekey_credit = map->count;
+            return;
+        }
+    } else if (map->rekey_credit > 0) {
+        map->rekey_credit--;
+    }
+
+    // Chains the hash cannot break up get searched by bisection. Background
+    // migration relinks buckets behind the writer's back, so those maps skip it
+    if (length > MAP_TREEIFY_LIMIT && !indexed && map->old_elements == NULL &&
+        (map->sync == NULL || !map->sync->has_worker)) {
+        map_index_build(map, bucket);
+    }
+}
+
+static ssize_t map_put_locked(map_t* map, uint32_t hash, const map_key_t* key, void* element) {
+    if (map->flags & MAP_FLAG_ADAPTIVE) {
+        map->counters.puts++;
+        map_adapt_tick(map);
+    }
+
+    const bool unhashed    = map_is_small(map) || map->dense;
+    ssize_t reserve_result = map_reserve(map, map->count + 1);
+    if (reserve_result == 0) {
+        reserve_result = map_dense_cover(map, key->bytes, map->count + 1);
+    }
+
+    if (reserve_result < 0) {
+        return reserve_result;
+    }
+
+    // The key went unhashed while the map was small or direct-addressed
+    if (unhashed && !map_is_small(map) && !map->dense) {
+        hash = map_key_unkeyed_hash(key);
+    }
+
+    // Check for existing entry with the key
+    uint64_t probes = map->counters.probes;
+    if (map_find_key(map, hash, key) != NULL) {
+        return -EEXIST;
+    }
+
+    map_kv_t* bck = map_kv_create_key(map, hash, key, element);
+    if (bck == NULL) {
+        return -ENOMEM;
+    }
+
+    map_link(map, bck);
+    map_notify(map, MAP_CHANGE_INSERT, bck, bck->value);
+    map_watch_chain(map, bck, map->counters.probes - probes);
+
+    if (map->sync != NULL && map->sync->has_worker) {
+        map_request_resize(map);
+    }
+
+    return 0;
+}
+
+static ssize_t map_remove_locked(map_t* map, uint32_t hash, const map_key_t* key, void* out);
+
+static ssize_t map_apply_locked(map_t* map, const map_op_t* op) {
+    if (op->kind == MAP_OP_PUT) {
+        return map_put_locked(map, op->hash, &op->key, op->data);
+    }
+
+    return map_remove_locked(map, op->hash, &op->key, op->data);
+}
+
+/**
+ * Applies every published mutation in one pass, ordered by bucket so that
+ * neighbouring writes touch neighbouring memory. Called with the lock held.
+ */
+static void map_combine_batch(map_t* map) {
+    map_op_t* ops = map->sync->ops;
+    map_op_t* batch[MAP_COMBINE_SLOTS];
+    size_t buckets[MAP_COMBINE_SLOTS];
+    size_t count = 0;
+
+    for (size_t i = 0; i < MAP_COMBINE_SLOTS; i++) {
+        if (atomic_load_explicit(&ops[i].state, memory_order_acquire) != MAP_OP_PENDING) {
+            continue;
+        }
+
+        // Insertion sort, the batch is at most MAP_COMBINE_SLOTS long
+        size_t bucket = ops[i].hash % map->capacity;
+        size_t j      = count++;
+        while (j > 0 && buckets[j - 1] > bucket) {
+            batch[j]   = batch[j - 1];
+            buckets[j] = buckets[j - 1];
+            j--;
+        }
+
+        batch[j]   = &ops[i];
+        buckets[j] = bucket;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        batch[i]->result = map_apply_locked(map, batch[i]);
+        atomic_store_explicit(&batch[i]->state, MAP_OP_DONE, memory_order_release);
+    }
+}
+
+static map_op_t* map_op_claim(map_op_t* ops) {
+    static atomic_size_t next_hint;
+    static _Thread_local size_t hint = SIZE_MAX;
+
+    // Spread threads over the slots so they rarely contend for the same one
+    if (hint == SIZE_MAX) {
+        hint = atomic_fetch_add(&next_hint, 1);
+    }
+
+    for (size_t i = 0; i < MAP_COMBINE_SLOTS; i++) {
+        map_op_t* op = &ops[(hint + i) % MAP_COMBINE_SLOTS];
+        int expected = MAP_OP_FREE;
+
+        if (atomic_compare_exchange_strong(&op->state, &expected, MAP_OP_CLAIMED)) {
+            return op;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Flat combining: publish the mutation in a slot, then either wait for another
+ * thread to apply it or take the lock and apply every pending one as a batch.
+ */
+static ssize_t map_combine(map_t* map, int kind, uint32_t hash, const map_key_t* key, void* data) {
+    map_sync_t* sync = map->sync;
+    map_op_t* op     = map_op_claim(sync->ops);
+
+    if (op == NULL) {
+        const map_op_t direct = {.kind = kind, .hash = hash, .key = *key, .data = data};
+
+        map_write_begin(map);
+        ssize_t result = map_apply_locked(map, &direct);
+        map_write_end(map);
+
+        return result;
+    }
+
+    op->kind = kind;
+    op->hash = hash;
+    op->key  = *key;
+    op->data = data;
+    atomic_store_explicit(&op->state, MAP_OP_PENDING, memory_order_release);
+
+    while (atomic_load_explicit(&op->state, memory_order_acquire) != MAP_OP_DONE) {
+        if (pthread_mutex_trylock(&sync->lock) == 0) {
+            map_seq_begin(map);
+            map_combine_batch(map);
+            map_seq_end(map);
+            pthread_mutex_unlock(&sync->lock);
+        } else {
+            sched_yield();
+        }
+    }
+
+    ssize_t result = op->result;
+    atomic_store_explicit(&op->state, MAP_OP_FREE, memory_order_release);
+
+    return result;
+}
+
+static ssize_t map_put_key(map_t* map, const map_key_t* key, void* element) {
+    if (map_is_static(map)) {
+        return map_static_put(map, key, element);
+    }
+
+    uint32_t hash = map_key_hash(map, key);
+
+    if (map->sync != NULL && map->sync->ops != NULL) {
+        return map_combine(map, MAP_OP_PUT, hash, key, element);
+    }
+
+    map_write_begin(map);
+    ssize_t result = map_put_locked(map, hash, key, element);
+    map_write_end(map);
+
+    return result;
+}
+
+ssize_t map_put(map_t* map, const char* key, size_t size, void* element) {
+    if (map == NULL || key == NULL || size == 0 || element == NULL) {
+        return -EINVAL;
+    }
+
+    if (size > MAP_KEY_MAX_LEN) {
+        return -EOVERFLOW;
+    }
+
+    if (map->key_width != 0 && size != map->key_width) {
+        return -EINVAL;
+    }
+
+    const map_key_t view = map_key_of(map, key, size);
+    return map_put_key(map, &view, element);
+}
+
+/**
+ * Lock-free lookup for single-writer maps: walk the table without taking any
+ * lock and retry if the writer touched the map in the meantime. Nodes and
+ * tables the writer unlinks stay allocated until this reader's epoch ends.
+ */
+ssize_t map_get_optimistic(map_t* map, uint32_t hash, const map_key_t* key, void* out, map_handle_t* handle) {
+    map_epoch_slot_t* slot = map_epoch_enter();
+    ssize_t result         = -ENOENT;
+
+    for (;;) {
+        uint64_t seq              = map_read_begin(map);
+        map_kv_t* const* elements = map->elements;
+        size_t capacity           = map->capacity;
+
+        // The table pointer and capacity must come from the same version
+        if (!map_read_valid(map, seq)) {
+            continue;
+        }
+
+        // A switch to the keyed hash bumps the sequence like any other write
+        uint32_t probe    = map->keyed ? map_key_siphash(&map->hash_key, key) : hash;
+        result            = -ENOENT;
+        map_kv_t* current = elements[probe % (uint32_t)capacity];
+
+        // Chains can be relinked under us, so validate on every step
+        while (current != NULL && map_read_valid(map, seq)) {
+            if (current->hash == probe && current->key->size == key->len &&
+                map_key_equal(key, current->key->bytes)) {
+                if (out != NULL) {
+                    memcpy(out, current->value, map->size);
+                }
+
+                if (handle != NULL) {
+                    *handle = (map_handle_t){.map = map, .node = current, .generation = map->handle_gen};
+                }
+
+                result = 0;
+                break;
+            }
+
+            current = current->next;
+        }
+
+        if (map_read_valid(map, seq)) {
+            break;
+        }
+    }
+
+    map_epoch_exit(slot);
+    return result;
+}
+
+static ssize_t map_get_key(map_t* map, uint32_t hash, const map_key_t* key, void* out) {
+    ssize_t result = -ENOENT;
+
+    if (map_is_static(map)) {
+        return map_static_get(map, key, out);
+    }
+
+    if (map->flags & MAP_FLAG_SINGLE_WRITER) {
+        return map_get_optimistic(map, hash, key, out, NULL);
+    }
+
+    map_lock(map);
+    map_kv_t** link = map_find_key(map, hash, key);
+    if (link != NULL) {
+        memcpy(out, (*link)->value, map->size);
+        result = 0;
+    }
+
+    if (map->flags & MAP_FLAG_ADAPTIVE) {
+        map->counters.gets++;
+        map->counters.hits += result == 0;
+        map_adapt_tick(map);
+    }
+    map_unlock(map);
+
+    return result;
+}
+
+ssize_t map_get_hashed(map_t* map, uint32_t hash, const char* key, size_t size, void* out) {
+    if (map->key_width != 0 && size != map->key_width) {
+        return -EINVAL;
+    }
+
+    const map_key_t view = map_key_of(map, key, size);
+    return map_get_key(map, hash, &view, out);
+}
+
+ssize_t map_get(map_t* map, const char* key, size_t size, void* out) {
+    if (map == NULL || key == NULL || size == 0 || out == NULL) {
+        return -EINVAL;
+    }
+
+    if (map->key_width != 0 && size != map->key_width) {
+        return -EINVAL;
+    }
+
+    const map_key_t view = map_key_of(map, key, size);
+    return map_get_key(map, map_key_hash(map, &view), &view, out);
+}
+
+static ssize_t map_remove_locked(map_t* map, uint32_t hash, const map_key_t* key, void* out) {
+    if (map->flags & MAP_FLAG_ADAPTIVE) {
+        map->counters.removes++;
+        map_adapt_tick(map);
+    }
+
+    map_kv_t** link = map_find_key(map, hash, key);
+    if (link == NULL) {
+        return -ENOENT;
+    }
+
+    memcpy(out, (*link)->value, map->size);
+    map_unlink(map, link);
+
+    map_rebalance(map);
+    return 0;
+}
+
+static ssize_t map_remove_key(map_t* map, const map_key_t* key, void* out) {
+    if (map_is_static(map)) {
+        return map_static_remove(map, key, out);
+    }
+
+    uint32_t hash = map_key_hash(map, key);
+
+    if (map->sync != NULL && map->sync->ops != NULL) {
+        return map_combine(map, MAP_OP_REMOVE, hash, key, out);
+    }
+
+    map_write_begin(map);
+    ssize_t result = map_remove_locked(map, hash, key, out);
+    map_write_end(map);
+
+    return result;
+}
+
+ssize_t map_remove(map_t* map, const char* key, size_t len, void* out) {
+    if (map == NULL || key == NULL || len == 0 || out == NULL) {
+        return -EINVAL;
+    }
+
+    if (map->key_width != 0 && len != map->key_width) {
+        return -EINVAL;
+    }
+
+    const map_key_t view = map_key_of(map, key, len);
+    return map_remove_key(map, &view, out);
+}
+
+/**
+ * Describes `parts` as a key view. A single part is a contiguous key and takes
+ * the ordinary paths, and so does a fixed-width key, gathered into `scratch`
+ * for its vector compare. Returns false if the parts are malformed or empty,
+ * or do not add up to a fixed-width map's key width.
+ */
+static bool map_key_parts(const map_t* map, map_key_t* key, const struct iovec* parts, size_t count,
+                          char (*scratch)[32]) {
+    if (parts == NULL || count == 0) {
+        return false;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if ((parts[i].iov_base == NULL && parts[i].iov_len > 0) || parts[i].iov_len > SIZE_MAX - len) {
+            return false;
+        }
+
+        len += parts[i].iov_len;
+    }
+
+    if (map->key_width != 0) {
+        if (len != map->key_width) {
+            return false;
+        }
+
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(*scratch + offset, parts[i].iov_base, parts[i].iov_len);
+            offset += parts[i].iov_len;
+        }
+
+        *key = map_key_of(map, *scratch, len);
+    } else if (count == 1) {
+        *key = map_key_of(map, parts[0].iov_base, len);
+    } else {
+        *key = (map_key_t){.parts = parts, .count = count, .len = len, .fold = map_folds(map)};
+    }
+
+    return len > 0;
+}
+
+ssize_t map_putv(map_t* map, const struct iovec* parts, size_t count, void* element) {
+    map_key_t key;
+    char scratch[32];
+
+    if (map == NULL || element == NULL || !map_key_parts(map, &key, parts, count, &scratch)) {
+        return -EINVAL;
+    }
+
+    if (key.len > MAP_KEY_MAX_LEN) {
+        return -EOVERFLOW;
+    }
+
+    return map_put_key(map, &key, element);
+}
+
+ssize_t map_getv(map_t* map, const struct iovec* parts, size_t count, void* out) {
+    map_key_t key;
+    char scratch[32];
+
+    if (map == NULL || out == NULL || !map_key_parts(map, &key, parts, count, &scratch)) {
+        return -EINVAL;
+    }
+
+    // No stored key is this long
+    if (key.len > MAP_KEY_MAX_LEN) {
+        return -ENOENT;
+    }
+
+    return map_get_key(map, map_key_hash(map, &key), &key, out);
+}
+
+ssize_t map_removev(map_t* map, const struct iovec* parts, size_t count, void* out) {
+    map_key_t key;
+    char scratch[32];
+
+    if (map == NULL || out == NULL || !map_key_parts(map, &key, parts, count, &scratch)) {
+        return -EINVAL;
+    }
+
+    if (key.len > MAP_KEY_MAX_LEN) {
+        return -ENOENT;
+    }
+
+    return map_remove_key(map, &key, out);
+}
+
+size_t map_count(const map_t* this) {
+    if (this->flags & MAP_FLAG_SINGLE_WRITER) {
+        size_t count;
+        uint64_t seq;
+
+        do {
+            seq   = map_read_begin(this);
+            count = this->count;
+        } while (!map_read_valid(this, seq));
+
+        return count;
+    }
+
+    map_lock(this);
+    size_t count = this->count;
+    map_unlock(this);
+
+    return count;
+}
+
+static void map_free_entries(const map_t* map, map_kv_t** elements, size_t capacity) {
+    for (size_t i = 0; i < capacity; i++) {
+        map_kv_t* current = elements[i];
+        while (current != NULL) {
+            map_kv_t* next = current->next;
+            map_kv_discard(map, current);
+            current = next;
+        }
+    }
+}
+
+static void map_free_table(const map_t* map, map_kv_t** elements, size_t capacity) {
+    map_free_entries(map, elements, capacity);
+    map_dealloc(map, elements, capacity * sizeof(map_kv_t*));
+}
+
+static void map_sync_destroy(map_t* map) {
+    map_sync_t* sync = map->sync;
+
+    if (sync->has_worker) {
+        pthread_mutex_lock(&sync->lock);
+        sync->stop = true;
+        pthread_cond_signal(&sync->wake);
+        pthread_mutex_unlock(&sync->lock);
+        pthread_join(sync->worker, NULL);
+    }
+
+    pthread_cond_destroy(&sync->wake);
+    pthread_mutex_destroy(&sync->lock);
+    free(sync->ops);
+    free(sync);
+    map->sync = NULL;
+}
+
+static ssize_t map_sync_init(map_t* map) {
+    map_sync_t* sync = calloc(1, sizeof(*sync));
+    if (sync == NULL) {
+        return -ENOMEM;
+    }
+
+    if (pthread_mutex_init(&sync->lock, NULL) != 0) {
+        free(sync);
+        return -ENOMEM;
+    }
+
+    if (pthread_cond_init(&sync->wake, NULL) != 0) {
+        pthread_mutex_destroy(&sync->lock);
+        free(sync);
+        return -ENOMEM;
+    }
+
+    map->sync = sync;
+
+    if (map->flags & MAP_FLAG_COMBINING) {
+        sync->ops = aligned_alloc(_Alignof(map_op_t), MAP_COMBINE_SLOTS * sizeof(map_op_t));
+        if (sync->ops == NULL) {
+            map_sync_destroy(map);
+            return -ENOMEM;
+        }
+
+        for (size_t i = 0; i < MAP_COMBINE_SLOTS; i++) {
+            atomic_init(&sync->ops[i].state, MAP_OP_FREE);
+        }
+    }
+
+    if (map->flags & MAP_FLAG_BACKGROUND_RESIZE) {
+        if (pthread_create(&sync->worker, NULL, map_resize_worker, map) != 0) {
+            map_sync_destroy(map);
+            return -EAGAIN;
+        }
+
+        sync->has_worker = true;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases everything `map` holds except the structure itself.
+ */
+static void map_teardown(map_t* map) {
+    if (map->sync != NULL) {
+        map_sync_destroy(map);
+    }
+
+    if (map->changes != NULL) {
+        map_changes_detach(map->changes);
+    }
+
+    if (map->old_elements != NULL) {
+        map_free_table(map, map->old_elements, map->old_capacity);
+    }
+
+    map_index_reset(map);
+
+    if (map_is_small(map)) {
+        map_free_entries(map, map->elements, map->capacity);
+    } else {
+        map_free_table(map, map->elements, map->capacity);
+    }
+
+    // Readers must be gone by the time the map is freed
+    for (size_t i = 0; i < map->retired_count; i++) {
+        free(map->retired[i].ptr);
+    }
+
+    free(map->retired);
+    map_dealloc(map, map->occupied, map_occupied_bytes(map->capacity));
+    map_slabs_free(map);
+}
+
+ssize_t map_free(map_t* map) {
+    // The buffer of a static map belongs to the caller
+    if (map != NULL && map_is_static(map)) {
+        return 0;
+    }
+
+    if (map == NULL || map->elements == NULL || map->embedded) {
+        return -EINVAL;
+    }
+
+    map_teardown(map);
+    map_dealloc(map, map, sizeof(*map));
+    return 0;
+}
+
+/**
+ * Sets up a map in zeroed memory. Fails with -EINVAL on flags that do not go
+ * together, or -ENOMEM; nothing is left to release on failure.
+ */
+static ssize_t map_setup(map_t* map, size_t size, uint32_t flags) {
+    if ((flags & ~MAP_FLAGS_KNOWN) != 0) {
+        return -EINVAL;
+    }
+
+    // The resize worker and the combiner share the table with other threads
+    if (flags & (MAP_FLAG_BACKGROUND_RESIZE | MAP_FLAG_COMBINING)) {
+        flags |= MAP_FLAG_CONCURRENT;
+    }
+
+    // A single-writer map has exactly one writer; a locked or background-resized
+    // map has several
+    if ((flags & MAP_FLAG_SINGLE_WRITER) && (flags & MAP_FLAG_CONCURRENT)) {
+        return -EINVAL;
+    }
+
+    // Lock-free readers cannot count their lookups
+    if ((flags & MAP_FLAG_SINGLE_WRITER) && (flags & MAP_FLAG_ADAPTIVE)) {
+        return -EINVAL;
+    }
+
+    // Fixed-width keys are binary, and have one width
+    const uint32_t widths = flags & (MAP_FLAG_KEY_16 | MAP_FLAG_KEY_32 | MAP_FLAG_KEY_64);
+    if ((widths & (widths - 1)) != 0 || (widths != 0 && (flags & MAP_FLAG_CASE_INSENSITIVE))) {
+        return -EINVAL;
+    }
+
+    // Maps no other thread touches start out small and only get a table once
+    // they outgrow the inline slots
+    if ((flags & (MAP_FLAG_CONCURRENT | MAP_FLAG_SINGLE_WRITER)) == 0) {
+        map->elements = map->small.nodes;
+        map->capacity = MAP_SMALL_SLOTS;
+    } else {
+        map->elements = calloc(precomputed_prime_table[0], sizeof(map_kv_t*));
+        if (map->elements == NULL) {
+            return -ENOMEM;
+        }
+
+        map->capacity = precomputed_prime_table[0];
+    }
+
+    map->size      = size;
+    map->count     = 0;
+    map->flags     = flags;
+    map->key_width = widths == MAP_FLAG_KEY_16   ? 16
+                     : widths == MAP_FLAG_KEY_32 ? 32
+                     : widths == MAP_FLAG_KEY_64 ? 8
+                                                 : 0;
+    atomic_init(&map->seq, 0);
+    map_adapt_init(map);
+
+    if (flags & MAP_FLAG_CONCURRENT) {
+        ssize_t result = map_sync_init(map);
+        if (result < 0) {
+            free(map->elements);
+            map->elements = NULL;
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+map_t* map_create_ex(size_t size, uint32_t flags) {
+    map_t* map = calloc(1, sizeof(*map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    if (map_setup(map, size, flags) < 0) {
+        free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+static_assert(sizeof(map_t) <= MAP_STORAGE_SIZE, "map_storage_t is too small for map_t");
+static_assert(_Alignof(map_t) <= _Alignof(map_storage_t), "map_storage_t is not aligned for map_t");
+
+map_t* map_init(map_storage_t* storage, size_t size, uint32_t flags) {
+    if (storage == NULL) {
+        return NULL;
+    }
+
+    memset(storage, 0, sizeof(*storage));
+
+    map_t* map = (map_t*)(void*)storage;
+    if (map_setup(map, size, flags) < 0) {
+        return NULL;
+    }
+
+    map->embedded = true;
+    return map;
+}
+
+ssize_t map_destroy(map_storage_t* storage) {
+    map_t* map = (map_t*)(void*)storage;
+    if (map == NULL || map->elements == NULL || !map->embedded) {
+        return -EINVAL;
+    }
+
+    map_teardown(map);
+    memset(storage, 0, sizeof(*storage));
+    return 0;
+}
+
+map_t* map_create_in(map_family_t* family, size_t size, uint32_t flags) {
+    // The family's pools have no locks
+    const uint32_t shared =
+        MAP_FLAG_CONCURRENT | MAP_FLAG_SINGLE_WRITER | MAP_FLAG_BACKGROUND_RESIZE | MAP_FLAG_COMBINING;
+    if (family == NULL || (flags & shared) != 0) {
+        return NULL;
+    }
+
+    map_t* map = map_family_zalloc(family, sizeof(*map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    map->family = family;
+    if (map_setup(map, size, flags) < 0) {
+        map_family_release(family, map, sizeof(*map));
+        return NULL;
+    }
+
+    return map;
+}
+
+map_t* map_create(size_t size) {
+    return map_create_ex(size, 0);
+}
+
+/**
+ * Number of buckets handed to a pool thread at a time by map_foreach_parallel.
+ */
+#define MAP_FOREACH_CHUNK (256)
+
+typedef struct map_foreach {
+    map_t* map;
+    map_foreach_fn fn;
+    void* ctx;
+} map_foreach_t;
+
+static void map_foreach_chunk(void* arg, size_t index) {
+    map_foreach_t* foreach = arg;
+    map_t* map             = foreach->map;
+    size_t end             = (index + 1) * MAP_FOREACH_CHUNK;
+
+    if (end > map->capacity) {
+        end = map->capacity;
+    }
+
+    for (size_t i = index * MAP_FOREACH_CHUNK; i < end; i++) {
+        for (map_kv_t* current = map->elements[i]; current != NULL; current = current->next) {
+            foreach->fn(foreach->ctx, current->key->bytes, current->key->size, current->value);
+        }
+    }
+}
+
+ssize_t map_foreach_parallel(map_t* map, map_pool_t* pool, map_foreach_fn fn, void* ctx) {
+    if (map == NULL || pool == NULL || fn == NULL || map_is_static(map)) {
+        return -EINVAL;
+    }
+
+    map_foreach_t foreach = {.map = map, .fn = fn, .ctx = ctx};
+
+    // Walk a single table: finish any migration first and keep writers out
+    map_lock(map);
+    map_migrate(map, SIZE_MAX);
+
+    size_t chunks  = (map->capacity + MAP_FOREACH_CHUNK - 1) / MAP_FOREACH_CHUNK;
+    ssize_t result = map_pool_parallel_for(pool, chunks, map_foreach_chunk, &foreach);
+    map_unlock(map);
+
+    return result;
+}
+
+/**
+ * First bucket at or after `index` that holds an entry, or the capacity. A
+ * direct-addressed map skips 64 empty slots at a time in its bitmap.
+ */
+static size_t map_next_bucket(const map_t* map, size_t index) {
+    if (!map->dense) {
+        while (index < map->capacity && map->elements[index] == NULL) {
+            index++;
+        }
+
+        return index;
+    }
+
+    const size_t words = (map->capacity + 63) / 64;
+    size_t word        = index / 64;
+    uint64_t bits      = word < words ? map->occupied[word] & (UINT64_MAX << (index % 64)) : 0;
+
+    while (bits == 0) {
+        if (++word >= words) {
+            return map->capacity;
+        }
+
+        bits = map->occupied[word];
+    }
+
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+}
+
+ssize_t map_iter_next(map_iter_t* iter, void* key_out, size_t* key_len_out, void* value_out) {
+    if (iter == NULL || key_out == NULL || key_len_out == NULL || value_out == NULL) {
+        return -EINVAL;
+    }
+
+    // Check if we're at the end of the map
+    if (iter->index >= iter->map->capacity) {
+        return -ENOENT;
+    }
+
+    if (map_is_static(iter->map)) {
+        map_static_entry(iter->map, iter->index, key_out, key_len_out, value_out);
+        iter->index = map_static_next(iter->map, iter->index + 1);
+        return 0;
+    }
+
+    // Copy current element's data
+    char** key_out_ptr = (char**)key_out;
+    *key_out_ptr       = iter->current->key->bytes;
+    *key_len_out       = iter->current->key->size;
+    memcpy(value_out, iter->current->value, iter->map->size);
+
+    // Move to the next element
+    if (iter->current->next != NULL) {
+        // Move to the next element in the current bucket
+        iter->current = iter->current->next;
+    } else {
+        // Move to the next non-empty bucket
+        iter->current = NULL;
+        iter->index   = map_next_bucket(iter->map, iter->index + 1);
+
+        if (iter->index < iter->map->capacity) {
+            iter->current = iter->map->elements[iter->index];
+        }
+    }
+
+    return 0;
+}
+
+ssize_t map_iter_free(map_iter_t* iter) {
+    if (iter == NULL) {
+        return -EINVAL;
+    }
+
+    free(iter);
+    return 0;
+}
+
+map_iter_t* map_iter_create(map_t* map) {
+    if (map == NULL) {
+        return NULL;
+    }
+
+    map_iter_t* iter = malloc(sizeof(*iter));
+    if (iter == NULL) {
+        return NULL;
+    }
+
+    // Iteration only walks the live table, so drain any in-flight migration
+    map_lock(map);
+    map_migrate(map, SIZE_MAX);
+    map_unlock(map);
+
+    iter->map     = map;
+    iter->index   = 0;
+    iter->current = NULL;
+
+    // Find the first non-empty bucket
+    if (map_is_static(map)) {
+        iter->index = map_static_next(map, 0);
+        return iter;
+    }
+
+    iter->index = map_next_bucket(map, 0);
+
     // Set current to the first element if one exists
     if (iter->index < map->capacity) {
         iter->current = map->elements[iter->index];
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+/**
+ * Longest key kept inline in a cache slot; lookups of longer keys go straight
+ * to the map. Sized so a slot header plus a small value fits a cache line.
+ */
+#define MAP_CACHE_KEY_LEN (40)
+
+typedef struct map_cache_slot {
+    uint64_t version;
+    uint32_t hash;
+    uint32_t len;
+    char key[MAP_CACHE_KEY_LEN];
+    uint8_t value[];
+} map_cache_slot_t;
+
+typedef struct map_cache {
+    map_t* map;
+    size_t mask;
+    size_t stride;
+    uint8_t* slots;
+} map_cache_t;
+
+static inline map_cache_slot_t* map_cache_slot(const map_cache_t* cache, uint32_t hash) {
+    return (map_cache_slot_t*)(void*)(cache->slots + (hash & cache->mask) * cache->stride);
+}
+
+map_cache_t* map_cache_create(map_t* map, size_t slots) {
+    if (map == NULL || slots == 0 || map_is_static(map)) {
+        return NULL;
+    }
+
+    // Round up to a power of two so the slot index is a mask of the hash
+    size_t count = 1;
+    while (count < slots) {
+        count <<= 1;
+    }
+
+    const size_t align = _Alignof(map_cache_slot_t);
+    const size_t value = (map->size + align - 1) & ~(align - 1);
+
+    map_cache_t* cache = malloc(sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->map    = map;
+    cache->mask   = count - 1;
+    cache->stride = sizeof(map_cache_slot_t) + value;
+    cache->slots  = calloc(count, cache->stride);
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+ssize_t map_cache_get(map_cache_t* cache, const char* key, size_t len, void* out) {
+    if (cache == NULL || key == NULL || len == 0 || out == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map = cache->map;
+    if (len > MAP_CACHE_KEY_LEN) {
+        return map_get(map, key, len, out);
+    }
+
+    // A slot is only valid for the map version it was filled at; the counter is
+    // odd while a write is in progress, which never matches a filled slot
+    uint32_t hash          = map_unkeyed_hash(map, key, len);
+    uint64_t version       = atomic_load_explicit(&map->seq, memory_order_acquire);
+    map_cache_slot_t* slot = map_cache_slot(cache, hash);
+
+    if (slot->version == version && slot->hash == hash && slot->len == len &&
+        memcmp(slot->key, key, len) == 0) {
+        memcpy(out, slot->value, map->size);
+        return 0;
+    }
+
+    ssize_t result = map_get_hashed(map, hash, key, len, out);
+
+    // Only cache the value if no write landed while it was being read
+    if (result == 0 && (version & 1) == 0 &&
+        atomic_load_explicit(&map->seq, memory_order_acquire) == version) {
+        slot->version = version;
+        slot->hash    = hash;
+        slot->len     = (uint32_t)len;
+        memcpy(slot->key, key, len);
+        memcpy(slot->value, out, map->size);
+    }
+
+    return result;
+}
+
+ssize_t map_cache_free(map_cache_t* cache) {
+    if (cache == NULL) {
+        return -EINVAL;
+    }
+
+    free(cache->slots);
+    free(cache);
+    return 0;
+}
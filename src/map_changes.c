@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+typedef struct map_change_record {
+    uint64_t seq;
+    uint32_t kind;
+    uint32_t len;
+    char key[MAP_KEY_MAX_LEN];
+    uint8_t value[];
+} map_change_record_t;
+
+/**
+ * Single-producer/single-consumer ring. The producer is whoever holds the map's
+ * write section, so producers are already serialized by the map itself.
+ */
+typedef struct map_changes {
+    map_t* map;
+    size_t mask;
+    size_t stride;
+    uint8_t* records;
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint64_t tail;
+    _Atomic uint64_t dropped;
+} map_changes_t;
+
+static inline map_change_record_t* map_changes_record(const map_changes_t* changes, uint64_t index) {
+    return (map_change_record_t*)(void*)(changes->records + (index & changes->mask) * changes->stride);
+}
+
+void map_changes_publish(map_changes_t* changes, uint64_t seq, map_change_kind_t kind, const string_t* key,
+                         const void* value, size_t size) {
+    uint64_t head = atomic_load_explicit(&changes->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&changes->tail, memory_order_acquire);
+
+    // Full: drop the record, the consumer sees the gap in sequence numbers
+    if (head - tail > changes->mask) {
+        atomic_fetch_add_explicit(&changes->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    map_change_record_t* record = map_changes_record(changes, head);
+    record->seq                 = seq;
+    record->kind                = (uint32_t)kind;
+    record->len                 = (uint32_t)key->size;
+    memcpy(record->key, key->bytes, key->size);
+    memcpy(record->value, value, size);
+
+    atomic_store_explicit(&changes->head, head + 1, memory_order_release);
+}
+
+void map_changes_detach(map_changes_t* changes) {
+    changes->map = NULL;
+}
+
+map_changes_t* map_changes_create(map_t* map, size_t capacity) {
+    if (map == NULL || capacity == 0 || map_is_static(map)) {
+        return NULL;
+    }
+
+    size_t count = 1;
+    while (count < capacity) {
+        count <<= 1;
+    }
+
+    const size_t align = _Alignof(map_change_record_t);
+    const size_t value = (map->size + align - 1) & ~(align - 1);
+
+    map_changes_t* changes = aligned_alloc(_Alignof(map_changes_t), sizeof(*changes));
+    if (changes == NULL) {
+        return NULL;
+    }
+
+    changes->map     = map;
+    changes->mask    = count - 1;
+    changes->stride  = sizeof(map_change_record_t) + value;
+    changes->records = malloc(count * changes->stride);
+    atomic_init(&changes->head, 0);
+    atomic_init(&changes->tail, 0);
+    atomic_init(&changes->dropped, 0);
+
+    if (changes->records == NULL) {
+        free(changes);
+        return NULL;
+    }
+
+    map_write_begin(map);
+    bool attached = map->changes == NULL;
+    if (attached) {
+        map->changes = changes;
+    }
+    map_write_end(map);
+
+    if (!attached) {
+        free(changes->records);
+        free(changes);
+        return NULL;
+    }
+
+    return changes;
+}
+
+ssize_t map_changes_drain(map_changes_t* changes, map_change_fn fn, void* ctx, size_t max) {
+    if (changes == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    uint64_t tail = atomic_load_explicit(&changes->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&changes->head, memory_order_acquire);
+    size_t drained = 0;
+
+    while (tail != head && drained < max) {
+        const map_change_record_t* record = map_changes_record(changes, tail);
+        const map_change_t change         = {
+            .seq   = record->seq,
+            .kind  = (map_change_kind_t)record->kind,
+            .key   = record->key,
+            .len   = record->len,
+            .value = record->value,
+        };
+
+        fn(ctx, &change);
+        tail++;
+        drained++;
+    }
+
+    // Hand the drained slots back to the producer in one store
+    atomic_store_explicit(&changes->tail, tail, memory_order_release);
+    return (ssize_t)drained;
+}
+
+uint64_t map_changes_dropped(const map_changes_t* changes) {
+    if (changes == NULL) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&changes->dropped, memory_order_relaxed);
+}
+
+ssize_t map_changes_free(map_changes_t* changes) {
+    if (changes == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map = changes->map;
+    if (map != NULL) {
+        map_write_begin(map);
+        map->changes = NULL;
+        map_write_end(map);
+    }
+
+    free(changes->records);
+    free(changes);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+static bool map_diff_equal(const map_diff_ops_t* ops, const void* a, const void* b, size_t size) {
+    if (ops->compare != NULL) {
+        return ops->compare(ops->ctx, a, b, size) == 0;
+    }
+
+    return memcmp(a, b, size) == 0;
+}
+
+/**
+ * Compares bucket `index` of `a` against `b`. When both tables have the same
+ * capacity every probe into `b` lands on the same bucket index, so the walk
+ * stays sequential in both tables.
+ */
+static size_t map_diff_bucket(map_t* a, map_t* b, size_t index, const map_diff_ops_t* ops) {
+    size_t differences = 0;
+
+    for (const map_kv_t* current = a->elements[index]; current != NULL; current = current->next) {
+        map_kv_t** link = map_find(b, map_kv_hash(a, b, current), current->key->bytes, current->key->size);
+
+        if (link == NULL) {
+            if (ops->on_removed != NULL) {
+                ops->on_removed(ops->ctx, current->key->bytes, current->key->size, current->value);
+            }
+            differences++;
+        } else if (!map_diff_equal(ops, current->value, (*link)->value, a->size)) {
+            if (ops->on_changed != NULL) {
+                ops->on_changed(ops->ctx, current->key->bytes, current->key->size, current->value,
+                                (*link)->value);
+            }
+            differences++;
+        }
+    }
+
+    return differences;
+}
+
+static size_t map_diff_added(map_t* a, map_t* b, size_t index, const map_diff_ops_t* ops) {
+    size_t differences = 0;
+
+    for (const map_kv_t* current = b->elements[index]; current != NULL; current = current->next) {
+        if (map_find(a, map_kv_hash(b, a, current), current->key->bytes, current->key->size) == NULL) {
+            if (ops->on_added != NULL) {
+                ops->on_added(ops->ctx, current->key->bytes, current->key->size, current->value);
+            }
+            differences++;
+        }
+    }
+
+    return differences;
+}
+
+ssize_t map_diff(map_t* a, map_t* b, const map_diff_ops_t* ops) {
+    if (a == NULL || b == NULL || ops == NULL || a->size != b->size || map_is_static(a) || map_is_static(b)) {
+        return -EINVAL;
+    }
+
+    if (a == b) {
+        return 0;
+    }
+
+    // Lock in address order so concurrent diffs of the same pair cannot deadlock
+    map_t* first  = (uintptr_t)a < (uintptr_t)b ? a : b;
+    map_t* second = first == a ? b : a;
+
+    map_lock(first);
+    map_lock(second);
+
+    // Walk single tables only
+    map_migrate(a, SIZE_MAX);
+    map_migrate(b, SIZE_MAX);
+
+    size_t differences = 0;
+    size_t buckets     = a->capacity > b->capacity ? a->capacity : b->capacity;
+
+    for (size_t i = 0; i < buckets; i++) {
+        if (i < a->capacity && a->elements[i] != NULL) {
+            differences += map_diff_bucket(a, b, i, ops);
+        }
+
+        if (i < b->capacity && b->elements[i] != NULL) {
+            differences += map_diff_added(a, b, i, ops);
+        }
+    }
+
+    map_unlock(second);
+    map_unlock(first);
+
+    return (ssize_t)differences;
+}
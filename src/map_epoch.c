@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "map_epoch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Slots per block. A thread holds its slot until it exits; when every slot is
+ * taken another block is chained on, so any number of threads can read. Blocks
+ * are never freed, since a reader may be scanning them at any time.
+ */
+#define MAP_EPOCH_SLOTS (128)
+
+typedef struct map_epoch_slot {
+    _Alignas(64) _Atomic uint64_t epoch;
+    atomic_bool in_use;
+} map_epoch_slot_t;
+
+typedef struct map_epoch_block {
+    map_epoch_slot_t slots[MAP_EPOCH_SLOTS];
+    _Atomic(struct map_epoch_block*) next;
+} map_epoch_block_t;
+
+static _Atomic uint64_t global_epoch = 1;
+static map_epoch_block_t first_block;
+static _Thread_local map_epoch_slot_t* thread_slot;
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static void map_epoch_slot_release(void* arg) {
+    map_epoch_slot_t* slot = arg;
+    atomic_store(&slot->epoch, 0);
+    atomic_store(&slot->in_use, false);
+}
+
+static void map_epoch_key_create(void) {
+    pthread_key_create(&slot_key, map_epoch_slot_release);
+}
+
+static map_epoch_slot_t* map_epoch_slot_claim(map_epoch_block_t* block) {
+    for (size_t i = 0; i < MAP_EPOCH_SLOTS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&block->slots[i].in_use, &expected, true)) {
+            return &block->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Chains a new block after `tail` with its first slot already claimed, or
+ * returns NULL if another thread chained one first or memory ran out.
+ */
+static map_epoch_slot_t* map_epoch_block_append(map_epoch_block_t* tail) {
+    map_epoch_block_t* block = aligned_alloc(_Alignof(map_epoch_block_t), sizeof(*block));
+    if (block == NULL) {
+        return NULL;
+    }
+
+    memset(block, 0, sizeof(*block));
+    atomic_store(&block->slots[0].in_use, true);
+
+    map_epoch_block_t* expected = NULL;
+    if (!atomic_compare_exchange_strong(&tail->next, &expected, block)) {
+        free(block);
+        return NULL;
+    }
+
+    return &block->slots[0];
+}
+
+static map_epoch_slot_t* map_epoch_slot_acquire(void) {
+    pthread_once(&slot_key_once, map_epoch_key_create);
+
+    map_epoch_block_t* block = &first_block;
+
+    for (;;) {
+        map_epoch_slot_t* slot = map_epoch_slot_claim(block);
+        if (slot == NULL && atomic_load(&block->next) == NULL) {
+            slot = map_epoch_block_append(block);
+        }
+
+        if (slot != NULL) {
+            pthread_setspecific(slot_key, slot);
+            return slot;
+        }
+
+        // Either another thread chained a block first, or memory ran out and
+        // the only way forward is a thread exiting
+        map_epoch_block_t* next = atomic_load(&block->next);
+        if (next != NULL) {
+            block = next;
+        } else {
+            sched_yield();
+            block = &first_block;
+        }
+    }
+}
+
+map_epoch_slot_t* map_epoch_enter(void) {
+    if (thread_slot == NULL) {
+        thread_slot = map_epoch_slot_acquire();
+    }
+
+    // Re-read after publishing so a concurrent retire either sees this reader
+    // or this reader sees the epoch that retire advanced to
+    uint64_t epoch = atomic_load(&global_epoch);
+    for (;;) {
+        atomic_store(&thread_slot->epoch, epoch);
+
+        uint64_t now = atomic_load(&global_epoch);
+        if (now == epoch) {
+            break;
+        }
+
+        epoch = now;
+    }
+
+    return thread_slot;
+}
+
+void map_epoch_exit(map_epoch_slot_t* slot) {
+    atomic_store_explicit(&slot->epoch, 0, memory_order_release);
+}
+
+uint64_t map_epoch_retire_tag(void) {
+    return atomic_fetch_add(&global_epoch, 1);
+}
+
+uint64_t map_epoch_oldest(void) {
+    uint64_t oldest = UINT64_MAX;
+
+    for (map_epoch_block_t* block = &first_block; block != NULL; block = atomic_load(&block->next)) {
+        for (size_t i = 0; i < MAP_EPOCH_SLOTS; i++) {
+            uint64_t epoch = atomic_load(&block->slots[i].epoch);
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+    }
+
+    return oldest;
+}
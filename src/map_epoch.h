@@ -0,0 +1,47 @@
+/**
+ * @file map_epoch.h
+ * @brief Epoch-based reclamation shared by the lock-free read paths
+ *
+ * Readers announce the global epoch in a per-thread slot for the duration of a
+ * read. Writers tag unlinked memory with map_epoch_retire_tag() and may free it
+ * once map_epoch_oldest() reports that no reader can still hold a reference.
+ */
+
+#ifndef MAP_EPOCH_H
+#define MAP_EPOCH_H
+
+#include <stdint.h>
+
+typedef struct map_epoch_slot map_epoch_slot_t;
+
+/**
+ * @brief Enters a read-side critical section on the calling thread
+ *
+ * @return The calling thread's slot, to be passed to map_epoch_exit()
+ */
+map_epoch_slot_t* map_epoch_enter(void);
+
+/**
+ * @brief Leaves the read-side critical section entered with map_epoch_enter()
+ *
+ * @param slot Slot returned by map_epoch_enter()
+ */
+void map_epoch_exit(map_epoch_slot_t* slot);
+
+/**
+ * @brief Advances the global epoch after memory has been unlinked
+ *
+ * @return Tag to store with the retired memory
+ */
+uint64_t map_epoch_retire_tag(void);
+
+/**
+ * @brief Returns the oldest epoch any reader is currently active in
+ *
+ * Memory retired with a tag lower than the returned value can be freed.
+ *
+ * @return Oldest active epoch, or UINT64_MAX if no reader is active
+ */
+uint64_t map_epoch_oldest(void);
+
+#endif /* MAP_EPOCH_H */
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+/**
+ * Bytes of each arena. Blocks of up to MAP_FAMILY_MAX_BLOCK bytes are carved
+ * from arenas in MAP_FAMILY_GRAIN steps and kept on one free list per size
+ * class once released; larger blocks, such as the bucket arrays of big maps,
+ * are allocated on their own and kept on a list so the family can free them.
+ */
+#define MAP_FAMILY_ARENA (64 * 1024)
+#define MAP_FAMILY_GRAIN (16)
+#define MAP_FAMILY_MAX_BLOCK (1024)
+#define MAP_FAMILY_CLASSES (MAP_FAMILY_MAX_BLOCK / MAP_FAMILY_GRAIN)
+
+typedef struct map_family_arena {
+    struct map_family_arena* next;
+    _Alignas(max_align_t) unsigned char data[];
+} map_family_arena_t;
+
+typedef struct map_family_large {
+    struct map_family_large* prev;
+    struct map_family_large* next;
+    _Alignas(max_align_t) unsigned char data[];
+} map_family_large_t;
+
+typedef struct map_family_free {
+    struct map_family_free* next;
+} map_family_free_t;
+
+typedef struct map_family {
+    map_family_arena_t* arenas;
+    unsigned char* cursor;
+    unsigned char* end;
+    map_family_free_t* free[MAP_FAMILY_CLASSES];
+    map_family_large_t* large;
+} map_family_t;
+
+static inline size_t map_family_class(size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / MAP_FAMILY_GRAIN;
+}
+
+map_family_t* map_family_create(void) {
+    return calloc(1, sizeof(map_family_t));
+}
+
+void* map_family_alloc(map_family_t* family, size_t bytes) {
+    if (bytes > MAP_FAMILY_MAX_BLOCK) {
+        if (bytes > SIZE_MAX - sizeof(map_family_large_t)) {
+            return NULL;
+        }
+
+        map_family_large_t* large = malloc(sizeof(*large) + bytes);
+        if (large == NULL) {
+            return NULL;
+        }
+
+        large->prev = NULL;
+        large->next = family->large;
+        if (family->large != NULL) {
+            family->large->prev = large;
+        }
+        family->large = large;
+
+        return large->data;
+    }
+
+    const size_t class = map_family_class(bytes);
+    if (family->free[class] != NULL) {
+        map_family_free_t* block = family->free[class];
+        family->free[class]      = block->next;
+        return block;
+    }
+
+    const size_t size = (class + 1) * MAP_FAMILY_GRAIN;
+    if ((size_t)(family->end - family->cursor) < size) {
+        // The tail of the old arena is given up; it is smaller than one block
+        map_family_arena_t* arena = malloc(sizeof(*arena) + MAP_FAMILY_ARENA);
+        if (arena == NULL) {
+            return NULL;
+        }
+
+        arena->next    = family->arenas;
+        family->arenas = arena;
+        family->cursor = arena->data;
+        family->end    = arena->data + MAP_FAMILY_ARENA;
+    }
+
+    void* block     = family->cursor;
+    family->cursor += size;
+    return block;
+}
+
+void* map_family_zalloc(map_family_t* family, size_t bytes) {
+    void* block = map_family_alloc(family, bytes);
+    if (block != NULL) {
+        memset(block, 0, bytes);
+    }
+
+    return block;
+}
+
+void map_family_release(map_family_t* family, void* ptr, size_t bytes) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    if (bytes > MAP_FAMILY_MAX_BLOCK) {
+        map_family_large_t* large = (map_family_large_t*)((unsigned char*)ptr - offsetof(map_family_large_t, data));
+
+        if (large->prev != NULL) {
+            large->prev->next = large->next;
+        } else {
+            family->large = large->next;
+        }
+
+        if (large->next != NULL) {
+            large->next->prev = large->prev;
+        }
+
+        free(large);
+        return;
+    }
+
+    const size_t class       = map_family_class(bytes);
+    map_family_free_t* block = ptr;
+    block->next              = family->free[class];
+    family->free[class]      = block;
+}
+
+ssize_t map_family_free(map_family_t* family) {
+    if (family == NULL) {
+        return -EINVAL;
+    }
+
+    while (family->arenas != NULL) {
+        map_family_arena_t* next = family->arenas->next;
+        free(family->arenas);
+        family->arenas = next;
+    }
+
+    while (family->large != NULL) {
+        map_family_large_t* next = family->large->next;
+        free(family->large);
+        family->large = next;
+    }
+
+    free(family);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_epoch.h"
+#include "map_internal.h"
+
+ssize_t map_find_handle(map_t* map, const char* key, size_t len, map_handle_t* out) {
+    if (map == NULL || key == NULL || len == 0 || out == NULL || map_is_static(map)) {
+        return -EINVAL;
+    }
+
+    if (map->key_width != 0 && len != map->key_width) {
+        return -EINVAL;
+    }
+
+    const map_key_t view = map_key_of(map, key, len);
+    const uint32_t hash  = map_key_hash(map, &view);
+
+    if (map->flags & MAP_FLAG_SINGLE_WRITER) {
+        return map_get_optimistic(map, hash, &view, NULL, out);
+    }
+
+    map_lock(map);
+    map_kv_t** link = map_find(map, hash, key, len);
+    if (link != NULL) {
+        *out = (map_handle_t){.map = map, .node = *link, .generation = map->handle_gen};
+    }
+    map_unlock(map);
+
+    return link != NULL ? 0 : -ENOENT;
+}
+
+ssize_t map_handle_get(const map_handle_t* handle, void* out) {
+    if (handle == NULL || handle->map == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map         = handle->map;
+    const map_kv_t* kv = handle->node;
+    bool stale;
+
+    // An unchanged generation means the entry is still linked, so it is read
+    // without looking at the table at all
+    if (map->flags & MAP_FLAG_SINGLE_WRITER) {
+        map_epoch_slot_t* slot = map_epoch_enter();
+        uint64_t seq;
+
+        do {
+            seq   = map_read_begin(map);
+            stale = map->handle_gen != handle->generation;
+            if (!stale) {
+                memcpy(out, kv->value, map->size);
+            }
+        } while (!map_read_valid(map, seq));
+
+        map_epoch_exit(slot);
+        return stale ? -ESTALE : 0;
+    }
+
+    map_lock(map);
+    stale = map->handle_gen != handle->generation;
+    if (!stale) {
+        memcpy(out, kv->value, map->size);
+    }
+    map_unlock(map);
+
+    return stale ? -ESTALE : 0;
+}
+
+ssize_t map_handle_put_value(const map_handle_t* handle, const void* value) {
+    if (handle == NULL || handle->map == NULL || value == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map   = handle->map;
+    map_kv_t* kv = handle->node;
+
+    map_write_begin(map);
+    const bool stale = map->handle_gen != handle->generation;
+    if (!stale) {
+        map_notify(map, MAP_CHANGE_UPDATE, kv, value);
+        memcpy(kv->value, value, map->size);
+    }
+    map_write_end(map);
+
+    return stale ? -ESTALE : 0;
+}
+
+/**
+ * Returns the link in the chain starting at `link` that points at `kv`, or
+ * NULL, comparing pointers only.
+ */
+static map_kv_t** map_handle_chain(map_kv_t** link, const map_kv_t* kv) {
+    while (*link != NULL && *link != kv) {
+        link = &(*link)->next;
+    }
+
+    return *link != NULL ? link : NULL;
+}
+
+/**
+ * Returns the link pointing at `kv`, which a current handle guarantees is
+ * linked. During a background resize the entry may still be in the old
+ * table.
+ */
+static map_kv_t** map_handle_link(map_t* map, const map_kv_t* kv) {
+    if (map_is_small(map)) {
+        for (size_t slot = 0; slot < MAP_SMALL_SLOTS; slot++) {
+            if (map->small.nodes[slot] == kv) {
+                return &map->small.nodes[slot];
+            }
+        }
+
+        return NULL;
+    }
+
+    if (map->dense) {
+        return &map->elements[kv->hash];
+    }
+
+    map_kv_t** link = map_handle_chain(&map->elements[kv->hash % (uint32_t)map->capacity], kv);
+    if (link == NULL && map->old_elements != NULL) {
+        link = map_handle_chain(&map->old_elements[kv->hash % (uint32_t)map->old_capacity], kv);
+    }
+
+    return link;
+}
+
+ssize_t map_handle_remove(const map_handle_t* handle, void* out) {
+    if (handle == NULL || handle->map == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map     = handle->map;
+    ssize_t result = -ESTALE;
+
+    map_write_begin(map);
+    map_kv_t** link = map->handle_gen == handle->generation ? map_handle_link(map, handle->node) : NULL;
+    if (link != NULL) {
+        memcpy(out, (*link)->value, map->size);
+        map_unlink(map, link);
+        map_rebalance(map);
+        result = 0;
+    }
+    map_write_end(map);
+
+    return result;
+}
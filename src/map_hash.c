@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "map_internal.h"
+
+#define MAP_ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define MAP_SIPROUND                                                                                    \
+    do {                                                                                                \
+        v0 += v1;                                                                                       \
+        v1 = MAP_ROTL64(v1, 13);                                                                        \
+        v1 ^= v0;                                                                                       \
+        v0 = MAP_ROTL64(v0, 32);                                                                        \
+        v2 += v3;                                                                                       \
+        v3 = MAP_ROTL64(v3, 16);                                                                        \
+        v3 ^= v2;                                                                                       \
+        v0 += v3;                                                                                       \
+        v3 = MAP_ROTL64(v3, 21);                                                                        \
+        v3 ^= v0;                                                                                       \
+        v2 += v1;                                                                                       \
+        v1 = MAP_ROTL64(v1, 17);                                                                        \
+        v1 ^= v2;                                                                                       \
+        v2 = MAP_ROTL64(v2, 32);                                                                        \
+    } while (0)
+
+static inline uint64_t map_load64(const uint8_t* bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+
+    return value;
+}
+
+/**
+ * SipHash-1-3: one compression and three finalization rounds, the variant
+ * hash tables use where the key only has to stay secret from remote clients.
+ * With `fold` set every message word is lowercased before it is absorbed.
+ */
+uint32_t map_siphash(const map_hash_key_t* key, const char* str, size_t len, bool fold) {
+    const uint8_t* in  = (const uint8_t*)str;
+    const uint8_t* end = in + (len - len % 8);
+
+    uint64_t v0 = key->k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key->k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key->k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key->k1 ^ 0x7465646279746573ULL;
+
+    for (; in != end; in += 8) {
+        uint64_t m = fold ? map_fold64(map_load64(in)) : map_load64(in);
+        v3 ^= m;
+        MAP_SIPROUND;
+        v0 ^= m;
+    }
+
+    uint64_t tail = 0;
+    for (size_t i = 0; i < len % 8; i++) {
+        tail |= (uint64_t)in[i] << (8 * i);
+    }
+
+    uint64_t b = ((uint64_t)len << 56) | (fold ? map_fold64(tail) : tail);
+
+    v3 ^= b;
+    MAP_SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    MAP_SIPROUND;
+    MAP_SIPROUND;
+    MAP_SIPROUND;
+
+    uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/**
+ * map_siphash over the concatenated parts of `key`. Bytes of a word that
+ * straddles two parts collect in `carry` until it is complete.
+ */
+uint32_t map_siphashv(const map_hash_key_t* hash_key, const map_key_t* key) {
+    uint64_t v0 = hash_key->k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = hash_key->k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = hash_key->k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = hash_key->k1 ^ 0x7465646279746573ULL;
+
+    const bool fold  = key->fold;
+    uint64_t carry   = 0;
+    unsigned carried = 0;
+
+    for (size_t i = 0; i < key->count; i++) {
+        const uint8_t* in = key->parts[i].iov_base;
+        size_t len        = key->parts[i].iov_len;
+
+        while (carried != 0 && len > 0) {
+            carry |= (uint64_t)*in++ << (8 * carried);
+            len--;
+
+            if (++carried == 8) {
+                uint64_t m = fold ? map_fold64(carry) : carry;
+                v3 ^= m;
+                MAP_SIPROUND;
+                v0 ^= m;
+                carry   = 0;
+                carried = 0;
+            }
+        }
+
+        for (; len >= 8; in += 8, len -= 8) {
+            uint64_t m = fold ? map_fold64(map_load64(in)) : map_load64(in);
+            v3 ^= m;
+            MAP_SIPROUND;
+            v0 ^= m;
+        }
+
+        while (len > 0) {
+            carry |= (uint64_t)*in++ << (8 * carried++);
+            len--;
+        }
+    }
+
+    uint64_t b = ((uint64_t)key->len << 56) | (fold ? map_fold64(carry) : carry);
+
+    v3 ^= b;
+    MAP_SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    MAP_SIPROUND;
+    MAP_SIPROUND;
+    MAP_SIPROUND;
+
+    uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint64_t map_splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void map_hash_key_init(map_hash_key_t* key) {
+    if (getrandom(key, sizeof(*key), GRND_NONBLOCK) == (ssize_t)sizeof(*key)) {
+        return;
+    }
+
+    // No entropy yet this early in boot: still better than a fixed key
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)(uintptr_t)key;
+    key->k0       = map_splitmix64(&seed);
+    key->k1       = map_splitmix64(&seed);
+}
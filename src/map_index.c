@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map_internal.h"
+
+/**
+ * Orders entries by hash, then length, then bytes. Bytes compare the way the
+ * map's lookups compare them, so the index agrees with the chains on which
+ * keys are equal.
+ */
+static int map_index_compare(uint32_t hash, const map_key_t* key, const map_kv_t* node) {
+    if (hash != node->hash) {
+        return hash < node->hash ? -1 : 1;
+    }
+
+    if (key->len != node->key->size) {
+        return key->len < node->key->size ? -1 : 1;
+    }
+
+    return map_key_compare(key, node->key->bytes);
+}
+
+/**
+ * First position whose entry does not order before the key.
+ */
+static size_t map_index_lower(const map_index_t* index, uint32_t hash, const map_key_t* key, uint64_t* probes) {
+    size_t low  = 0;
+    size_t high = index->count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        (*probes)++;
+        if (map_index_compare(hash, key, index->nodes[middle]) > 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Bytes of an index with room for `capacity` entries.
+ */
+static inline size_t map_index_bytes(size_t capacity) {
+    return sizeof(map_index_t) + capacity * sizeof(map_kv_t*);
+}
+
+/**
+ * The chain of an indexed bucket is kept in index order, so the link to the
+ * entry at `position` is the next pointer of the one before it.
+ */
+static map_kv_t** map_index_link(map_t* map, size_t bucket, const map_index_t* index, size_t position) {
+    return position == 0 ? &map->elements[bucket] : &index->nodes[position - 1]->next;
+}
+
+void map_index_build(map_t* map, size_t bucket) {
+    if (map->indexes == NULL) {
+        map->indexes = map_zalloc(map, map->capacity * sizeof(*map->indexes));
+        if (map->indexes == NULL) {
+            return;
+        }
+    }
+
+    size_t count = 0;
+    for (const map_kv_t* current = map->elements[bucket]; current != NULL; current = current->next) {
+        count++;
+    }
+
+    map_index_t* index = map_alloc(map, map_index_bytes(2 * count));
+    if (index == NULL) {
+        if (map->indexed == 0) {
+            map_dealloc(map, map->indexes, map->capacity * sizeof(*map->indexes));
+            map->indexes = NULL;
+        }
+        return;
+    }
+
+    // Sort by insertion: the chain is only just past MAP_TREEIFY_LIMIT, and
+    // qsort could not compare keys the way this map does
+    index->count    = 0;
+    index->capacity = 2 * count;
+    for (map_kv_t* current = map->elements[bucket]; current != NULL; current = current->next) {
+        const map_key_t key = map_key_of(map, current->key->bytes, current->key->size);
+        uint64_t probes     = 0;
+        size_t position     = map_index_lower(index, current->hash, &key, &probes);
+
+        memmove(&index->nodes[position + 1], &index->nodes[position],
+                (index->count - position) * sizeof(index->nodes[0]));
+        index->nodes[position] = current;
+        index->count++;
+    }
+
+    // Relink the chain in index order
+    for (size_t i = 0; i < index->count; i++) {
+        index->nodes[i]->next = i + 1 < index->count ? index->nodes[i + 1] : NULL;
+    }
+
+    map->elements[bucket] = index->nodes[0];
+    map->indexes[bucket]  = index;
+    map->indexed++;
+}
+
+void map_index_drop(map_t* map, size_t bucket) {
+    map_dealloc(map, map->indexes[bucket], map_index_bytes(map->indexes[bucket]->capacity));
+    map->indexes[bucket] = NULL;
+
+    if (--map->indexed == 0) {
+        map_dealloc(map, map->indexes, map->capacity * sizeof(*map->indexes));
+        map->indexes = NULL;
+    }
+}
+
+void map_index_reset(map_t* map) {
+    if (map->indexes == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->indexes[i] != NULL) {
+            map_dealloc(map, map->indexes[i], map_index_bytes(map->indexes[i]->capacity));
+        }
+    }
+
+    map_dealloc(map, map->indexes, map->capacity * sizeof(*map->indexes));
+    map->indexes = NULL;
+    map->indexed = 0;
+}
+
+map_kv_t** map_index_find(map_t* map, size_t bucket, uint32_t hash, const map_key_t* key, uint64_t* probes) {
+    const map_index_t* index = map->indexes[bucket];
+    size_t position          = map_index_lower(index, hash, key, probes);
+
+    if (position < index->count && map_index_compare(hash, key, index->nodes[position]) == 0) {
+        return map_index_link(map, bucket, index, position);
+    }
+
+    return NULL;
+}
+
+bool map_index_insert(map_t* map, size_t bucket, map_kv_t* kv) {
+    map_index_t* index = map->indexes[bucket];
+
+    if (index->count == index->capacity) {
+        size_t capacity    = index->capacity * 2;
+        map_index_t* grown = map_alloc(map, map_index_bytes(capacity));
+        if (grown == NULL) {
+            // The chain is still a valid chain without its index
+            map_index_drop(map, bucket);
+            return false;
+        }
+
+        memcpy(grown, index, map_index_bytes(index->count));
+        map_dealloc(map, index, map_index_bytes(index->capacity));
+
+        index                = grown;
+        index->capacity      = capacity;
+        map->indexes[bucket] = index;
+    }
+
+    const map_key_t key = map_key_of(map, kv->key->bytes, kv->key->size);
+    uint64_t probes     = 0;
+    size_t position     = map_index_lower(index, kv->hash, &key, &probes);
+    map_kv_t** link     = map_index_link(map, bucket, index, position);
+
+    kv->next = *link;
+    *link    = kv;
+
+    memmove(&index->nodes[position + 1], &index->nodes[position],
+            (index->count - position) * sizeof(index->nodes[0]));
+    index->nodes[position] = kv;
+    index->count++;
+
+    return true;
+}
+
+void map_index_remove(map_t* map, size_t bucket, const map_kv_t* kv) {
+    const map_key_t key = map_key_of(map, kv->key->bytes, kv->key->size);
+    map_index_t* index  = map->indexes[bucket];
+    uint64_t probes     = 0;
+    size_t position     = map_index_lower(index, kv->hash, &key, &probes);
+
+    memmove(&index->nodes[position], &index->nodes[position + 1],
+            (index->count - position - 1) * sizeof(index->nodes[0]));
+    index->count--;
+
+    // The chain stays sorted, which costs nothing once it is walked linearly again
+    if (index->count < MAP_UNTREEIFY_LIMIT) {
+        map_index_drop(map, bucket);
+    }
+}
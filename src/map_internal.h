@@ -0,0 +1,844 @@
+/**
+ * @file map_internal.h
+ * @brief Map internals shared between the library's translation units
+ */
+
+#ifndef MAP_INTERNAL_H
+#define MAP_INTERNAL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "map.h"
+
+typedef struct string {
+    size_t size;
+    char bytes[];
+} string_t;
+
+typedef struct map_kv {
+    struct map_kv* next;
+    uint32_t hash;
+    bool key_inline;
+    bool in_slab;
+    string_t* key;
+    uint8_t value[];
+} map_kv_t;
+
+/**
+ * Number of buckets the resize worker moves per lock hold, bounding how long a
+ * foreground operation can wait behind it.
+ */
+#define MAP_RESIZE_BATCH (64)
+
+/**
+ * Number of publication slots of a combining map. Writers that find every slot
+ * taken fall back to locking the map themselves.
+ */
+#define MAP_COMBINE_SLOTS (64)
+
+enum {
+    MAP_OP_FREE,
+    MAP_OP_CLAIMED,
+    MAP_OP_PENDING,
+    MAP_OP_DONE,
+};
+
+enum {
+    MAP_OP_PUT,
+    MAP_OP_REMOVE,
+};
+
+/**
+ * A key being looked up: `len` contiguous bytes, or when `parts` is set the
+ * concatenation of `count` parts, which is never materialized. `fold` makes
+ * hashing and comparison ignore ASCII case. A non-zero `width` marks the
+ * contiguous key of a fixed-width map, compared as raw bytes.
+ */
+typedef struct map_key {
+    const char* bytes;
+    const struct iovec* parts;
+    size_t count;
+    size_t len;
+    bool fold;
+    uint8_t width;
+} map_key_t;
+
+/**
+ * A mutation published by a writer for the combiner to apply; the combiner
+ * stores the outcome in `result` before marking the slot done.
+ */
+typedef struct map_op {
+    _Alignas(64) atomic_int state;
+    int kind;
+    uint32_t hash;
+    map_key_t key;
+    void* data;
+    ssize_t result;
+} map_op_t;
+
+typedef struct map_sync {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t worker;
+    size_t target;
+    bool has_worker;
+    bool stop;
+    map_op_t* ops;
+} map_sync_t;
+
+/**
+ * Number of retired allocations a single-writer map accumulates before the
+ * writer tries to reclaim them.
+ */
+#define MAP_RECLAIM_BATCH (64)
+
+typedef struct map_retired {
+    void* ptr;
+    uint64_t tag;
+} map_retired_t;
+
+/**
+ * Number of entries a small map holds inline before it switches to a hashed
+ * table. One SSE2 register covers the length and first-byte arrays.
+ */
+#define MAP_SMALL_SLOTS (16)
+
+/**
+ * Inline representation of a map with few entries: no table and no hashing,
+ * lookups filter the slots by key length and tag and compare the survivors.
+ * An empty slot has length zero, which no key has.
+ */
+typedef struct map_small {
+    uint8_t lens[MAP_SMALL_SLOTS];
+    uint8_t tags[MAP_SMALL_SLOTS];
+    map_kv_t* nodes[MAP_SMALL_SLOTS];
+} map_small_t;
+
+/**
+ * Filter byte of a small map slot: the first byte of the key folded with the
+ * last, so keys sharing a prefix ("user:1", "user:2") still tell apart. Bit 5
+ * is dropped from both, which keeps keys that only differ in case on the same
+ * tag for case-insensitive maps.
+ */
+static inline uint8_t map_small_tag(const char* key, size_t len) {
+    return ((uint8_t)key[0] | 0x20) ^ ((uint8_t)key[len - 1] | 0x20);
+}
+
+/**
+ * Lowercases the ASCII letters among the bytes of `word`, all lanes at once:
+ * adding to the low seven bits of each byte sets its top bit exactly when the
+ * byte is at least 'A', or above 'Z', and no lane carries into the next.
+ */
+static inline uint32_t map_fold32(uint32_t word) {
+    uint32_t low   = word & 0x7f7f7f7fu;
+    uint32_t upper = ((low + 0x3f3f3f3fu) ^ (low + 0x25252525u)) & ~word & 0x80808080u;
+
+    return word | (upper >> 2);
+}
+
+static inline uint64_t map_fold64(uint64_t word) {
+    uint64_t low   = word & 0x7f7f7f7f7f7f7f7fULL;
+    uint64_t upper = ((low + 0x3f3f3f3f3f3f3f3fULL) ^ (low + 0x2525252525252525ULL)) & ~word & 0x8080808080808080ULL;
+
+    return word | (upper >> 2);
+}
+
+static inline uint8_t map_fold8(uint8_t byte) {
+    return (unsigned)(byte - 'A') < 26u ? (uint8_t)(byte | 0x20) : byte;
+}
+
+/**
+ * Longest chain an insert may walk before the map stops trusting its hash and
+ * switches to a keyed one. Far beyond what a uniform hash produces at any load
+ * factor the map allows, so only crafted keys get there.
+ */
+#define MAP_CHAIN_LIMIT (16)
+
+/**
+ * Chain length past which an insert gives its bucket a sorted index, and below
+ * which a removal takes it away again. The gap keeps a bucket near the limit
+ * from building and dropping its index on alternate operations.
+ */
+#define MAP_TREEIFY_LIMIT (8)
+#define MAP_UNTREEIFY_LIMIT (6)
+
+/**
+ * Sorted index of one long bucket: its entries ordered by hash, length and
+ * key, searched by bisection. Only the writer uses it; the chain itself is
+ * kept in the same order so lock-free readers and every chain walker still
+ * see an ordinary chain.
+ */
+typedef struct map_index {
+    size_t count;
+    size_t capacity;
+    map_kv_t* nodes[];
+} map_index_t;
+
+/**
+ * A map of 64-bit keys switches to direct addressing when the keys it holds
+ * span at most MAP_DENSE_ENTER slots per entry, and widens its array for a new
+ * key while the span stays within MAP_DENSE_WIDEN slots per entry; a wider
+ * span sends it back to hashing. Removals only do so below one entry per
+ * MAP_DENSE_SPARSE slots, far enough from the other two that a map near either
+ * threshold does not switch back and forth.
+ */
+#define MAP_DENSE_ENTER (2)
+#define MAP_DENSE_WIDEN (4)
+#define MAP_DENSE_SPARSE (16)
+
+/**
+ * Bytes of the occupancy bitmap of a direct-addressed array of `capacity`
+ * slots.
+ */
+static inline size_t map_occupied_bytes(size_t capacity) {
+    return (capacity + 63) / 64 * sizeof(uint64_t);
+}
+
+/**
+ * Secret key of the keyed hash, drawn per map.
+ */
+typedef struct map_hash_key {
+    uint64_t k0;
+    uint64_t k1;
+} map_hash_key_t;
+
+/**
+ * Operation counters of an adaptive map, updated with the lock held.
+ */
+typedef struct map_counters {
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t puts;
+    uint64_t removes;
+    uint64_t probes;
+} map_counters_t;
+
+/**
+ * Slabs of a map that has been compacted, and the progress of its current
+ * pass; defined in map_slab.c.
+ */
+typedef struct map_slabs map_slabs_t;
+
+typedef struct map {
+    map_kv_t** elements;
+    size_t capacity;
+    size_t count;
+    size_t size;
+    uint32_t flags;
+    map_sync_t* sync;
+    map_kv_t** old_elements;
+    size_t old_capacity;
+    size_t migrate_index;
+    _Atomic uint64_t seq;
+    map_retired_t* retired;
+    size_t retired_count;
+    size_t retired_capacity;
+    map_hooks_t hooks;
+    map_changes_t* changes;
+    uint64_t change_seq;
+    map_small_t small;
+    map_counters_t counters;
+    map_counters_t adapt_base;
+    uint64_t resizes;
+    uint64_t adaptations;
+    uint32_t grow_load;
+    uint32_t shrink_load;
+    size_t small_limit;
+    map_profile_t profile;
+    map_hash_key_t hash_key;
+    bool keyed;
+    size_t rekey_credit;
+    uint64_t rekeys;
+    map_index_t** indexes;
+    size_t indexed;
+    size_t key_width;
+    bool dense;
+    uint64_t dense_base;
+    size_t dense_floor;
+    uint64_t* occupied;
+    uint8_t* slots;
+    size_t slot_size;
+    size_t max_entries;
+    bool embedded;
+    map_family_t* family;
+    map_slabs_t* slabs;
+    uint64_t handle_gen;
+} map_t;
+
+/**
+ * murmur_hash2, of the lowercased key if `fold` is set. Folding happens a word
+ * at a time inside the block loop, so it costs no extra pass over the key.
+ */
+static inline uint32_t map_murmur(const char* str, size_t len, bool fold) {
+    uint32_t h          = 0;
+    const uint32_t m    = 0x5bd1e995;
+    const uint32_t r    = 24;
+    const uint8_t* ustr = (const uint8_t*)str;
+
+    while (len >= 4) {
+        uint32_t k = ((uint32_t)ustr[0]) | ((uint32_t)ustr[1] << 8) | ((uint32_t)ustr[2] << 16) |
+                     ((uint32_t)ustr[3] << 24);
+
+        if (fold) {
+            k = map_fold32(k);
+        }
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h *= m;
+        h ^= k;
+
+        ustr += 4;
+        len -= 4;
+    }
+
+    uint32_t tail = 0;
+    switch (len) {
+        case 3:
+            tail ^= (uint32_t)ustr[2] << 16;
+            [[fallthrough]];
+        case 2:
+            tail ^= (uint32_t)ustr[1] << 8;
+            [[fallthrough]];
+        case 1:
+            tail ^= (uint32_t)ustr[0];
+            h ^= fold ? map_fold32(tail) : tail;
+            h *= m;
+            break;
+        default:
+            break;
+    }
+
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+
+    return h;
+}
+
+static inline uint32_t murmur_hash2(const char* str, size_t len) {
+    return map_murmur(str, len, false);
+}
+
+/**
+ * Keyed 32-bit hash of `str` (SipHash-1-3 folded to 32 bits).
+ */
+uint32_t map_siphash(const map_hash_key_t* key, const char* str, size_t len, bool fold);
+
+/**
+ * Draws a fresh random key.
+ */
+void map_hash_key_init(map_hash_key_t* key);
+
+/**
+ * memcmp(key, stored, len) with ASCII letters compared as lowercase, sixteen
+ * bytes at a time where SSE2 is available. Keys are binary, so a NUL byte is
+ * compared like any other.
+ */
+int map_fold_compare(const char* key, const char* stored, size_t len);
+
+/**
+ * memcmp(key, stored, len), or map_fold_compare for a folding key, over the
+ * concatenated parts of `key`.
+ */
+int map_keyv_compare(const map_key_t* key, const char* stored);
+
+/**
+ * murmur_hash2 of the concatenated parts of `key`, computed incrementally.
+ */
+uint32_t map_murmurv(const map_key_t* key);
+
+/**
+ * map_siphash of the concatenated parts of `key`, computed incrementally.
+ */
+uint32_t map_siphashv(const map_hash_key_t* hash_key, const map_key_t* key);
+
+/**
+ * Small map tag of the concatenated parts of `key`.
+ */
+uint8_t map_keyv_tag(const map_key_t* key);
+
+static inline uint64_t map_load_u64(const char* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/**
+ * Hash of a fixed-width key: its 64-bit words xored together, then spread
+ * over the high half by a multiply. The bytes are expected to be random, the
+ * multiply only keeps sequential or low-entropy words from lining up.
+ */
+static inline uint32_t map_fixed_hash(const char* key, size_t width) {
+    uint64_t folded = 0;
+    for (size_t i = 0; i < width; i += 8) {
+        folded ^= map_load_u64(key + i);
+    }
+
+    return (uint32_t)((folded * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+/**
+ * Equality of two fixed-width keys, one vector compare per 16 (or 32) bytes,
+ * or a plain load of a 64-bit key.
+ */
+static inline bool map_fixed_equal(const char* a, const char* b, size_t width) {
+    if (width == 8) {
+        return map_load_u64(a) == map_load_u64(b);
+    }
+
+#if defined(__AVX2__)
+    if (width == 32) {
+        const __m256i left  = _mm256_loadu_si256((const __m256i*)a);
+        const __m256i right = _mm256_loadu_si256((const __m256i*)b);
+        return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(left, right)) == UINT32_MAX;
+    }
+#endif
+#if defined(__SSE2__)
+    for (size_t i = 0; i < width; i += 16) {
+        const __m128i left  = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i right = _mm_loadu_si128((const __m128i*)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(left, right)) != 0xffff) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return memcmp(a, b, width) == 0;
+#endif
+}
+
+static inline int map_key_compare(const map_key_t* key, const char* stored) {
+    if (key->width != 0) {
+        return memcmp(key->bytes, stored, key->width);
+    }
+
+    if (key->parts != NULL) {
+        return map_keyv_compare(key, stored);
+    }
+
+    return key->fold ? map_fold_compare(key->bytes, stored, key->len) : memcmp(key->bytes, stored, key->len);
+}
+
+/**
+ * map_key_compare(key, stored) == 0 for a stored key of the same length.
+ */
+static inline bool map_key_equal(const map_key_t* key, const char* stored) {
+    return key->width != 0 ? map_fixed_equal(key->bytes, stored, key->width) : map_key_compare(key, stored) == 0;
+}
+
+static inline uint32_t map_key_unkeyed_hash(const map_key_t* key) {
+    if (key->width != 0) {
+        return map_fixed_hash(key->bytes, key->width);
+    }
+
+    return key->parts == NULL ? map_murmur(key->bytes, key->len, key->fold) : map_murmurv(key);
+}
+
+static inline uint32_t map_key_siphash(const map_hash_key_t* hash_key, const map_key_t* key) {
+    return key->parts == NULL ? map_siphash(hash_key, key->bytes, key->len, key->fold) : map_siphashv(hash_key, key);
+}
+
+static inline uint8_t map_key_tag(const map_key_t* key) {
+    return key->parts == NULL ? map_small_tag(key->bytes, key->len) : map_keyv_tag(key);
+}
+
+static inline bool map_folds(const map_t* map) {
+    return (map->flags & MAP_FLAG_CASE_INSENSITIVE) != 0;
+}
+
+/**
+ * View of a contiguous key, compared the way `map` compares keys. Keys of a
+ * fixed-width map have already been checked to be `key_width` long.
+ */
+static inline map_key_t map_key_of(const map_t* map, const char* bytes, size_t len) {
+    return (map_key_t){.bytes = bytes, .len = len, .fold = map_folds(map), .width = (uint8_t)map->key_width};
+}
+
+/**
+ * Hash of `key` as `map` sees it before any switch to the keyed hash, the one
+ * callers hand to map_find: murmur_hash2, or the folded bytes of a fixed-width
+ * key.
+ */
+static inline uint32_t map_unkeyed_hash(const map_t* map, const char* key, size_t len) {
+    if (map->key_width != 0 && len == map->key_width) {
+        return map_fixed_hash(key, len);
+    }
+
+    return map_murmur(key, len, map_folds(map));
+}
+
+/**
+ * Slot of a 64-bit key in the array of a direct-addressed map; keys below the
+ * range wrap around to offsets past its end.
+ */
+static inline uint64_t map_dense_offset(const map_t* map, const char* key) {
+    return map_load_u64(key) - map->dense_base;
+}
+
+/**
+ * Hash entries of `map` are stored under: the unkeyed hash until chains get
+ * suspiciously long, the map's keyed hash after that. Entries of a
+ * direct-addressed map store their slot instead.
+ */
+static inline uint32_t map_hash(const map_t* map, const char* key, size_t len) {
+    if (map->dense) {
+        return (uint32_t)map_dense_offset(map, key);
+    }
+
+    return map->keyed ? map_siphash(&map->hash_key, key, len, map_folds(map)) : map_unkeyed_hash(map, key, len);
+}
+
+/**
+ * Turns an unkeyed hash computed outside the lock into the hash `map` stores
+ * entries under. A keyed map hashes the key again with its own key, so callers
+ * never race with the switch. Lock held.
+ */
+static inline uint32_t map_table_hash(const map_t* map, uint32_t hash, const map_key_t* key) {
+    if (map->dense) {
+        return (uint32_t)map_dense_offset(map, key->bytes);
+    }
+
+    return map->keyed ? map_key_siphash(&map->hash_key, key) : hash;
+}
+
+/**
+ * True while `map` uses the inline representation. `elements` then points at
+ * the slot array, each slot being a chain of at most one entry, so code that
+ * walks buckets works on both representations.
+ */
+static inline bool map_is_small(const map_t* map) {
+    return map->elements == map->small.nodes;
+}
+
+/**
+ * True for a map built by map_init_static: open addressing in the caller's
+ * buffer, and no table or nodes at all.
+ */
+static inline bool map_is_static(const map_t* map) {
+    return map->slots != NULL;
+}
+
+/**
+ * True if other threads may access `map`. Shared maps always use a table.
+ */
+static inline bool map_is_shared(const map_t* map) {
+    return map->sync != NULL || (map->flags & MAP_FLAG_SINGLE_WRITER) != 0;
+}
+
+/**
+ * Unkeyed hash of `key` to hand to map_find. Small, direct-addressed and keyed
+ * maps never look at it, so unshared ones skip it; shared maps always hash
+ * since they may switch while the caller waits for the lock.
+ */
+static inline uint32_t map_key_hash(const map_t* map, const map_key_t* key) {
+    if (!map_is_shared(map) && (map_is_small(map) || map->dense || map->keyed)) {
+        return 0;
+    }
+
+    return map_key_unkeyed_hash(key);
+}
+
+/**
+ * Unkeyed hash of an entry of `map` as `other` hashes keys, for probing
+ * `other`. Entries of small and keyed maps do not carry one, and the one an
+ * entry carries is of no use to a map that hashes keys differently.
+ */
+static inline uint32_t map_kv_hash(const map_t* map, const map_t* other, const map_kv_t* kv) {
+    if (map_is_small(map) || map->dense || map->keyed || map_folds(map) != map_folds(other) ||
+        map->key_width != other->key_width) {
+        return map_unkeyed_hash(other, kv->key->bytes, kv->key->size);
+    }
+
+    return kv->hash;
+}
+
+static inline void map_lock(const map_t* map) {
+    if (map->sync != NULL) {
+        pthread_mutex_lock(&map->sync->lock);
+    }
+}
+
+static inline void map_unlock(const map_t* map) {
+    if (map->sync != NULL) {
+        pthread_mutex_unlock(&map->sync->lock);
+    }
+}
+
+/**
+ * Picks a profile for an adaptive map from the operations counted since the
+ * last decision and applies its tuning. Lock held.
+ */
+void map_adapt(map_t* map);
+
+/**
+ * Counts one operation of an adaptive map and takes a decision once a full
+ * window has been seen. Lock held.
+ */
+static inline void map_adapt_tick(map_t* map) {
+    const map_counters_t* now  = &map->counters;
+    const map_counters_t* base = &map->adapt_base;
+
+    if (now->gets + now->puts + now->removes - base->gets - base->puts - base->removes >= MAP_ADAPT_WINDOW) {
+        map_adapt(map);
+    }
+}
+
+/**
+ * Sets the tuning every map starts out with.
+ */
+void map_adapt_init(map_t* map);
+
+/**
+ * map_get with the key's hash already computed by the caller.
+ */
+ssize_t map_get_hashed(map_t* map, uint32_t hash, const char* key, size_t size, void* out);
+
+/**
+ * Takes the map lock and opens a write section on the sequence counter.
+ */
+void map_write_begin(map_t* map);
+
+/**
+ * Closes the write section opened by map_write_begin and drops the lock.
+ */
+void map_write_end(map_t* map);
+
+/**
+ * Returns the link pointing at the entry for `key`, or NULL. `hash` is the
+ * key's murmur_hash2. Lock held.
+ */
+map_kv_t** map_find(map_t* map, uint32_t hash, const char* key, size_t len);
+
+/**
+ * Allocates an unlinked entry; `element` may be NULL to leave the value unset.
+ */
+map_kv_t* map_kv_create(const map_t* map, uint32_t hash, const char* key, size_t size, const void* element);
+
+/**
+ * Frees an entry that has been unlinked from the map, deferring the free on
+ * single-writer maps until no reader can observe it.
+ */
+void map_kv_release(map_t* map, map_kv_t* kv);
+
+/**
+ * Frees an entry that was never linked, so no reader can have seen it.
+ */
+void map_kv_discard(const map_t* map, map_kv_t* kv);
+
+/**
+ * Offset of the key stored behind the value of an entry.
+ */
+static inline size_t map_kv_key_offset(const map_t* map) {
+    return (sizeof(map_kv_t) + map->size + _Alignof(string_t) - 1) & ~(_Alignof(string_t) - 1);
+}
+
+/**
+ * Frees an entry that map_compact moved into a slab, unmapping the slab once
+ * it holds no entries.
+ */
+void map_slab_release(const map_t* map, map_kv_t* kv);
+
+/**
+ * Unmaps every slab of a map whose entries have all been freed.
+ */
+void map_slabs_free(map_t* map);
+
+/**
+ * Number of slabs a map has mapped.
+ */
+size_t map_slab_count(const map_t* map);
+
+/**
+ * Allocates `bytes` from the map's family, or a zeroed block of them. Only
+ * blocks of a map that belongs to a family come from its pools; a family map
+ * frees with the size it allocated.
+ */
+void* map_family_alloc(map_family_t* family, size_t bytes);
+void* map_family_zalloc(map_family_t* family, size_t bytes);
+void map_family_release(map_family_t* family, void* ptr, size_t bytes);
+
+static inline void* map_alloc(const map_t* map, size_t bytes) {
+    return map->family != NULL ? map_family_alloc(map->family, bytes) : malloc(bytes);
+}
+
+static inline void* map_zalloc(const map_t* map, size_t bytes) {
+    return map->family != NULL ? map_family_zalloc(map->family, bytes) : calloc(1, bytes);
+}
+
+static inline void map_dealloc(const map_t* map, void* ptr, size_t bytes) {
+    if (map->family != NULL) {
+        map_family_release(map->family, ptr, bytes);
+    } else {
+        free(ptr);
+    }
+}
+
+/**
+ * Sorts the chain of `bucket` and gives it an index. Lock held.
+ */
+void map_index_build(map_t* map, size_t bucket);
+
+/**
+ * Removes the index of `bucket`, leaving its chain as it is. Lock held.
+ */
+void map_index_drop(map_t* map, size_t bucket);
+
+/**
+ * Removes every index, before the table is relinked. Lock held.
+ */
+void map_index_reset(map_t* map);
+
+/**
+ * map_find for an indexed bucket; `hash` is the table hash. Lock held.
+ */
+map_kv_t** map_index_find(map_t* map, size_t bucket, uint32_t hash, const map_key_t* key, uint64_t* probes);
+
+/**
+ * Links `kv` into an indexed bucket at its sorted position. Returns false if
+ * the index could not grow and was dropped instead. Lock held.
+ */
+bool map_index_insert(map_t* map, size_t bucket, map_kv_t* kv);
+
+/**
+ * Takes `kv` out of the index of its bucket before it is unlinked. Lock held.
+ */
+void map_index_remove(map_t* map, size_t bucket, const map_kv_t* kv);
+
+/**
+ * Links an entry into the live table and counts it. Lock held.
+ */
+void map_link(map_t* map, map_kv_t* kv);
+
+/**
+ * Looks at the chain an insert just landed in, switching to the keyed hash or
+ * indexing the bucket if it is too long. A miss walks the whole chain of an
+ * unindexed bucket, so `probes`, the entries the lookup before the insert
+ * probed, is its length before the insert. Lock held.
+ */
+void map_watch_chain(map_t* map, const map_kv_t* kv, uint64_t probes);
+
+/**
+ * Moves up to `budget` buckets of the table being retired into the live one.
+ * Once every bucket has been moved the old table is released. Lock held.
+ */
+void map_migrate(map_t* map, size_t budget);
+
+/**
+ * Reports a mutation to the map's hooks and change stream. Lock held. For
+ * updates `kv` still holds the old value and `value` is the new one; otherwise
+ * `value` is the entry's value.
+ */
+void map_notify(map_t* map, map_change_kind_t kind, const map_kv_t* kv, const void* value);
+
+/**
+ * Unlinks the entry at `link`, reports and releases it. Lock held.
+ */
+void map_unlink(map_t* map, map_kv_t** link);
+
+/**
+ * Appends a record to a change stream; drops it if the ring is full.
+ */
+void map_changes_publish(map_changes_t* changes, uint64_t seq, map_change_kind_t kind, const string_t* key,
+                         const void* value, size_t size);
+
+/**
+ * Forgets the map a change stream is attached to, when the map is freed first.
+ */
+void map_changes_detach(map_changes_t* changes);
+
+/**
+ * Grows the table until `count` entries fit under the load factor. Lock held.
+ */
+ssize_t map_reserve(map_t* map, size_t count);
+
+/**
+ * Shrinks a sparse table, or lets the resize worker decide. Lock held.
+ */
+void map_rebalance(map_t* map);
+
+/**
+ * Looks `key` up on a single-writer map without the lock, copying its value
+ * to `out` unless NULL and, unless NULL, pointing `handle` at its entry.
+ */
+ssize_t map_get_optimistic(map_t* map, uint32_t hash, const map_key_t* key, void* out, map_handle_t* handle);
+
+/**
+ * Copies the bytes of `key` to `out`, joining its parts if it has any.
+ */
+static inline void map_key_gather(const map_key_t* key, char* out) {
+    if (key->parts == NULL) {
+        memcpy(out, key->bytes, key->len);
+        return;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < key->count; i++) {
+        memcpy(out + offset, key->parts[i].iov_base, key->parts[i].iov_len);
+        offset += key->parts[i].iov_len;
+    }
+}
+
+/**
+ * map_put, map_get and map_remove of a static map.
+ */
+ssize_t map_static_put(map_t* map, const map_key_t* key, const void* element);
+ssize_t map_static_get(map_t* map, const map_key_t* key, void* out);
+ssize_t map_static_remove(map_t* map, const map_key_t* key, void* out);
+
+/**
+ * First occupied slot of a static map at or after `index`, or its capacity.
+ */
+size_t map_static_next(const map_t* map, size_t index);
+
+/**
+ * Reads the entry in occupied slot `index` of a static map for an iterator.
+ */
+void map_static_entry(map_t* map, size_t index, char** key, size_t* len, void* value);
+
+/**
+ * Makes sure a direct-addressed map has a slot for the 64-bit `key` before it
+ * is linked, widening the array or going back to hashing with a table sized
+ * for `count`, the number of entries the map holds once the caller is done.
+ * Does nothing for other maps. Lock held.
+ */
+ssize_t map_dense_cover(map_t* map, const char* key, size_t count);
+
+/**
+ * Waits for the writer to leave its critical section and returns the even
+ * sequence number the read is validated against.
+ */
+static inline uint64_t map_read_begin(const map_t* map) {
+    for (;;) {
+        uint64_t seq = atomic_load_explicit(&map->seq, memory_order_acquire);
+        if ((seq & 1) == 0) {
+            return seq;
+        }
+
+        sched_yield();
+    }
+}
+
+static inline bool map_read_valid(const map_t* map, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&map->seq, memory_order_relaxed) == seq;
+}
+
+#endif /* MAP_INTERNAL_H */
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+/**
+ * Smallest bucket array of an intrusive map. The array doubles once there are
+ * more than three nodes per four buckets and halves below one per eight, so a
+ * resize never immediately calls for the opposite one.
+ */
+#define MAP_INTRUSIVE_MIN_BUCKETS (16)
+
+typedef struct map_intrusive {
+    map_node_t** buckets;
+    size_t mask;
+    size_t count;
+    map_intrusive_ops_t ops;
+} map_intrusive_t;
+
+static bool map_intrusive_equal(const map_intrusive_t* map, const map_node_t* node, const char* key, size_t len) {
+    if (map->ops.equal != NULL) {
+        return map->ops.equal(node, key, len);
+    }
+
+    size_t stored_len;
+    const char* stored = map->ops.key(node, &stored_len);
+
+    return stored_len == len && memcmp(stored, key, len) == 0;
+}
+
+/**
+ * Returns the link pointing at the node stored under `key`, or NULL. Nodes
+ * whose hash differs are skipped without calling back into the user's code.
+ */
+static map_node_t** map_intrusive_lookup(const map_intrusive_t* map, uint32_t hash, const char* key, size_t len) {
+    map_node_t** link = &map->buckets[hash & map->mask];
+
+    while (*link != NULL) {
+        if ((*link)->hash == hash && map_intrusive_equal(map, *link, key, len)) {
+            return link;
+        }
+
+        link = &(*link)->next;
+    }
+
+    return NULL;
+}
+
+/**
+ * Relinks every node into a new array of `count` buckets, a power of two.
+ * Nodes keep the hash they were linked with, so keys are not read again.
+ */
+static ssize_t map_intrusive_resize(map_intrusive_t* map, size_t count) {
+    map_node_t** buckets = calloc(count, sizeof(map_node_t*));
+    if (buckets == NULL) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i <= map->mask; i++) {
+        map_node_t* current = map->buckets[i];
+
+        while (current != NULL) {
+            map_node_t* next = current->next;
+            size_t index     = current->hash & (count - 1);
+
+            current->next  = buckets[index];
+            buckets[index] = current;
+            current        = next;
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = buckets;
+    map->mask    = count - 1;
+
+    return 0;
+}
+
+map_intrusive_t* map_intrusive_create(const map_intrusive_ops_t* ops) {
+    if (ops == NULL || ops->key == NULL) {
+        return NULL;
+    }
+
+    map_intrusive_t* map = malloc(sizeof(*map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    map->buckets = calloc(MAP_INTRUSIVE_MIN_BUCKETS, sizeof(map_node_t*));
+    if (map->buckets == NULL) {
+        free(map);
+        return NULL;
+    }
+
+    map->mask  = MAP_INTRUSIVE_MIN_BUCKETS - 1;
+    map->count = 0;
+    map->ops   = *ops;
+
+    return map;
+}
+
+ssize_t map_intrusive_insert(map_intrusive_t* map, map_node_t* node) {
+    if (map == NULL || node == NULL) {
+        return -EINVAL;
+    }
+
+    size_t len;
+    const char* key = map->ops.key(node, &len);
+    if (key == NULL || len == 0) {
+        return -EINVAL;
+    }
+
+    const uint32_t hash = murmur_hash2(key, len);
+    if (map_intrusive_lookup(map, hash, key, len) != NULL) {
+        return -EEXIST;
+    }
+
+    if ((map->count + 1) * 4 > (map->mask + 1) * 3) {
+        ssize_t result = map_intrusive_resize(map, (map->mask + 1) * 2);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    map_node_t** bucket = &map->buckets[hash & map->mask];
+    node->hash          = hash;
+    node->next          = *bucket;
+    *bucket             = node;
+    map->count++;
+
+    return 0;
+}
+
+map_node_t* map_intrusive_find(const map_intrusive_t* map, const char* key, size_t len) {
+    if (map == NULL || key == NULL || len == 0) {
+        return NULL;
+    }
+
+    map_node_t** link = map_intrusive_lookup(map, murmur_hash2(key, len), key, len);
+    return link != NULL ? *link : NULL;
+}
+
+/**
+ * Takes the node at `link` out of its chain and shrinks a sparse array. A
+ * failed shrink leaves the map as it was.
+ */
+static map_node_t* map_intrusive_detach(map_intrusive_t* map, map_node_t** link) {
+    map_node_t* node = *link;
+
+    *link      = node->next;
+    node->next = NULL;
+    map->count--;
+
+    if (map->mask + 1 > MAP_INTRUSIVE_MIN_BUCKETS && map->count * 8 < map->mask + 1) {
+        map_intrusive_resize(map, (map->mask + 1) / 2);
+    }
+
+    return node;
+}
+
+map_node_t* map_intrusive_remove(map_intrusive_t* map, const char* key, size_t len) {
+    if (map == NULL || key == NULL || len == 0) {
+        return NULL;
+    }
+
+    map_node_t** link = map_intrusive_lookup(map, murmur_hash2(key, len), key, len);
+    return link != NULL ? map_intrusive_detach(map, link) : NULL;
+}
+
+ssize_t map_intrusive_unlink(map_intrusive_t* map, map_node_t* node) {
+    if (map == NULL || node == NULL) {
+        return -EINVAL;
+    }
+
+    // The node remembers its hash, which leads straight to its bucket
+    for (map_node_t** link = &map->buckets[node->hash & map->mask]; *link != NULL; link = &(*link)->next) {
+        if (*link == node) {
+            map_intrusive_detach(map, link);
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+size_t map_intrusive_count(const map_intrusive_t* map) {
+    return map->count;
+}
+
+ssize_t map_intrusive_foreach(map_intrusive_t* map, map_intrusive_fn fn, void* ctx) {
+    if (map == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i <= map->mask; i++) {
+        map_node_t* current = map->buckets[i];
+
+        // Read the link first, fn may free the object around the node
+        while (current != NULL) {
+            map_node_t* next = current->next;
+            fn(ctx, current);
+            current = next;
+        }
+    }
+
+    return 0;
+}
+
+ssize_t map_intrusive_free(map_intrusive_t* map) {
+    if (map == NULL) {
+        return -EINVAL;
+    }
+
+    free(map->buckets);
+    free(map);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "map_internal.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline __m128i map_fold16(__m128i bytes) {
+    // Bytes above 0x7f compare as negative and are never letters
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                        _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+
+    return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+int map_fold_compare(const char* key, const char* stored, size_t len) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        const __m128i left  = _mm_loadu_si128((const __m128i*)(key + i));
+        const __m128i right = _mm_loadu_si128((const __m128i*)(stored + i));
+
+        // Leave the first differing chunk to the byte loop, which orders it
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(map_fold16(left), map_fold16(right))) != 0xffff) {
+            break;
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        const uint8_t left  = map_fold8((uint8_t)key[i]);
+        const uint8_t right = map_fold8((uint8_t)stored[i]);
+
+        if (left != right) {
+            return left - right;
+        }
+    }
+
+    return 0;
+}
+
+int map_keyv_compare(const map_key_t* key, const char* stored) {
+    size_t offset = 0;
+
+    for (size_t i = 0; i < key->count; i++) {
+        const char* part = key->parts[i].iov_base;
+        size_t len       = key->parts[i].iov_len;
+        int result       = memcmp(part, stored + offset, len);
+
+        // Equal bytes are equal under either comparison
+        if (result != 0 && key->fold) {
+            result = map_fold_compare(part, stored + offset, len);
+        }
+
+        if (result != 0) {
+            return result;
+        }
+
+        offset += len;
+    }
+
+    return 0;
+}
+
+uint8_t map_keyv_tag(const map_key_t* key) {
+    uint8_t first = 0;
+    uint8_t last  = 0;
+
+    for (size_t i = 0; i < key->count; i++) {
+        if (key->parts[i].iov_len > 0) {
+            first = *(const uint8_t*)key->parts[i].iov_base;
+            break;
+        }
+    }
+
+    for (size_t i = key->count; i > 0; i--) {
+        if (key->parts[i - 1].iov_len > 0) {
+            last = ((const uint8_t*)key->parts[i - 1].iov_base)[key->parts[i - 1].iov_len - 1];
+            break;
+        }
+    }
+
+    return (first | 0x20) ^ (last | 0x20);
+}
+
+static inline uint32_t map_murmur_block(uint32_t h, uint32_t k) {
+    const uint32_t m = 0x5bd1e995;
+
+    k *= m;
+    k ^= k >> 24;
+    k *= m;
+
+    h *= m;
+    h ^= k;
+
+    return h;
+}
+
+/**
+ * Same blocks, tail and finalization as murmur_hash2. Bytes of a block that
+ * straddles two parts collect in `carry` until it is complete.
+ */
+uint32_t map_murmurv(const map_key_t* key) {
+    const uint32_t m = 0x5bd1e995;
+    const bool fold  = key->fold;
+    uint32_t h       = 0;
+    uint32_t carry   = 0;
+    unsigned carried = 0;
+
+    for (size_t i = 0; i < key->count; i++) {
+        const uint8_t* bytes = key->parts[i].iov_base;
+        size_t len           = key->parts[i].iov_len;
+
+        while (carried != 0 && len > 0) {
+            carry |= (uint32_t)*bytes++ << (8 * carried);
+            len--;
+
+            if (++carried == 4) {
+                h       = map_murmur_block(h, fold ? map_fold32(carry) : carry);
+                carry   = 0;
+                carried = 0;
+            }
+        }
+
+        while (len >= 4) {
+            uint32_t k = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) |
+                         ((uint32_t)bytes[3] << 24);
+
+            h = map_murmur_block(h, fold ? map_fold32(k) : k);
+            bytes += 4;
+            len -= 4;
+        }
+
+        while (len > 0) {
+            carry |= (uint32_t)*bytes++ << (8 * carried++);
+            len--;
+        }
+    }
+
+    // The tail bytes sit in `carry` exactly as murmur_hash2 xors them in
+    if (carried != 0) {
+        h ^= fold ? map_fold32(carry) : carry;
+        h *= m;
+    }
+
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+
+    return h;
+}
@@ -0,0 +1,128 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MAP_PREFETCH(address) __builtin_prefetch((address), 0, 3)
+#else
+#define MAP_PREFETCH(address) ((void)(address))
+#endif
+
+enum {
+    MAP_LOOKUP_BUCKET,
+    MAP_LOOKUP_NODE,
+    MAP_LOOKUP_KEY,
+    MAP_LOOKUP_DONE,
+};
+
+static bool map_lookup_finish(map_lookup_t* lookup, ssize_t result) {
+    lookup->result = result;
+    lookup->state  = MAP_LOOKUP_DONE;
+    return true;
+}
+
+/**
+ * Moves to the next entry of the chain, prefetching it for the next step.
+ */
+static bool map_lookup_advance(map_lookup_t* lookup, const map_kv_t* next) {
+    if (next == NULL) {
+        return map_lookup_finish(lookup, -ENOENT);
+    }
+
+    MAP_PREFETCH(next);
+    lookup->node  = next;
+    lookup->state = MAP_LOOKUP_NODE;
+    return false;
+}
+
+void map_lookup_start(map_lookup_t* lookup, map_t* map, const char* key, size_t len, void* out) {
+    *lookup = (map_lookup_t){.map = map, .key = key, .len = len, .out = out};
+
+    if (map == NULL || key == NULL || len == 0 || out == NULL || (map->key_width != 0 && len != map->key_width)) {
+        map_lookup_finish(lookup, -EINVAL);
+        return;
+    }
+
+    // Shared maps only allow lookups that start and end inside one lock or
+    // one seqlock read section, so there is nothing to interleave; small maps
+    // fit in a few cache lines, direct-addressed ones need a single load and
+    // static ones have no chains to step through, so all three are searched
+    // right away
+    if (map->sync != NULL || (map->flags & MAP_FLAG_SINGLE_WRITER) || map_is_small(map) || map->dense ||
+        map_is_static(map)) {
+        map_lookup_finish(lookup, map_get(map, key, len, out));
+        return;
+    }
+
+    lookup->hash  = map_hash(map, key, len);
+    lookup->state = MAP_LOOKUP_BUCKET;
+    MAP_PREFETCH(&map->elements[lookup->hash % (uint32_t)map->capacity]);
+}
+
+bool map_lookup_step(map_lookup_t* lookup) {
+    const map_t* map     = lookup->map;
+    const map_kv_t* node = lookup->node;
+
+    switch (lookup->state) {
+        case MAP_LOOKUP_BUCKET:
+            return map_lookup_advance(lookup, map->elements[lookup->hash % (uint32_t)map->capacity]);
+
+        case MAP_LOOKUP_NODE:
+            if (node->hash != lookup->hash) {
+                return map_lookup_advance(lookup, node->next);
+            }
+
+            // The key lives in its own allocation: fetch it before comparing
+            MAP_PREFETCH(node->key);
+            lookup->state = MAP_LOOKUP_KEY;
+            return false;
+
+        case MAP_LOOKUP_KEY: {
+            const map_key_t key = map_key_of(map, lookup->key, lookup->len);
+            if (node->key->size != lookup->len || !map_key_equal(&key, node->key->bytes)) {
+                return map_lookup_advance(lookup, node->next);
+            }
+
+            memcpy(lookup->out, node->value, map->size);
+            return map_lookup_finish(lookup, 0);
+        }
+
+        default:
+            return true;
+    }
+}
+
+ssize_t map_lookup_result(const map_lookup_t* lookup) {
+    if (lookup == NULL) {
+        return -EINVAL;
+    }
+
+    return lookup->state == MAP_LOOKUP_DONE ? lookup->result : -EAGAIN;
+}
+
+size_t map_lookup_run(map_lookup_t* lookups, size_t count) {
+    bool pending = true;
+
+    // Each pass advances every unfinished lookup once, so by the time a
+    // lookup comes round again the memory it prefetched has usually arrived
+    while (pending) {
+        pending = false;
+        for (size_t i = 0; i < count; i++) {
+            if (lookups[i].state != MAP_LOOKUP_DONE && !map_lookup_step(&lookups[i])) {
+                pending = true;
+            }
+        }
+    }
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        found += lookups[i].result == 0;
+    }
+
+    return found;
+}
@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "map.h"
+
+/**
+ * Capacity of each worker's deque. A worker whose deque is full runs the task
+ * it was about to push inline instead.
+ */
+#define MAP_POOL_DEQUE_SIZE (1024)
+
+/**
+ * Number of tasks a parallel loop is split into per thread, so idle threads
+ * have something left to steal when the work is uneven.
+ */
+#define MAP_POOL_SPLIT (4)
+
+typedef struct map_pool_group {
+    map_pool_fn fn;
+    void* arg;
+    atomic_size_t remaining;
+} map_pool_group_t;
+
+typedef struct map_pool_task {
+    map_pool_group_t* group;
+    size_t begin;
+    size_t end;
+} map_pool_task_t;
+
+/**
+ * Chase-Lev work-stealing deque: the owner pushes and takes at the bottom,
+ * thieves steal from the top.
+ */
+typedef struct map_pool_deque {
+    _Alignas(64) atomic_int_fast64_t top;
+    _Alignas(64) atomic_int_fast64_t bottom;
+    _Atomic(map_pool_task_t*) tasks[MAP_POOL_DEQUE_SIZE];
+} map_pool_deque_t;
+
+typedef struct map_pool_worker {
+    map_pool_deque_t deque;
+    struct map_pool* pool;
+    pthread_t thread;
+    uint64_t seed;
+} map_pool_worker_t;
+
+typedef struct map_pool {
+    map_pool_worker_t* workers;
+    size_t threads;
+    map_executor_t executor;
+    bool external;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    map_pool_task_t** injected;
+    size_t injected_count;
+    size_t injected_capacity;
+    atomic_size_t pending;
+    atomic_bool stop;
+} map_pool_t;
+
+static _Thread_local map_pool_worker_t* current_worker;
+
+static bool map_pool_deque_push(map_pool_deque_t* deque, map_pool_task_t* task) {
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (b - t >= MAP_POOL_DEQUE_SIZE) {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->tasks[b % MAP_POOL_DEQUE_SIZE], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+static map_pool_task_t* map_pool_deque_take(map_pool_deque_t* deque) {
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    map_pool_task_t* task = atomic_load_explicit(&deque->tasks[b % MAP_POOL_DEQUE_SIZE], memory_order_relaxed);
+
+    // Last task left: race the thieves for it
+    if (t == b) {
+        if (!atomic_compare_exchange_strong_explicit(
+                &deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+static map_pool_task_t* map_pool_deque_steal(map_pool_deque_t* deque) {
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return NULL;
+    }
+
+    map_pool_task_t* task = atomic_load_explicit(&deque->tasks[t % MAP_POOL_DEQUE_SIZE], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(
+            &deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return task;
+}
+
+static void map_pool_task_run(map_pool_task_t* task) {
+    map_pool_group_t* group = task->group;
+
+    for (size_t i = task->begin; i < task->end; i++) {
+        group->fn(group->arg, i);
+    }
+
+    atomic_fetch_sub_explicit(&group->remaining, 1, memory_order_release);
+}
+
+static void map_pool_task_run_external(void* arg) {
+    map_pool_task_run(arg);
+}
+
+static map_pool_task_t* map_pool_find_task(map_pool_t* pool, map_pool_worker_t* self, uint64_t* seed) {
+    if (self != NULL) {
+        map_pool_task_t* task = map_pool_deque_take(&self->deque);
+        if (task != NULL) {
+            return task;
+        }
+    }
+
+    // Pick a random victim to spread thieves over the workers
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+
+    for (size_t i = 0; i < pool->threads; i++) {
+        map_pool_worker_t* victim = &pool->workers[(*seed + i) % pool->threads];
+        if (victim == self) {
+            continue;
+        }
+
+        map_pool_task_t* task = map_pool_deque_steal(&victim->deque);
+        if (task != NULL) {
+            return task;
+        }
+    }
+
+    map_pool_task_t* task = NULL;
+    if (atomic_load_explicit(&pool->pending, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->injected_count > 0) {
+            task = pool->injected[--pool->injected_count];
+            atomic_fetch_sub(&pool->pending, 1);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return task;
+}
+
+static void* map_pool_worker_main(void* arg) {
+    map_pool_worker_t* self = arg;
+    map_pool_t* pool        = self->pool;
+    current_worker          = self;
+
+    while (!atomic_load(&pool->stop)) {
+        map_pool_task_t* task = map_pool_find_task(pool, self, &self->seed);
+        if (task != NULL) {
+            map_pool_task_run(task);
+            continue;
+        }
+
+        // Nothing to steal: sleep until work is injected
+        pthread_mutex_lock(&pool->lock);
+        while (pool->injected_count == 0 && !atomic_load(&pool->stop)) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+static bool map_pool_inject(map_pool_t* pool, map_pool_task_t** tasks, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->injected_count + count > pool->injected_capacity) {
+        size_t capacity = pool->injected_capacity ? pool->injected_capacity : 64;
+        while (capacity < pool->injected_count + count) {
+            capacity *= 2;
+        }
+
+        map_pool_task_t** injected = realloc(pool->injected, capacity * sizeof(*injected));
+        if (injected == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return false;
+        }
+
+        pool->injected          = injected;
+        pool->injected_capacity = capacity;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pool->injected[pool->injected_count++] = tasks[i];
+    }
+
+    atomic_fetch_add(&pool->pending, count);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+ssize_t map_pool_parallel_for(map_pool_t* pool, size_t count, map_pool_fn fn, void* arg) {
+    if (pool == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t ntasks = pool->threads * MAP_POOL_SPLIT;
+    if (ntasks > count) {
+        ntasks = count;
+    }
+
+    map_pool_task_t* tasks = malloc(ntasks * (sizeof(*tasks) + sizeof(map_pool_task_t*)));
+    if (tasks == NULL) {
+        return -ENOMEM;
+    }
+
+    map_pool_task_t** queue = (map_pool_task_t**)(void*)(tasks + ntasks);
+    map_pool_group_t group  = {.fn = fn, .arg = arg};
+    atomic_init(&group.remaining, ntasks);
+
+    for (size_t i = 0; i < ntasks; i++) {
+        tasks[i] = (map_pool_task_t){
+            .group = &group,
+            .begin = count * i / ntasks,
+            .end   = count * (i + 1) / ntasks,
+        };
+        queue[i] = &tasks[i];
+    }
+
+    map_pool_worker_t* self = current_worker != NULL && current_worker->pool == pool ? current_worker : NULL;
+    size_t first            = 0;
+
+    if (pool->external) {
+        // Keep the first task for the calling thread, hand the rest out
+        for (size_t i = 1; i < ntasks; i++) {
+            if (pool->executor.submit(pool->executor.ctx, map_pool_task_run_external, queue[i]) != 0) {
+                map_pool_task_run(queue[i]);
+            }
+        }
+        first = ntasks;
+        map_pool_task_run(queue[0]);
+    } else if (self != NULL) {
+        // Nested loop on a worker: push onto our own deque for others to steal
+        for (; first < ntasks; first++) {
+            if (!map_pool_deque_push(&self->deque, queue[first])) {
+                break;
+            }
+        }
+    } else if (map_pool_inject(pool, queue, ntasks)) {
+        first = ntasks;
+    }
+
+    // Whatever could not be queued runs here
+    for (size_t i = first; i < ntasks; i++) {
+        map_pool_task_run(queue[i]);
+    }
+
+    // Help out until every task of this loop has finished
+    uint64_t seed = (uint64_t)(uintptr_t)&group | 1;
+    while (atomic_load_explicit(&group.remaining, memory_order_acquire) > 0) {
+        map_pool_task_t* task = pool->external ? NULL : map_pool_find_task(pool, self, &seed);
+        if (task != NULL) {
+            map_pool_task_run(task);
+        } else {
+            sched_yield();
+        }
+    }
+
+    free(tasks);
+    return 0;
+}
+
+static map_pool_t* map_pool_alloc(size_t threads) {
+    map_pool_t* pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&pool->wake, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+
+    pool->threads = threads;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->stop, false);
+    return pool;
+}
+
+map_pool_t* map_pool_create(size_t threads) {
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads     = online > 0 ? (size_t)online : 1;
+    }
+
+    map_pool_t* pool = map_pool_alloc(threads);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->workers = aligned_alloc(_Alignof(map_pool_worker_t), threads * sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        map_pool_free(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        map_pool_worker_t* worker = &pool->workers[i];
+        atomic_init(&worker->deque.top, 0);
+        atomic_init(&worker->deque.bottom, 0);
+        worker->pool = pool;
+        worker->seed = (uint64_t)i * 0x9e3779b97f4a7c15ull + 1;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, map_pool_worker_main, &pool->workers[i]) != 0) {
+            pool->threads = i;
+            map_pool_free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+map_pool_t* map_pool_create_external(const map_executor_t* executor, size_t concurrency) {
+    if (executor == NULL || executor->submit == NULL || concurrency == 0) {
+        return NULL;
+    }
+
+    map_pool_t* pool = map_pool_alloc(concurrency);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->executor = *executor;
+    pool->external = true;
+    return pool;
+}
+
+ssize_t map_pool_free(map_pool_t* pool) {
+    if (pool == NULL) {
+        return -EINVAL;
+    }
+
+    if (pool->workers != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        atomic_store(&pool->stop, true);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (size_t i = 0; i < pool->threads; i++) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+
+        free(pool->workers);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->injected);
+    free(pool);
+    return 0;
+}
@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+enum {
+    MAP_REPL_SNAPSHOT = 1,
+    MAP_REPL_DELTA    = 2,
+};
+
+/**
+ * Every batch starts with this header. A snapshot replaces the follower's
+ * contents and `seq` is the last change it includes; a delta carries `count`
+ * consecutive changes ending at `seq`.
+ */
+typedef struct map_repl_header {
+    uint32_t type;
+    uint32_t value_size;
+    uint64_t seq;
+    uint32_t count;
+    uint32_t bytes;
+} map_repl_header_t;
+
+/**
+ * Records follow the header back to back: the change kind, the key length,
+ * the key bytes and, except for removals, the value.
+ */
+#define MAP_REPL_RECORD_HEADER (2)
+
+typedef struct map_repl {
+    map_t* map;
+    int fd;
+    bool primary;
+    bool synced;
+    bool gap;
+    uint64_t seq;
+    uint64_t dropped;
+    uint32_t count;
+    map_changes_t* changes;
+    uint8_t* buffer;
+    size_t length;
+    size_t capacity;
+    map_kv_t** nodes;
+    uint8_t* kinds;
+    size_t nodes_capacity;
+} map_repl_t;
+
+static ssize_t map_repl_reserve(map_repl_t* repl, size_t bytes) {
+    if (repl->length + bytes <= repl->capacity) {
+        return 0;
+    }
+
+    size_t capacity = repl->capacity ? repl->capacity : 4096;
+    while (capacity < repl->length + bytes) {
+        capacity *= 2;
+    }
+
+    uint8_t* buffer = realloc(repl->buffer, capacity);
+    if (buffer == NULL) {
+        return -ENOMEM;
+    }
+
+    repl->buffer   = buffer;
+    repl->capacity = capacity;
+    return 0;
+}
+
+static ssize_t map_repl_append(map_repl_t* repl, map_change_kind_t kind, const char* key, size_t len,
+                               const void* value) {
+    size_t size    = kind == MAP_CHANGE_REMOVE ? 0 : repl->map->size;
+    ssize_t result = map_repl_reserve(repl, MAP_REPL_RECORD_HEADER + len + size);
+    if (result < 0) {
+        return result;
+    }
+
+    uint8_t* out = repl->buffer + repl->length;
+    out[0]       = (uint8_t)kind;
+    out[1]       = (uint8_t)(len - 1);
+    memcpy(out + MAP_REPL_RECORD_HEADER, key, len);
+    if (size > 0) {
+        memcpy(out + MAP_REPL_RECORD_HEADER + len, value, size);
+    }
+
+    repl->length += MAP_REPL_RECORD_HEADER + len + size;
+    repl->count++;
+    return 0;
+}
+
+static void map_repl_begin(map_repl_t* repl) {
+    repl->length = sizeof(map_repl_header_t);
+    repl->count  = 0;
+}
+
+static ssize_t map_repl_send(map_repl_t* repl, uint32_t type) {
+    if (repl->length - sizeof(map_repl_header_t) > UINT32_MAX) {
+        return -EOVERFLOW;
+    }
+
+    const map_repl_header_t header = {
+        .type       = type,
+        .value_size = (uint32_t)repl->map->size,
+        .seq        = repl->seq,
+        .count      = repl->count,
+        .bytes      = (uint32_t)(repl->length - sizeof(map_repl_header_t)),
+    };
+    memcpy(repl->buffer, &header, sizeof(header));
+
+    size_t sent = 0;
+    while (sent < repl->length) {
+        ssize_t n = send(repl->fd, repl->buffer + sent, repl->length - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        sent += (size_t)n;
+    }
+
+    return (ssize_t)repl->count;
+}
+
+static ssize_t map_repl_recv(int fd, void* buffer, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        ssize_t n = recv(fd, (uint8_t*)buffer + received, length - received, 0);
+        if (n == 0) {
+            return -ECONNRESET;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        received += (size_t)n;
+    }
+
+    return 0;
+}
+
+/**
+ * Encodes the whole map under its lock, then sends it after the lock is gone
+ * so a slow follower never holds up the primary's writers.
+ */
+static ssize_t map_repl_snapshot(map_repl_t* repl) {
+    map_t* map     = repl->map;
+    ssize_t result = 0;
+
+    map_repl_begin(repl);
+    repl->dropped = map_changes_dropped(repl->changes);
+
+    map_lock(map);
+    map_migrate(map, SIZE_MAX);
+    repl->seq = map->change_seq;
+
+    for (size_t i = 0; i < map->capacity && result == 0; i++) {
+        for (const map_kv_t* current = map->elements[i]; current != NULL && result == 0; current = current->next) {
+            result = map_repl_append(repl, MAP_CHANGE_INSERT, current->key->bytes, current->key->size, current->value);
+        }
+    }
+    map_unlock(map);
+
+    if (result < 0) {
+        return result;
+    }
+
+    result       = map_repl_send(repl, MAP_REPL_SNAPSHOT);
+    repl->synced = result >= 0;
+    return result;
+}
+
+static void map_repl_skip(void* ctx, const map_change_t* change) {
+    (void)ctx;
+    (void)change;
+}
+
+static void map_repl_collect(void* ctx, const map_change_t* change) {
+    map_repl_t* repl = ctx;
+
+    // Already covered by the snapshot, or past a gap that forces a new one
+    if (change->seq <= repl->seq || repl->gap) {
+        return;
+    }
+
+    if (change->seq != repl->seq + 1 ||
+        map_repl_append(repl, change->kind, change->key, change->len, change->value) < 0) {
+        repl->gap = true;
+        return;
+    }
+
+    repl->seq = change->seq;
+}
+
+map_repl_t* map_repl_primary_create(map_t* map, int fd, size_t capacity) {
+    if (map == NULL || fd < 0 || capacity == 0 || map_is_static(map)) {
+        return NULL;
+    }
+
+    map_repl_t* repl = calloc(1, sizeof(*repl));
+    if (repl == NULL) {
+        return NULL;
+    }
+
+    repl->map     = map;
+    repl->fd      = fd;
+    repl->primary = true;
+    repl->changes = map_changes_create(map, capacity);
+
+    if (repl->changes == NULL || map_repl_reserve(repl, sizeof(map_repl_header_t)) < 0) {
+        map_repl_free(repl);
+        return NULL;
+    }
+
+    return repl;
+}
+
+map_repl_t* map_repl_follower_create(map_t* map, int fd) {
+    if (map == NULL || fd < 0 || map_is_static(map)) {
+        return NULL;
+    }
+
+    map_repl_t* repl = calloc(1, sizeof(*repl));
+    if (repl == NULL) {
+        return NULL;
+    }
+
+    repl->map = map;
+    repl->fd  = fd;
+    return repl;
+}
+
+ssize_t map_repl_flush(map_repl_t* repl) {
+    if (repl == NULL || !repl->primary) {
+        return -EINVAL;
+    }
+
+    if (!repl->synced) {
+        // Whatever the stream holds up to now is part of the snapshot
+        map_changes_drain(repl->changes, map_repl_skip, NULL, SIZE_MAX);
+        return map_repl_snapshot(repl);
+    }
+
+    map_repl_begin(repl);
+    repl->gap = false;
+    map_changes_drain(repl->changes, map_repl_collect, repl, SIZE_MAX);
+
+    // Records dropped at the tail of the ring leave no gap behind them
+    if (repl->gap || map_changes_dropped(repl->changes) != repl->dropped) {
+        repl->gap = false;
+        return map_repl_snapshot(repl);
+    }
+
+    if (repl->count == 0) {
+        return 0;
+    }
+
+    ssize_t result = map_repl_send(repl, MAP_REPL_DELTA);
+    if (result < 0) {
+        // The follower may have seen part of the batch; start over
+        repl->synced = false;
+    }
+
+    return result;
+}
+
+/**
+ * Turns the received records into unlinked entries so that applying them
+ * cannot fail halfway.
+ */
+static ssize_t map_repl_decode(map_repl_t* repl, const map_repl_header_t* header) {
+    map_t* map = repl->map;
+
+    if (header->count > repl->nodes_capacity) {
+        map_kv_t** nodes = realloc(repl->nodes, header->count * sizeof(*nodes));
+        if (nodes == NULL) {
+            return -ENOMEM;
+        }
+        repl->nodes = nodes;
+
+        uint8_t* kinds = realloc(repl->kinds, header->count);
+        if (kinds == NULL) {
+            return -ENOMEM;
+        }
+        repl->kinds          = kinds;
+        repl->nodes_capacity = header->count;
+    }
+
+    const uint8_t* in  = repl->buffer;
+    const uint8_t* end = repl->buffer + header->bytes;
+    size_t decoded     = 0;
+    ssize_t result     = 0;
+
+    while (decoded < header->count) {
+        if (end - in < MAP_REPL_RECORD_HEADER) {
+            result = -EPROTO;
+            break;
+        }
+
+        uint8_t kind = in[0];
+        size_t len   = (size_t)in[1] + 1;
+        size_t size  = kind == MAP_CHANGE_REMOVE ? 0 : map->size;
+
+        if (kind > MAP_CHANGE_REMOVE || (header->type == MAP_REPL_SNAPSHOT && kind != MAP_CHANGE_INSERT) ||
+            (size_t)(end - in) < MAP_REPL_RECORD_HEADER + len + size ||
+            (map->key_width != 0 && len != map->key_width)) {
+            result = -EPROTO;
+            break;
+        }
+
+        const char* key = (const char*)in + MAP_REPL_RECORD_HEADER;
+        map_kv_t* node  = map_kv_create(map, map_unkeyed_hash(map, key, len), key, len, size > 0 ? key + len : NULL);
+        if (node == NULL) {
+            result = -ENOMEM;
+            break;
+        }
+
+        repl->kinds[decoded]   = kind;
+        repl->nodes[decoded++] = node;
+        in += MAP_REPL_RECORD_HEADER + len + size;
+    }
+
+    if (result == 0 && in != end) {
+        result = -EPROTO;
+    }
+
+    if (result < 0) {
+        for (size_t i = 0; i < decoded; i++) {
+            map_kv_discard(map, repl->nodes[i]);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Applies a decoded batch in one write section. A snapshot first drops every
+ * entry the follower holds.
+ */
+static ssize_t map_repl_apply(map_repl_t* repl, const map_repl_header_t* header) {
+    map_t* map  = repl->map;
+    size_t puts = 0;
+
+    for (size_t i = 0; i < header->count; i++) {
+        puts += repl->kinds[i] != MAP_CHANGE_REMOVE;
+    }
+
+    map_write_begin(map);
+
+    const size_t total = header->type == MAP_REPL_SNAPSHOT ? puts : map->count + puts;
+    ssize_t result     = map_reserve(map, total);
+    for (size_t i = 0; i < header->count && result >= 0; i++) {
+        if (repl->kinds[i] != MAP_CHANGE_REMOVE) {
+            result = map_dense_cover(map, repl->nodes[i]->key->bytes, total);
+        }
+    }
+
+    if (result < 0) {
+        map_write_end(map);
+        for (size_t i = 0; i < header->count; i++) {
+            map_kv_discard(map, repl->nodes[i]);
+        }
+        return result;
+    }
+
+    if (header->type == MAP_REPL_SNAPSHOT) {
+        map_migrate(map, SIZE_MAX);
+        for (size_t i = 0; i < map->capacity; i++) {
+            while (map->elements[i] != NULL) {
+                map_unlink(map, &map->elements[i]);
+            }
+        }
+    }
+
+    // Past this point nothing can fail
+    for (size_t i = 0; i < header->count; i++) {
+        map_kv_t* node        = repl->nodes[i];
+        const uint64_t probes = map->counters.probes;
+        map_kv_t** link       = map_find(map, node->hash, node->key->bytes, node->key->size);
+
+        if (repl->kinds[i] == MAP_CHANGE_REMOVE) {
+            if (link != NULL) {
+                map_unlink(map, link);
+            }
+            map_kv_discard(map, node);
+        } else if (link != NULL) {
+            map_notify(map, MAP_CHANGE_UPDATE, *link, node->value);
+            memcpy((*link)->value, node->value, map->size);
+            map_kv_discard(map, node);
+        } else {
+            map_link(map, node);
+            map_notify(map, MAP_CHANGE_INSERT, node, node->value);
+            map_watch_chain(map, node, map->counters.probes - probes);
+        }
+    }
+
+    map_rebalance(map);
+    map_write_end(map);
+
+    return (ssize_t)header->count;
+}
+
+ssize_t map_repl_poll(map_repl_t* repl) {
+    if (repl == NULL || repl->primary) {
+        return -EINVAL;
+    }
+
+    map_repl_header_t header;
+    ssize_t result = map_repl_recv(repl->fd, &header, sizeof(header));
+    if (result < 0) {
+        return result;
+    }
+
+    if ((header.type != MAP_REPL_SNAPSHOT && header.type != MAP_REPL_DELTA) ||
+        header.value_size != repl->map->size) {
+        return -EPROTO;
+    }
+
+    // A delta must continue exactly where the follower left off
+    if (header.type == MAP_REPL_DELTA && (!repl->synced || header.seq - header.count != repl->seq)) {
+        return -EPROTO;
+    }
+
+    // Every record takes at least its header, so a count the payload cannot
+    // hold is rejected before anything is sized by it
+    if (header.count > header.bytes / MAP_REPL_RECORD_HEADER) {
+        return -EPROTO;
+    }
+
+    repl->length = 0;
+    result       = map_repl_reserve(repl, header.bytes);
+    if (result == 0) {
+        result = map_repl_recv(repl->fd, repl->buffer, header.bytes);
+    }
+    if (result == 0) {
+        result = map_repl_decode(repl, &header);
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    result = map_repl_apply(repl, &header);
+    if (result >= 0) {
+        repl->seq    = header.seq;
+        repl->synced = true;
+    }
+
+    return result;
+}
+
+uint64_t map_repl_seq(const map_repl_t* repl) {
+    return repl != NULL ? repl->seq : 0;
+}
+
+ssize_t map_repl_free(map_repl_t* repl) {
+    if (repl == NULL) {
+        return -EINVAL;
+    }
+
+    if (repl->changes != NULL) {
+        map_changes_free(repl->changes);
+    }
+
+    free(repl->buffer);
+    free(repl->nodes);
+    free(repl->kinds);
+    free(repl);
+    return 0;
+}
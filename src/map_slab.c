@@ -0,0 +1,282 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "map.h"
+#include "map_internal.h"
+
+/**
+ * Bytes of each slab. Slabs are mapped at an address aligned to their size,
+ * so the slab of an entry is found by masking the entry's address. An entry
+ * too large for a slab stays where it is.
+ */
+#define MAP_SLAB_SIZE (256 * 1024)
+
+typedef struct map_slab {
+    struct map_slab* prev;
+    struct map_slab* next;
+    size_t used;
+    size_t live;
+    uint64_t pass;
+    _Alignas(max_align_t) unsigned char data[];
+} map_slab_t;
+
+#define MAP_SLAB_ROOM (MAP_SLAB_SIZE - offsetof(map_slab_t, data))
+
+/**
+ * Entries are only ever moved into the slab being filled by the current pass,
+ * and once moved are left alone until the next pass. A table resize or rekey
+ * between two calls relinks every entry, so the pass starts over at the first
+ * bucket; the entries it already moved are recognized by their slab's pass.
+ */
+typedef struct map_slabs {
+    map_slab_t* head;
+    map_slab_t* fill;
+    size_t count;
+    uint64_t pass;
+    bool active;
+    size_t index;
+    uint64_t shape;
+} map_slabs_t;
+
+static inline map_slab_t* map_slab_of(const map_kv_t* kv) {
+    return (map_slab_t*)((uintptr_t)kv & ~(uintptr_t)(MAP_SLAB_SIZE - 1));
+}
+
+static inline size_t map_slab_entry_bytes(const map_t* map, const map_kv_t* kv) {
+    const size_t bytes = map_kv_key_offset(map) + sizeof(string_t) + kv->key->size + 1;
+    return (bytes + _Alignof(map_kv_t) - 1) & ~(_Alignof(map_kv_t) - 1);
+}
+
+/**
+ * Maps a slab aligned to MAP_SLAB_SIZE by mapping twice that and unmapping
+ * the ends.
+ */
+static map_slab_t* map_slab_map(map_slabs_t* slabs) {
+    unsigned char* region =
+        mmap(NULL, 2 * MAP_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+
+    const uintptr_t start = ((uintptr_t)region + MAP_SLAB_SIZE - 1) & ~(uintptr_t)(MAP_SLAB_SIZE - 1);
+    const size_t head     = start - (uintptr_t)region;
+
+    if (head > 0) {
+        munmap(region, head);
+    }
+    munmap((unsigned char*)start + MAP_SLAB_SIZE, MAP_SLAB_SIZE - head);
+
+    // Fresh anonymous memory is zeroed
+    map_slab_t* slab = (map_slab_t*)start;
+    slab->pass       = slabs->pass;
+    slab->next       = slabs->head;
+    if (slabs->head != NULL) {
+        slabs->head->prev = slab;
+    }
+
+    slabs->head = slab;
+    slabs->count++;
+
+    return slab;
+}
+
+static void map_slab_unmap(map_slabs_t* slabs, map_slab_t* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        slabs->head = slab->next;
+    }
+
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+
+    if (slabs->fill == slab) {
+        slabs->fill = NULL;
+    }
+
+    slabs->count--;
+    munmap(slab, MAP_SLAB_SIZE);
+}
+
+void map_slab_release(const map_t* map, map_kv_t* kv) {
+    map_slabs_t* slabs = map->slabs;
+    map_slab_t* slab   = map_slab_of(kv);
+
+    // The slab being filled may still take entries, until its pass is over
+    if (--slab->live == 0 && (slab != slabs->fill || !slabs->active)) {
+        map_slab_unmap(slabs, slab);
+    }
+}
+
+/**
+ * Copies `kv` and its key into the slab being filled, or returns NULL if no
+ * slab can be mapped.
+ */
+static map_kv_t* map_slab_move(map_t* map, map_slabs_t* slabs, const map_kv_t* kv) {
+    const size_t bytes = map_slab_entry_bytes(map, kv);
+    map_slab_t* fill   = slabs->fill;
+
+    if (fill == NULL || fill->pass != slabs->pass || fill->used + bytes > MAP_SLAB_ROOM) {
+        map_slab_t* slab = map_slab_map(slabs);
+        if (slab == NULL) {
+            return NULL;
+        }
+
+        slabs->fill = slab;
+        if (fill != NULL && fill->live == 0) {
+            map_slab_unmap(slabs, fill);
+        }
+        fill = slab;
+    }
+
+    map_kv_t* moved = (map_kv_t*)(void*)(fill->data + fill->used);
+    fill->used += bytes;
+    fill->live++;
+
+    memcpy(moved, kv, sizeof(map_kv_t) + map->size);
+    moved->key = (string_t*)((char*)moved + map_kv_key_offset(map));
+    memcpy(moved->key, kv->key, sizeof(string_t) + kv->key->size + 1);
+    moved->key_inline = true;
+    moved->in_slab    = true;
+
+    return moved;
+}
+
+/**
+ * True for entries the current pass has no reason to move.
+ */
+static bool map_slab_settled(const map_t* map, const map_slabs_t* slabs, const map_kv_t* kv) {
+    return (kv->in_slab && map_slab_of(kv)->pass == slabs->pass) || map_slab_entry_bytes(map, kv) > MAP_SLAB_ROOM;
+}
+
+ssize_t map_compact(map_t* map, size_t budget) {
+    if (map == NULL || map_is_static(map) || map->family != NULL || (map->flags & MAP_FLAG_SINGLE_WRITER)) {
+        return -EINVAL;
+    }
+
+    map_write_begin(map);
+
+    if (map->slabs == NULL) {
+        map->slabs = calloc(1, sizeof(*map->slabs));
+        if (map->slabs == NULL) {
+            map_write_end(map);
+            return -ENOMEM;
+        }
+    }
+
+    map_slabs_t* slabs   = map->slabs;
+    const uint64_t shape = map->resizes + map->rekeys;
+
+    // Walk a single table
+    map_migrate(map, SIZE_MAX);
+
+    if (!slabs->active) {
+        slabs->active = true;
+        slabs->pass++;
+        slabs->index = 0;
+        slabs->shape = shape;
+    } else if (slabs->shape != shape) {
+        slabs->index = 0;
+        slabs->shape = shape;
+    }
+
+    ssize_t result = 0;
+    bool moved_any = false;
+
+    // Moving chain by chain, in bucket order, puts each chain and the entries
+    // an iterator visits one after another next to each other
+    for (; slabs->index < map->capacity; slabs->index++) {
+        const size_t bucket = slabs->index;
+
+        for (map_kv_t** link = &map->elements[bucket]; *link != NULL; link = &(*link)->next) {
+            map_kv_t* kv = *link;
+            if (map_slab_settled(map, slabs, kv)) {
+                continue;
+            }
+
+            if (budget == 0) {
+                result = -EAGAIN;
+                break;
+            }
+
+            map_kv_t* moved = map_slab_move(map, slabs, kv);
+            if (moved == NULL) {
+                result = -ENOMEM;
+                break;
+            }
+
+            *link = moved;
+
+            map_index_t* index = map->indexes != NULL ? map->indexes[bucket] : NULL;
+            for (size_t i = 0; index != NULL && i < index->count; i++) {
+                if (index->nodes[i] == kv) {
+                    index->nodes[i] = moved;
+                    break;
+                }
+            }
+
+            map_kv_discard(map, kv);
+            moved_any = true;
+            budget--;
+        }
+
+        // Resume at the same bucket; what was moved is skipped next time
+        if (result < 0) {
+            break;
+        }
+    }
+
+    if (result == 0) {
+        slabs->active = false;
+
+        // Everything moved into the fill slab this pass may have gone since
+        if (slabs->fill != NULL && slabs->fill->live == 0) {
+            map_slab_unmap(slabs, slabs->fill);
+        }
+    }
+
+    // Handles may refer to any entry that moved
+    if (moved_any) {
+        map->handle_gen++;
+    }
+
+    map_write_end(map);
+
+#if defined(__GLIBC__)
+    // The blocks the entries left are free but scattered through the heap;
+    // glibc keeps them mapped unless asked to hand whole free pages back
+    if (result == 0) {
+        malloc_trim(0);
+    }
+#endif
+
+    return result;
+}
+
+void map_slabs_free(map_t* map) {
+    map_slabs_t* slabs = map->slabs;
+    if (slabs == NULL) {
+        return;
+    }
+
+    while (slabs->head != NULL) {
+        map_slab_unmap(slabs, slabs->head);
+    }
+
+    free(slabs);
+    map->slabs = NULL;
+}
+
+size_t map_slab_count(const map_t* map) {
+    return map->slabs != NULL ? map->slabs->count : 0;
+}
@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+/**
+ * One slot of a static map. `distance` is one more than how far the entry
+ * sits from the slot its hash points at, and zero for an empty slot. Entries
+ * of a run are kept ordered by home slot (Robin Hood order), so a lookup stops
+ * at the first entry that is closer to home than the key would be.
+ */
+typedef struct map_static_slot {
+    uint32_t hash;
+    uint8_t distance;
+    uint8_t len;
+    char key[MAP_KEY_MAX_LEN];
+    uint8_t value[];
+} map_static_slot_t;
+
+static inline map_static_slot_t* map_static_slot(const map_t* map, size_t index) {
+    return (map_static_slot_t*)(void*)(map->slots + (index & (map->capacity - 1)) * map->slot_size);
+}
+
+static inline size_t map_align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+/**
+ * Number of slots of a static map: a power of two that keeps the table at
+ * most three quarters full, or 0 on overflow.
+ */
+static size_t map_static_capacity(size_t max_entries) {
+    if (max_entries > SIZE_MAX / 8) {
+        return 0;
+    }
+
+    size_t capacity = 8;
+    while (capacity * 3 < max_entries * 4) {
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+size_t map_static_size(size_t size, size_t max_entries) {
+    const size_t capacity = map_static_capacity(max_entries);
+    const size_t stride   = map_align_up(sizeof(map_static_slot_t) + size, _Alignof(map_static_slot_t));
+
+    if (capacity == 0 || size > SIZE_MAX / 2 || stride > (SIZE_MAX / 2) / capacity) {
+        return 0;
+    }
+
+    return _Alignof(map_t) - 1 + map_align_up(sizeof(map_t), _Alignof(map_static_slot_t)) + capacity * stride;
+}
+
+map_t* map_init_static(void* buffer, size_t bytes, size_t size, size_t max_entries) {
+    const size_t needed = map_static_size(size, max_entries);
+    if (buffer == NULL || size == 0 || max_entries == 0 || needed == 0 || bytes < needed) {
+        return NULL;
+    }
+
+    const uintptr_t start = map_align_up((uintptr_t)buffer, _Alignof(map_t));
+    map_t* map            = (map_t*)start;
+    memset(map, 0, sizeof(*map));
+
+    map->capacity    = map_static_capacity(max_entries);
+    map->slot_size   = map_align_up(sizeof(map_static_slot_t) + size, _Alignof(map_static_slot_t));
+    map->slots       = (uint8_t*)start + map_align_up(sizeof(map_t), _Alignof(map_static_slot_t));
+    map->max_entries = max_entries;
+    map->size        = size;
+    atomic_init(&map->seq, 0);
+    map_adapt_init(map);
+
+    // Nothing can rekey a table that may not allocate, so it is keyed from the start
+    map_hash_key_init(&map->hash_key);
+
+    memset(map->slots, 0, map->capacity * map->slot_size);
+    return map;
+}
+
+/**
+ * Index of the slot holding `key`, or SIZE_MAX. At most
+ * MAP_STATIC_PROBE_LIMIT + 1 slots are looked at.
+ */
+static size_t map_static_find(map_t* map, uint32_t hash, const map_key_t* key) {
+    for (size_t distance = 0; distance <= MAP_STATIC_PROBE_LIMIT; distance++) {
+        const map_static_slot_t* slot = map_static_slot(map, hash + distance);
+        map->counters.probes++;
+
+        // An empty slot, or an entry closer to home than the key would be,
+        // means the key is not stored
+        if (slot->distance <= distance) {
+            return SIZE_MAX;
+        }
+
+        if (slot->hash == hash && slot->len == key->len && map_key_equal(key, slot->key)) {
+            return (hash + distance) & (map->capacity - 1);
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+ssize_t map_static_put(map_t* map, const map_key_t* key, const void* element) {
+    const uint32_t hash = map_key_siphash(&map->hash_key, key);
+
+    if (map_static_find(map, hash, key) != SIZE_MAX) {
+        return -EEXIST;
+    }
+
+    if (map->count == map->max_entries) {
+        return -ENOSPC;
+    }
+
+    // The key goes in front of the first entry closer to home than it would
+    // be; that entry and the rest of its run move up one slot
+    size_t distance = 0;
+    while (map_static_slot(map, hash + distance)->distance > distance) {
+        if (++distance > MAP_STATIC_PROBE_LIMIT) {
+            return -ENOSPC;
+        }
+    }
+
+    size_t end = distance;
+    while (map_static_slot(map, hash + end)->distance != 0) {
+        if (map_static_slot(map, hash + end)->distance > MAP_STATIC_PROBE_LIMIT) {
+            return -ENOSPC;
+        }
+
+        end++;
+    }
+
+    // Nothing fails past this point
+    for (size_t i = end; i > distance; i--) {
+        map_static_slot_t* to = map_static_slot(map, hash + i);
+        memcpy(to, map_static_slot(map, hash + i - 1), map->slot_size);
+        to->distance++;
+    }
+
+    map_static_slot_t* slot = map_static_slot(map, hash + distance);
+    slot->hash              = hash;
+    slot->distance          = (uint8_t)(distance + 1);
+    slot->len               = (uint8_t)key->len;
+    map_key_gather(key, slot->key);
+    memcpy(slot->value, element, map->size);
+    map->count++;
+
+    return 0;
+}
+
+ssize_t map_static_get(map_t* map, const map_key_t* key, void* out) {
+    const size_t index = map_static_find(map, map_key_siphash(&map->hash_key, key), key);
+    if (index == SIZE_MAX) {
+        return -ENOENT;
+    }
+
+    memcpy(out, map_static_slot(map, index)->value, map->size);
+    return 0;
+}
+
+ssize_t map_static_remove(map_t* map, const map_key_t* key, void* out) {
+    size_t index = map_static_find(map, map_key_siphash(&map->hash_key, key), key);
+    if (index == SIZE_MAX) {
+        return -ENOENT;
+    }
+
+    memcpy(out, map_static_slot(map, index)->value, map->size);
+
+    // Backward shift: the entries after it that are away from home move one
+    // slot closer, which leaves no tombstones behind
+    for (;;) {
+        map_static_slot_t* next = map_static_slot(map, index + 1);
+        if (next->distance <= 1) {
+            break;
+        }
+
+        map_static_slot_t* slot = map_static_slot(map, index);
+        memcpy(slot, next, map->slot_size);
+        slot->distance--;
+        index++;
+    }
+
+    map_static_slot(map, index)->distance = 0;
+    map->count--;
+
+    return 0;
+}
+
+size_t map_static_next(const map_t* map, size_t index) {
+    while (index < map->capacity && map_static_slot(map, index)->distance == 0) {
+        index++;
+    }
+
+    return index;
+}
+
+void map_static_entry(map_t* map, size_t index, char** key, size_t* len, void* value) {
+    map_static_slot_t* slot = map_static_slot(map, index);
+
+    *key = slot->key;
+    *len = slot->len;
+    memcpy(value, slot->value, map->size);
+}
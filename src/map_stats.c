@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+typedef struct map_tuning {
+    uint32_t grow_load;
+    uint32_t shrink_load;
+    size_t small_limit;
+} map_tuning_t;
+
+/**
+ * Load factors keep a factor of two between growing and shrinking so one
+ * resize never immediately calls for the opposite one. For the same reason a
+ * map leaves the inline slots above MAP_SMALL_SLOTS entries but only returns
+ * to them at half that, so a map hovering around the threshold does not
+ * switch engines back and forth.
+ */
+static const map_tuning_t map_profile_tuning[] = {
+    [MAP_PROFILE_BALANCED] = {.grow_load = 75, .shrink_load = 25, .small_limit = MAP_SMALL_SLOTS / 2},
+    // Churn would otherwise shrink and regrow the table, or switch engines, over and over
+    [MAP_PROFILE_WRITE_HEAVY] = {.grow_load = 75, .shrink_load = 10, .small_limit = 0},
+    // A miss walks the whole chain, so keep chains short
+    [MAP_PROFILE_MISS_HEAVY] = {.grow_load = 50, .shrink_load = 15, .small_limit = MAP_SMALL_SLOTS / 2},
+    // Hits stop half way down a chain on average
+    [MAP_PROFILE_READ_HEAVY] = {.grow_load = 90, .shrink_load = 30, .small_limit = MAP_SMALL_SLOTS / 2},
+};
+
+static void map_apply_profile(map_t* map, map_profile_t profile) {
+    const map_tuning_t* tuning = &map_profile_tuning[profile];
+
+    map->profile     = profile;
+    map->grow_load   = tuning->grow_load;
+    map->shrink_load = tuning->shrink_load;
+    map->small_limit = map_is_shared(map) ? 0 : tuning->small_limit;
+}
+
+void map_adapt_init(map_t* map) {
+    map_apply_profile(map, MAP_PROFILE_BALANCED);
+}
+
+void map_adapt(map_t* map) {
+    const map_counters_t* now  = &map->counters;
+    const map_counters_t* base = &map->adapt_base;
+
+    uint64_t gets   = now->gets - base->gets;
+    uint64_t hits   = now->hits - base->hits;
+    uint64_t writes = now->puts - base->puts + now->removes - base->removes;
+    uint64_t probes = now->probes - base->probes;
+    uint64_t ops    = gets + writes;
+
+    map_profile_t profile = MAP_PROFILE_BALANCED;
+
+    if (writes * 2 > ops) {
+        profile = MAP_PROFILE_WRITE_HEAVY;
+    } else if ((gets - hits) * 2 > gets || probes > ops * 2) {
+        profile = MAP_PROFILE_MISS_HEAVY;
+    } else if (hits * 10 >= gets * 9) {
+        profile = MAP_PROFILE_READ_HEAVY;
+    }
+
+    map_apply_profile(map, profile);
+    map->adapt_base = map->counters;
+    map->adaptations++;
+}
+
+static void map_stats_fill(const map_t* map, map_stats_t* out) {
+    *out = (map_stats_t){
+        .count           = map->count,
+        .capacity        = map->capacity,
+        .engine          = map_is_static(map)  ? MAP_ENGINE_STATIC
+                           : map_is_small(map) ? MAP_ENGINE_SMALL
+                           : map->dense        ? MAP_ENGINE_DIRECT
+                                               : MAP_ENGINE_HASHED,
+        .profile         = map->profile,
+        .grow_load       = map->grow_load,
+        .shrink_load     = map->shrink_load,
+        .small_limit     = map->small_limit,
+        .gets            = map->counters.gets,
+        .hits            = map->counters.hits,
+        .puts            = map->counters.puts,
+        .removes         = map->counters.removes,
+        .probes          = map->counters.probes,
+        .resizes         = map->resizes,
+        .adaptations     = map->adaptations,
+        .rekeys          = map->rekeys,
+        .indexed_buckets = map->indexed,
+        .slabs           = map_slab_count(map),
+    };
+}
+
+ssize_t map_stats(const map_t* map, map_stats_t* out) {
+    if (map == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    if (map->flags & MAP_FLAG_SINGLE_WRITER) {
+        uint64_t seq;
+
+        do {
+            seq = map_read_begin(map);
+            map_stats_fill(map, out);
+        } while (!map_read_valid(map, seq));
+
+        return 0;
+    }
+
+    map_lock(map);
+    map_stats_fill(map, out);
+    map_unlock(map);
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_internal.h"
+
+typedef struct map_txn_entry {
+    int kind;
+    bool must_exist;
+    map_kv_t* node;
+} map_txn_entry_t;
+
+typedef struct map_txn {
+    map_t* map;
+    map_txn_entry_t* entries;
+    size_t count;
+    size_t capacity;
+} map_txn_t;
+
+static void map_txn_destroy(map_txn_t* txn) {
+    for (size_t i = 0; i < txn->count; i++) {
+        if (txn->entries[i].node != NULL) {
+            map_kv_discard(txn->map, txn->entries[i].node);
+        }
+    }
+
+    free(txn->entries);
+    free(txn);
+}
+
+/**
+ * Returns the entry already staged for `key`, or NULL.
+ */
+static map_txn_entry_t* map_txn_find(map_txn_t* txn, uint32_t hash, const char* key, size_t len) {
+    for (size_t i = 0; i < txn->count; i++) {
+        const map_kv_t* node = txn->entries[i].node;
+        if (node->hash != hash || node->key->size != len) {
+            continue;
+        }
+
+        if (map_folds(txn->map) ? map_fold_compare(key, node->key->bytes, len) == 0
+                                : memcmp(node->key->bytes, key, len) == 0) {
+            return &txn->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static ssize_t map_txn_stage(map_txn_t* txn, int kind, const char* key, size_t len, const void* element) {
+    uint32_t hash          = map_unkeyed_hash(txn->map, key, len);
+    map_txn_entry_t* entry = map_txn_find(txn, hash, key, len);
+
+    if (entry != NULL) {
+        // A later operation on the same key supersedes the staged one; removing
+        // a key this transaction put may find nothing in the map, which is fine
+        if (kind == MAP_OP_PUT) {
+            memcpy(entry->node->value, element, txn->map->size);
+        } else if (entry->kind == MAP_OP_PUT) {
+            entry->must_exist = false;
+        }
+
+        entry->kind = kind;
+        return 0;
+    }
+
+    if (txn->count == txn->capacity) {
+        size_t capacity          = txn->capacity ? txn->capacity * 2 : 8;
+        map_txn_entry_t* entries = realloc(txn->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return -ENOMEM;
+        }
+
+        txn->entries  = entries;
+        txn->capacity = capacity;
+    }
+
+    // Allocate the entry now so commit cannot run out of memory halfway
+    map_kv_t* node = map_kv_create(txn->map, hash, key, len, element);
+    if (node == NULL) {
+        return -ENOMEM;
+    }
+
+    txn->entries[txn->count++] = (map_txn_entry_t){.kind = kind, .must_exist = true, .node = node};
+    return 0;
+}
+
+map_txn_t* map_txn_begin(map_t* map) {
+    if (map == NULL || map_is_static(map)) {
+        return NULL;
+    }
+
+    map_txn_t* txn = calloc(1, sizeof(*txn));
+    if (txn == NULL) {
+        return NULL;
+    }
+
+    txn->map = map;
+    return txn;
+}
+
+ssize_t map_txn_put(map_txn_t* txn, const char* key, size_t len, const void* element) {
+    if (txn == NULL || key == NULL || len == 0 || element == NULL) {
+        return -EINVAL;
+    }
+
+    if (len > MAP_KEY_MAX_LEN) {
+        return -EOVERFLOW;
+    }
+
+    if (txn->map->key_width != 0 && len != txn->map->key_width) {
+        return -EINVAL;
+    }
+
+    return map_txn_stage(txn, MAP_OP_PUT, key, len, element);
+}
+
+ssize_t map_txn_remove(map_txn_t* txn, const char* key, size_t len) {
+    if (txn == NULL || key == NULL || len == 0) {
+        return -EINVAL;
+    }
+
+    if (len > MAP_KEY_MAX_LEN) {
+        return -EOVERFLOW;
+    }
+
+    if (txn->map->key_width != 0 && len != txn->map->key_width) {
+        return -EINVAL;
+    }
+
+    return map_txn_stage(txn, MAP_OP_REMOVE, key, len, NULL);
+}
+
+/**
+ * Checks every staged operation against the map and returns how many new
+ * entries the transaction adds. Nothing is modified.
+ */
+static ssize_t map_txn_validate(map_txn_t* txn) {
+    map_t* map   = txn->map;
+    size_t added = 0;
+
+    for (size_t i = 0; i < txn->count; i++) {
+        const map_txn_entry_t* entry = &txn->entries[i];
+        const map_kv_t* node         = entry->node;
+        bool exists                  = map_find(map, node->hash, node->key->bytes, node->key->size) != NULL;
+
+        if (entry->kind == MAP_OP_REMOVE && entry->must_exist && !exists) {
+            return -ENOENT;
+        }
+
+        if (entry->kind == MAP_OP_PUT && !exists) {
+            added++;
+        }
+    }
+
+    return (ssize_t)added;
+}
+
+ssize_t map_txn_commit(map_txn_t* txn) {
+    if (txn == NULL) {
+        return -EINVAL;
+    }
+
+    map_t* map = txn->map;
+
+    // The whole commit is one write section: locked readers wait for it and
+    // optimistic readers retry until it is done, so nobody sees half of it
+    map_write_begin(map);
+
+    ssize_t result = map_txn_validate(txn);
+    size_t total   = map->count;
+    if (result >= 0) {
+        total += (size_t)result;
+        result = map_reserve(map, total);
+    }
+
+    // A direct-addressed map needs a slot for every key it is about to link
+    for (size_t i = 0; i < txn->count && result >= 0; i++) {
+        if (txn->entries[i].kind == MAP_OP_PUT) {
+            result = map_dense_cover(map, txn->entries[i].node->key->bytes, total);
+        }
+    }
+
+    if (result < 0) {
+        map_write_end(map);
+        map_txn_destroy(txn);
+        return result;
+    }
+
+    // Past this point nothing can fail
+    for (size_t i = 0; i < txn->count; i++) {
+        map_txn_entry_t* entry = &txn->entries[i];
+        map_kv_t* node         = entry->node;
+        const uint64_t probes  = map->counters.probes;
+        map_kv_t** link        = map_find(map, node->hash, node->key->bytes, node->key->size);
+
+        if (entry->kind == MAP_OP_PUT) {
+            if (link != NULL) {
+                map_notify(map, MAP_CHANGE_UPDATE, *link, node->value);
+                memcpy((*link)->value, node->value, map->size);
+            } else {
+                map_link(map, node);
+                map_notify(map, MAP_CHANGE_INSERT, node, node->value);
+                map_watch_chain(map, node, map->counters.probes - probes);
+                entry->node = NULL;
+            }
+        } else if (link != NULL) {
+            map_unlink(map, link);
+        }
+    }
+
+    map_rebalance(map);
+    map_write_end(map);
+
+    map_txn_destroy(txn);
+    return 0;
+}
+
+ssize_t map_txn_abort(map_txn_t* txn) {
+    if (txn == NULL) {
+        return -EINVAL;
+    }
+
+    map_txn_destroy(txn);
+    return 0;
+}
@@ -1,5 +1,10 @@
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unity.h>
@@ -362,6 +367,1750 @@ static void test_remove_operations(void) {
     TEST_ASSERT_EQUAL_INT(0, map_free(map));
 }
 
+static void test_background_resize(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_BACKGROUND_RESIZE);
+    TEST_ASSERT_NOT_NULL(map);
+
+    // Every key must stay reachable while the worker migrates buckets
+    for (int i = 0; i < 5000; i++) {
+        char key[20];
+        sprintf(key, "key%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key) + 1, &i));
+
+        int result = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, "key0", 5, &result));
+        TEST_ASSERT_EQUAL_INT(0, result);
+    }
+
+    TEST_ASSERT_EQUAL_INT(5000, map_count(map));
+
+    for (int i = 0; i < 4900; i++) {
+        char key[20];
+        sprintf(key, "key%d", i);
+        int result = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, strlen(key) + 1, &result));
+        TEST_ASSERT_EQUAL_INT(i, result);
+    }
+
+    // The iterator drains any migration still in flight
+    map_iter_t* iter = map_iter_create(map);
+    TEST_ASSERT_NOT_NULL(iter);
+
+    int count = 0;
+    char* key_ptr;
+    size_t key_len;
+    int value;
+    while (map_iter_next(iter, &key_ptr, &key_len, &value) == 0) {
+        TEST_ASSERT_TRUE(value >= 4900);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_INT(100, count);
+
+    TEST_ASSERT_EQUAL_INT(0, map_iter_free(iter));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+typedef struct {
+    map_t* map;
+    int base;
+} writer_args_t;
+
+static void* concurrent_writer(void* arg) {
+    writer_args_t* args = arg;
+
+    for (int i = 0; i < 2000; i++) {
+        char key[20];
+        int value = args->base + i;
+        sprintf(key, "key%d", value);
+        if (map_put(args->map, key, strlen(key) + 1, &value) != 0) {
+            return arg;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_writers(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_BACKGROUND_RESIZE);
+    TEST_ASSERT_NOT_NULL(map);
+
+    pthread_t threads[4];
+    writer_args_t args[4];
+    for (int i = 0; i < 4; i++) {
+        args[i].map  = map;
+        args[i].base = i * 2000;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, concurrent_writer, &args[i]));
+    }
+
+    for (int i = 0; i < 4; i++) {
+        void* failed = NULL;
+        pthread_join(threads[i], &failed);
+        TEST_ASSERT_NULL(failed);
+    }
+
+    TEST_ASSERT_EQUAL_INT(8000, map_count(map));
+
+    for (int i = 0; i < 8000; i++) {
+        char key[20];
+        sprintf(key, "key%d", i);
+        int result = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key) + 1, &result));
+        TEST_ASSERT_EQUAL_INT(i, result);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // Unknown flags are rejected
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), 1u << 31));
+}
+
+typedef struct {
+    map_t* map;
+    int failures;
+} reader_args_t;
+
+static atomic_bool writer_done;
+
+static void* optimistic_reader(void* arg) {
+    reader_args_t* args = arg;
+
+    while (!atomic_load(&writer_done)) {
+        for (int i = 0; i < 100; i++) {
+            char key[20];
+            sprintf(key, "stable%d", i);
+            int result = -1;
+            if (map_get(args->map, key, strlen(key) + 1, &result) != 0 || result != i) {
+                args->failures++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void test_single_writer(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_SINGLE_WRITER);
+    TEST_ASSERT_NOT_NULL(map);
+
+    for (int i = 0; i < 100; i++) {
+        char key[20];
+        sprintf(key, "stable%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key) + 1, &i));
+    }
+
+    atomic_store(&writer_done, false);
+
+    pthread_t readers[4];
+    reader_args_t args[4];
+    for (int i = 0; i < 4; i++) {
+        args[i].map      = map;
+        args[i].failures = 0;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&readers[i], NULL, optimistic_reader, &args[i]));
+    }
+
+    // Churn grows and shrinks the table underneath the readers
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 2000; i++) {
+            char key[20];
+            sprintf(key, "churn%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key) + 1, &i));
+        }
+
+        for (int i = 0; i < 2000; i++) {
+            char key[20];
+            sprintf(key, "churn%d", i);
+            int result = -1;
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, strlen(key) + 1, &result));
+            TEST_ASSERT_EQUAL_INT(i, result);
+        }
+    }
+
+    atomic_store(&writer_done, true);
+    for (int i = 0; i < 4; i++) {
+        pthread_join(readers[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, args[i].failures);
+    }
+
+    TEST_ASSERT_EQUAL_INT(100, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // A single writer excludes the locked modes
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), MAP_FLAG_SINGLE_WRITER | MAP_FLAG_CONCURRENT));
+}
+
+static atomic_int readers_in;
+static atomic_bool readers_release;
+
+static void* parked_reader(void* arg) {
+    reader_args_t* args = arg;
+    int result          = -1;
+
+    if (map_get(args->map, "stable7", strlen("stable7") + 1, &result) != 0 || result != 7) {
+        args->failures++;
+    }
+
+    // Stay alive so the thread keeps its reader slot
+    atomic_fetch_add(&readers_in, 1);
+    while (!atomic_load(&readers_release)) {
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_single_writer_many_readers(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_SINGLE_WRITER);
+    TEST_ASSERT_NOT_NULL(map);
+
+    for (int i = 0; i < 100; i++) {
+        char key[20];
+        sprintf(key, "stable%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key) + 1, &i));
+    }
+
+    // More live readers than one block of reader slots holds
+    enum { READERS = 300 };
+    static pthread_t readers[READERS];
+    static reader_args_t args[READERS];
+    atomic_store(&readers_in, 0);
+    atomic_store(&readers_release, false);
+
+    for (int i = 0; i < READERS; i++) {
+        args[i].map      = map;
+        args[i].failures = 0;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&readers[i], NULL, parked_reader, &args[i]));
+    }
+
+    while (atomic_load(&readers_in) < READERS) {
+        sched_yield();
+    }
+
+    // The writer carries on with every block of slots in use
+    int result = -1;
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, "stable0", strlen("stable0") + 1, &result));
+    TEST_ASSERT_EQUAL_INT(0, result);
+
+    atomic_store(&readers_release, true);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, args[i].failures);
+    }
+
+    TEST_ASSERT_EQUAL_INT(99, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+typedef struct {
+    map_t* map;
+    int base;
+    int failures;
+} combining_args_t;
+
+static void* combining_writer(void* arg) {
+    combining_args_t* args = arg;
+
+    for (int i = 0; i < 2000; i++) {
+        char key[20];
+        int value = args->base + i;
+        sprintf(key, "key%d", value);
+        if (map_put(args->map, key, strlen(key) + 1, &value) != 0) {
+            args->failures++;
+        }
+
+        // Results come back through the slot, including errors
+        if (map_put(args->map, key, strlen(key) + 1, &value) != -EEXIST) {
+            args->failures++;
+        }
+    }
+
+    for (int i = 0; i < 2000; i += 2) {
+        char key[20];
+        int result = -1;
+        sprintf(key, "key%d", args->base + i);
+        if (map_remove(args->map, key, strlen(key) + 1, &result) != 0 || result != args->base + i) {
+            args->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_combining_writers(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_COMBINING);
+    TEST_ASSERT_NOT_NULL(map);
+
+    pthread_t threads[8];
+    combining_args_t args[8];
+    for (int i = 0; i < 8; i++) {
+        args[i] = (combining_args_t){.map = map, .base = i * 2000};
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, combining_writer, &args[i]));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, args[i].failures);
+    }
+
+    TEST_ASSERT_EQUAL_INT(8000, map_count(map));
+
+    for (int i = 1; i < 16000; i += 2) {
+        char key[20];
+        sprintf(key, "key%d", i);
+        int result = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key) + 1, &result));
+        TEST_ASSERT_EQUAL_INT(i, result);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_read_cache(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(map);
+
+    map_cache_t* cache = map_cache_create(map, 10);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    char key[] = "hot";
+    int value  = 1;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, key, sizeof(key), &value));
+
+    // The first read fills the slot, the second is served from it
+    int result = 0;
+    TEST_ASSERT_EQUAL_INT(0, map_cache_get(cache, key, sizeof(key), &result));
+    TEST_ASSERT_EQUAL_INT(1, result);
+    result = 0;
+    TEST_ASSERT_EQUAL_INT(0, map_cache_get(cache, key, sizeof(key), &result));
+    TEST_ASSERT_EQUAL_INT(1, result);
+
+    // Any write invalidates cached entries
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, sizeof(key), &result));
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_cache_get(cache, key, sizeof(key), &result));
+
+    value = 2;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, key, sizeof(key), &value));
+    TEST_ASSERT_EQUAL_INT(0, map_cache_get(cache, key, sizeof(key), &result));
+    TEST_ASSERT_EQUAL_INT(2, result);
+
+    // Keys too long for a slot are looked up in the map directly
+    char long_key[MAP_KEY_MAX_LEN];
+    memset(long_key, 'x', sizeof(long_key));
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, long_key, sizeof(long_key), &value));
+    TEST_ASSERT_EQUAL_INT(0, map_cache_get(cache, long_key, sizeof(long_key), &result));
+    TEST_ASSERT_EQUAL_INT(2, result);
+
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_cache_get(NULL, key, sizeof(key), &result));
+    TEST_ASSERT_EQUAL_INT(0, map_cache_free(cache));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+typedef struct diff_counts {
+    int added;
+    int removed;
+    int changed;
+} diff_counts_t;
+
+static void diff_added(void* ctx, const char* key, size_t len, const void* value) {
+    (void)len;
+    (void)value;
+    TEST_ASSERT_EQUAL_INT('n', key[0]);
+    ((diff_counts_t*)ctx)->added++;
+}
+
+static void diff_removed(void* ctx, const char* key, size_t len, const void* value) {
+    (void)len;
+    (void)value;
+    TEST_ASSERT_EQUAL_INT('o', key[0]);
+    ((diff_counts_t*)ctx)->removed++;
+}
+
+static void diff_changed(void* ctx, const char* key, size_t len, const void* old_value, const void* new_value) {
+    (void)key;
+    (void)len;
+    int before = 0;
+    int after  = 0;
+    memcpy(&before, old_value, sizeof(int));
+    memcpy(&after, new_value, sizeof(int));
+    TEST_ASSERT_EQUAL_INT(before + 1, after);
+    ((diff_counts_t*)ctx)->changed++;
+}
+
+static int diff_compare_parity(void* ctx, const void* a, const void* b, size_t size) {
+    (void)ctx;
+    (void)size;
+    int x = 0;
+    int y = 0;
+    memcpy(&x, a, sizeof(int));
+    memcpy(&y, b, sizeof(int));
+    return (x & 1) != (y & 1);
+}
+
+static void test_diff(void) {
+    map_t* a = map_create(sizeof(int));
+    map_t* b = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+
+    char key[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "shared:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(a, key, strlen(key), &i));
+        int value = i < 20 ? i + 1 : i;
+        TEST_ASSERT_EQUAL_INT(0, map_put(b, key, strlen(key), &value));
+    }
+    for (int i = 0; i < 10; i++) {
+        snprintf(key, sizeof(key), "old:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(a, key, strlen(key), &i));
+    }
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "new:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(b, key, strlen(key), &i));
+    }
+
+    // Different table sizes take the probing path
+    diff_counts_t counts = {0};
+    map_diff_ops_t ops   = {
+          .on_added   = diff_added,
+          .on_removed = diff_removed,
+          .on_changed = diff_changed,
+          .ctx        = &counts,
+    };
+    TEST_ASSERT_EQUAL_INT(5030, map_diff(a, b, &ops));
+    TEST_ASSERT_EQUAL_INT(5000, counts.added);
+    TEST_ASSERT_EQUAL_INT(10, counts.removed);
+    TEST_ASSERT_EQUAL_INT(20, counts.changed);
+
+    // A comparator decides which values count as changed
+    ops.compare = diff_compare_parity;
+    counts      = (diff_counts_t){0};
+    TEST_ASSERT_EQUAL_INT(5030, map_diff(a, b, &ops));
+    TEST_ASSERT_EQUAL_INT(20, counts.changed);
+
+    TEST_ASSERT_EQUAL_INT(0, map_diff(a, a, &ops));
+    TEST_ASSERT_EQUAL_INT(0, map_diff(b, b, &ops));
+
+    map_t* wide = map_create(sizeof(long long));
+    TEST_ASSERT_NOT_NULL(wide);
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_diff(a, wide, &ops));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_diff(a, b, NULL));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(wide));
+    TEST_ASSERT_EQUAL_INT(0, map_free(a));
+    TEST_ASSERT_EQUAL_INT(0, map_free(b));
+}
+
+static void test_interleaved_lookup(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    char keys[64][16];
+    for (int i = 0; i < 64; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "k%d", i);
+        if (i % 2 == 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, keys[i], strlen(keys[i]), &i));
+        }
+    }
+
+    map_lookup_t lookups[64];
+    int values[64] = {0};
+    for (int i = 0; i < 64; i++) {
+        map_lookup_start(&lookups[i], map, keys[i], strlen(keys[i]), &values[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(-EAGAIN, map_lookup_result(&lookups[0]));
+
+    TEST_ASSERT_EQUAL_size_t(32, map_lookup_run(lookups, 64));
+    for (int i = 0; i < 64; i++) {
+        if (i % 2 == 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookups[i]));
+            TEST_ASSERT_EQUAL_INT(i, values[i]);
+        } else {
+            TEST_ASSERT_EQUAL_INT(-ENOENT, map_lookup_result(&lookups[i]));
+        }
+    }
+
+    // Stepping one lookup by hand reaches the same answer
+    int value = -1;
+    map_lookup_start(&lookups[0], map, "k10", 3, &value);
+    while (!map_lookup_step(&lookups[0])) {
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookups[0]));
+    TEST_ASSERT_EQUAL_INT(10, value);
+
+    map_lookup_start(&lookups[0], NULL, "k10", 3, &value);
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_lookup_result(&lookups[0]));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_lookup_result(NULL));
+
+    // Shared maps answer at start
+    map_t* shared = map_create_ex(sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(shared);
+    TEST_ASSERT_EQUAL_INT(0, map_put(shared, "k10", 3, &value));
+    map_lookup_start(&lookups[0], shared, "k10", 3, &value);
+    TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookups[0]));
+    TEST_ASSERT_EQUAL_size_t(1, map_lookup_run(lookups, 1));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(shared));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_small_map(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    // Same length and first byte, so only the key comparison tells them apart
+    char key[16];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 40; i++) {
+            snprintf(key, sizeof(key), "k%02d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+            TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, key, strlen(key), &i));
+
+            for (int j = 0; j <= i; j++) {
+                int value = -1;
+                snprintf(key, sizeof(key), "k%02d", j);
+                TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key), &value));
+                TEST_ASSERT_EQUAL_INT(j, value);
+            }
+        }
+        TEST_ASSERT_EQUAL_size_t(40, map_count(map));
+
+        // Shrink back below the threshold and check nothing got lost on the way
+        for (int i = 39; i >= 0; i--) {
+            int value = -1;
+            snprintf(key, sizeof(key), "k%02d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, strlen(key), &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+            TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, key, strlen(key), &value));
+
+            for (int j = 0; j < i; j++) {
+                snprintf(key, sizeof(key), "k%02d", j);
+                TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key), &value));
+                TEST_ASSERT_EQUAL_INT(j, value);
+            }
+        }
+        TEST_ASSERT_EQUAL_size_t(0, map_count(map));
+    }
+
+    // A transaction can carry a small map past the threshold in one commit
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    for (int i = 0; i < 24; i++) {
+        snprintf(key, sizeof(key), "t%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, key, strlen(key), &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_size_t(24, map_count(map));
+
+    // Small and hashed maps compare against each other
+    map_t* small = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(small);
+    for (int i = 0; i < 4; i++) {
+        snprintf(key, sizeof(key), "t%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(small, key, strlen(key), &i));
+    }
+
+    map_diff_ops_t ops = {0};
+    TEST_ASSERT_EQUAL_INT(20, map_diff(small, map, &ops));
+    TEST_ASSERT_EQUAL_INT(20, map_diff(map, small, &ops));
+
+    size_t seen      = 0;
+    map_iter_t* iter = map_iter_create(small);
+    TEST_ASSERT_NOT_NULL(iter);
+    char* iter_key = NULL;
+    size_t iter_len;
+    int iter_value;
+    while (map_iter_next(iter, &iter_key, &iter_len, &iter_value) == 0) {
+        seen++;
+    }
+    TEST_ASSERT_EQUAL_size_t(4, seen);
+    TEST_ASSERT_EQUAL_INT(0, map_iter_free(iter));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(small));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_small_map_binary_keys(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    // Little-endian multiples of 256 share their length, their first and last
+    // byte and everything up to the first NUL
+    for (uint32_t i = 1; i <= 12; i++) {
+        const uint32_t id = i << 8;
+        int value         = (int)i;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_size_t(12, map_count(map));
+
+    for (uint32_t i = 1; i <= 12; i++) {
+        const uint32_t id = i << 8;
+        int value         = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)&id, sizeof(id), &value));
+        TEST_ASSERT_EQUAL_INT((int)i, value);
+    }
+
+    const uint32_t missing = 13 << 8;
+    int value              = -1;
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, (const char*)&missing, sizeof(missing), &value));
+
+    const uint32_t first = 1 << 8;
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, (const char*)&first, sizeof(first), &value));
+    TEST_ASSERT_EQUAL_INT(1, value);
+    TEST_ASSERT_EQUAL_size_t(11, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // Folding compares every byte too
+    map = map_create_ex(sizeof(int), MAP_FLAG_CASE_INSENSITIVE);
+    TEST_ASSERT_NOT_NULL(map);
+    int one = 1;
+    int two = 2;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "a\0b", 3, &one));
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "a\0c", 3, &two));
+    TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, "A\0B", 3, &two));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "A\0C", 3, &value));
+    TEST_ASSERT_EQUAL_INT(2, value);
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_adaptive(void) {
+    map_stats_t stats;
+    char key[32];
+    int value = 0;
+
+    // Plain maps report their shape and the default tuning
+    map_t* plain = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(plain);
+    TEST_ASSERT_EQUAL_INT(0, map_stats(plain, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_SMALL, stats.engine);
+    TEST_ASSERT_EQUAL_INT(MAP_PROFILE_BALANCED, stats.profile);
+    TEST_ASSERT_EQUAL_INT(75, stats.grow_load);
+    TEST_ASSERT_EQUAL_INT(25, stats.shrink_load);
+    TEST_ASSERT_EQUAL_INT(0, map_get(plain, "absent", 6, &value) == 0);
+    TEST_ASSERT_EQUAL_INT(0, map_stats(plain, &stats));
+    TEST_ASSERT_EQUAL_INT(0, (int)stats.gets);
+    TEST_ASSERT_EQUAL_INT(0, map_free(plain));
+
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), MAP_FLAG_ADAPTIVE | MAP_FLAG_SINGLE_WRITER));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_stats(NULL, &stats));
+
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_ADAPTIVE);
+    TEST_ASSERT_NOT_NULL(map);
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+    }
+
+    // A window of misses asks for shorter chains, applied by the next insert
+    for (int i = 0; i < MAP_ADAPT_WINDOW; i++) {
+        snprintf(key, sizeof(key), "miss:%d", i);
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, key, strlen(key), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "key:100", 7, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_PROFILE_MISS_HEAVY, stats.profile);
+    TEST_ASSERT_EQUAL_INT(50, stats.grow_load);
+    TEST_ASSERT_EQUAL_INT(1, (int)stats.adaptations);
+    TEST_ASSERT_TRUE(stats.count * 100 <= stats.capacity * 50);
+    TEST_ASSERT_EQUAL_INT(MAP_ADAPT_WINDOW, (int)(stats.gets - stats.hits));
+
+    // Churn keeps the table hashed while the map shrinks
+    for (int i = 0; i < MAP_ADAPT_WINDOW; i++) {
+        snprintf(key, sizeof(key), "key:%d", i % 101);
+        if (map_remove(map, key, strlen(key), &value) == -ENOENT) {
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+        }
+    }
+    for (int i = 0; i < 101; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        map_remove(map, key, strlen(key), &value);
+    }
+    for (int i = 0; i < 4; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_PROFILE_WRITE_HEAVY, stats.profile);
+    TEST_ASSERT_EQUAL_INT(0, (int)stats.small_limit);
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, stats.engine);
+
+    // Once a whole window is reads, the next removal moves it back to the small engine
+    for (int i = 0; i < 2 * MAP_ADAPT_WINDOW; i++) {
+        snprintf(key, sizeof(key), "key:%d", i % 4);
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key), &value));
+        TEST_ASSERT_EQUAL_INT(i % 4, value);
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, "key:3", 5, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_PROFILE_READ_HEAVY, stats.profile);
+    TEST_ASSERT_EQUAL_INT(90, stats.grow_load);
+    TEST_ASSERT_EQUAL_INT(8, (int)stats.small_limit);
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_SMALL, stats.engine);
+    TEST_ASSERT_EQUAL_INT(3, (int)stats.count);
+    for (int i = 0; i < 3; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, key, strlen(key), &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+
+    // Hovering just past the slots does not switch engines on every write
+    for (int i = 3; i < 17; i++) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, "key:16", 6, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_PROFILE_READ_HEAVY, stats.profile);
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, stats.engine);
+    TEST_ASSERT_EQUAL_INT(16, (int)stats.count);
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static uint32_t murmur_unmix(uint32_t k) {
+    const uint32_t m = 0x5bd1e995;
+    uint32_t inverse = m;
+
+    // Newton's iteration for the inverse of m modulo 2^32
+    for (int i = 0; i < 5; i++) {
+        inverse *= 2 - m * inverse;
+    }
+
+    k *= inverse;
+    k ^= k >> 24;
+    return k * inverse;
+}
+
+/**
+ * Builds 8-byte keys that all end in the same murmur_hash2 state, and so share
+ * one bucket at every table size: the second block undoes whatever the first
+ * one contributed. Keys never contain a NUL byte.
+ */
+static size_t colliding_keys(char (*keys)[9], size_t count) {
+    const uint32_t m = 0x5bd1e995;
+    size_t made      = 0;
+
+    for (uint32_t seed = 0; made < count; seed++) {
+        uint8_t first[4] = {(uint8_t)('a' + seed % 26), (uint8_t)('a' + seed / 26 % 26),
+                            (uint8_t)('a' + seed / 676 % 26), (uint8_t)('a' + seed / 17576 % 26)};
+        uint32_t k = (uint32_t)first[0] | (uint32_t)first[1] << 8 | (uint32_t)first[2] << 16 |
+                     (uint32_t)first[3] << 24;
+
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+
+        uint32_t second = murmur_unmix(0x12345678u ^ (k * m));
+        uint8_t bytes[4] = {(uint8_t)second, (uint8_t)(second >> 8), (uint8_t)(second >> 16),
+                            (uint8_t)(second >> 24)};
+        if (bytes[0] == 0 || bytes[1] == 0 || bytes[2] == 0 || bytes[3] == 0) {
+            continue;
+        }
+
+        memcpy(keys[made], first, 4);
+        memcpy(keys[made] + 4, bytes, 4);
+        keys[made][8] = '\0';
+        made++;
+    }
+
+    return made;
+}
+
+static void test_hash_flooding(void) {
+    enum { FLOOD_KEYS = 2000 };
+    static char keys[FLOOD_KEYS][9];
+    colliding_keys(keys, FLOOD_KEYS);
+
+    const uint32_t flags[] = {0, MAP_FLAG_CONCURRENT, MAP_FLAG_SINGLE_WRITER, MAP_FLAG_ADAPTIVE};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f]);
+        TEST_ASSERT_NOT_NULL(map);
+
+        for (int i = 0; i < FLOOD_KEYS; i++) {
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, keys[i], 8, &i));
+        }
+
+        map_stats_t stats;
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_INT(1, (int)stats.rekeys);
+
+        for (int i = 0; i < FLOOD_KEYS; i++) {
+            int value = -1;
+            TEST_ASSERT_EQUAL_INT(0, map_get(map, keys[i], 8, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+        }
+
+        // Lookups walk short chains again
+        if (flags[f] & MAP_FLAG_ADAPTIVE) {
+            map_stats_t after;
+            TEST_ASSERT_EQUAL_INT(0, map_stats(map, &after));
+            TEST_ASSERT_TRUE(after.probes - stats.probes < 3 * FLOOD_KEYS);
+        }
+
+        map_lookup_t lookup;
+        int value = -1;
+        map_lookup_start(&lookup, map, keys[7], 8, &value);
+        map_lookup_run(&lookup, 1);
+        TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookup));
+        TEST_ASSERT_EQUAL_INT(7, value);
+
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+
+    // Transactions link their entries without map_put and are watched too
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+    for (int i = 0; i < FLOOD_KEYS; i++) {
+        map_txn_t* txn = map_txn_begin(map);
+        TEST_ASSERT_NOT_NULL(txn);
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, keys[i], 8, &i));
+        TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    }
+
+    map_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    TEST_ASSERT_TRUE(stats.rekeys > 0);
+    for (int i = 0; i < FLOOD_KEYS; i++) {
+        int value = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, keys[i], 8, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+    map_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &after));
+    TEST_ASSERT_TRUE(after.probes - stats.probes < 3 * FLOOD_KEYS);
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // Keyed and unkeyed maps holding the same entries compare equal
+    map_t* keyed = map_create(sizeof(int));
+    map_t* plain = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(keyed);
+    TEST_ASSERT_NOT_NULL(plain);
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_put(keyed, keys[i], 8, &i));
+    }
+
+    map_txn_t* txn = map_txn_begin(plain);
+    TEST_ASSERT_NOT_NULL(txn);
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, keys[i], 8, &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+
+    map_diff_ops_t ops = {0};
+    TEST_ASSERT_EQUAL_INT(0, map_diff(keyed, plain, &ops));
+    TEST_ASSERT_EQUAL_INT(0, map_diff(plain, keyed, &ops));
+
+    // Transactions stage entries under the unkeyed hash
+    txn = map_txn_begin(keyed);
+    TEST_ASSERT_NOT_NULL(txn);
+    for (int i = 100; i < 200; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, keys[i], 8, &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, keys[0], 8));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_size_t(199, map_count(keyed));
+    for (int i = 1; i < 200; i++) {
+        int value = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_get(keyed, keys[i], 8, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(keyed));
+    TEST_ASSERT_EQUAL_INT(0, map_free(plain));
+}
+
+static void test_indexed_buckets(void) {
+    enum { CHAIN = 12 };
+    static char keys[CHAIN + 4][9];
+    colliding_keys(keys, CHAIN + 4);
+
+    const uint32_t flags[] = {MAP_FLAG_ADAPTIVE, MAP_FLAG_SINGLE_WRITER};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f]);
+        TEST_ASSERT_NOT_NULL(map);
+
+        char key[16];
+        for (int i = 0; i < 20; i++) {
+            snprintf(key, sizeof(key), "plain:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key), &i));
+        }
+
+        // Long enough for an index, too short to give up on the hash
+        for (int i = 0; i < CHAIN; i++) {
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, keys[i], 8, &i));
+            TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, keys[i], 8, &i));
+        }
+
+        map_stats_t stats;
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_INT(1, (int)stats.indexed_buckets);
+        TEST_ASSERT_EQUAL_INT(0, (int)stats.rekeys);
+
+        for (int i = 0; i < CHAIN + 4; i++) {
+            int value = -1;
+            TEST_ASSERT_EQUAL_INT(i < CHAIN ? 0 : -ENOENT, map_get(map, keys[i], 8, &value));
+            if (i < CHAIN) {
+                TEST_ASSERT_EQUAL_INT(i, value);
+            }
+        }
+
+        // Bisection instead of a walk over the whole chain
+        if (flags[f] & MAP_FLAG_ADAPTIVE) {
+            map_stats_t after;
+            TEST_ASSERT_EQUAL_INT(0, map_stats(map, &after));
+            TEST_ASSERT_TRUE(after.probes - stats.probes <= (CHAIN + 4) * 5);
+        }
+
+        // Transactions go through the index too
+        map_txn_t* txn = map_txn_begin(map);
+        TEST_ASSERT_NOT_NULL(txn);
+        for (int i = CHAIN; i < CHAIN + 4; i++) {
+            TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, keys[i], 8, &i));
+        }
+        TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, keys[0], 8));
+        TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+
+        size_t seen      = 0;
+        map_iter_t* iter = map_iter_create(map);
+        char* iter_key   = NULL;
+        size_t iter_len;
+        int iter_value;
+        while (map_iter_next(iter, &iter_key, &iter_len, &iter_value) == 0) {
+            seen++;
+        }
+        map_iter_free(iter);
+        TEST_ASSERT_EQUAL_size_t(20 + CHAIN + 3, seen);
+
+        // Shrinking the chain takes the index away
+        for (int i = 1; i < CHAIN; i++) {
+            int value = -1;
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, keys[i], 8, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+            for (int j = i + 1; j < CHAIN + 4; j++) {
+                TEST_ASSERT_EQUAL_INT(0, map_get(map, keys[j], 8, &value));
+                TEST_ASSERT_EQUAL_INT(j, value);
+            }
+        }
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_INT(0, (int)stats.indexed_buckets);
+
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+}
+
+static void test_scattered_keys(void) {
+    enum { FLOOD_KEYS = 40, KEYS = 64 };
+    static char flood[FLOOD_KEYS][9];
+    colliding_keys(flood, FLOOD_KEYS);
+
+    const uint32_t flags[] = {0, MAP_FLAG_SINGLE_WRITER, MAP_FLAG_COMBINING, MAP_FLAG_ADAPTIVE};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f]);
+        TEST_ASSERT_NOT_NULL(map);
+
+        // Inline slots first, then the hashed table; both paths must agree
+        char key[32];
+        for (int i = 0; i < KEYS; i++) {
+            size_t len            = (size_t)snprintf(key, sizeof(key), "user:%d:session", i);
+            size_t cut            = (size_t)i % len;
+            struct iovec parts[3] = {{key, cut}, {key + cut, 0}, {key + cut, len - cut}};
+
+            if (i % 2 == 0) {
+                TEST_ASSERT_EQUAL_INT(0, map_putv(map, parts, 3, &i));
+            } else {
+                TEST_ASSERT_EQUAL_INT(0, map_put(map, key, len, &i));
+            }
+            TEST_ASSERT_EQUAL_INT(-EEXIST, map_putv(map, parts, 3, &i));
+
+            int value = -1;
+            TEST_ASSERT_EQUAL_INT(0, map_getv(map, parts, 3, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+            TEST_ASSERT_EQUAL_INT(0, map_get(map, key, len, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+        }
+
+        // Parts that split hash blocks, hashed again under a key
+        for (int i = 0; i < FLOOD_KEYS; i++) {
+            struct iovec parts[2] = {{flood[i], 3}, {flood[i] + 3, 5}};
+            int value             = 1000 + i;
+            TEST_ASSERT_EQUAL_INT(0, map_putv(map, parts, 2, &value));
+        }
+
+        map_stats_t stats;
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_INT(1, (int)stats.rekeys);
+
+        for (int i = 0; i < FLOOD_KEYS; i++) {
+            struct iovec parts[3] = {{flood[i], 1}, {flood[i] + 1, 6}, {flood[i] + 7, 1}};
+            int value             = -1;
+            TEST_ASSERT_EQUAL_INT(0, map_getv(map, parts, 3, &value));
+            TEST_ASSERT_EQUAL_INT(1000 + i, value);
+            TEST_ASSERT_EQUAL_INT(0, map_get(map, flood[i], 8, &value));
+            TEST_ASSERT_EQUAL_INT(1000 + i, value);
+        }
+
+        // Misses that only differ in a later part
+        int value                  = -1;
+        struct iovec prefix[2]     = {{"user:1", 6}, {":sessio", 7}};
+        struct iovec mismatched[2] = {{"user:1", 6}, {":sessioN", 8}};
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_getv(map, prefix, 2, &value));
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_getv(map, mismatched, 2, &value));
+
+        for (int i = 0; i < KEYS; i++) {
+            size_t len            = (size_t)snprintf(key, sizeof(key), "user:%d:session", i);
+            struct iovec parts[2] = {{key, len / 2}, {key + len / 2, len - len / 2}};
+            TEST_ASSERT_EQUAL_INT(0, map_removev(map, parts, 2, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+            TEST_ASSERT_EQUAL_INT(-ENOENT, map_removev(map, parts, 2, &value));
+        }
+        TEST_ASSERT_EQUAL_size_t(FLOOD_KEYS, map_count(map));
+
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    // Terminators inside a part count as key bytes, as they do for map_put
+    int value                 = 7;
+    struct iovec with_nul[2]  = {{"ab", 2}, {"c", 2}};
+    TEST_ASSERT_EQUAL_INT(0, map_putv(map, with_nul, 2, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "abc", 4, &value));
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "abc", 3, &value));
+
+    char long_part[MAP_KEY_MAX_LEN];
+    memset(long_part, 'x', sizeof(long_part));
+    struct iovec too_long[2] = {{long_part, sizeof(long_part)}, {"y", 1}};
+    struct iovec empty[2]    = {{"", 0}, {"", 0}};
+    struct iovec missing[1]  = {{NULL, 3}};
+    TEST_ASSERT_EQUAL_INT(-EOVERFLOW, map_putv(map, too_long, 2, &value));
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_getv(map, too_long, 2, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_putv(map, empty, 2, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_getv(map, missing, 1, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_getv(map, NULL, 1, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_removev(map, with_nul, 0, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_putv(NULL, with_nul, 2, &value));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+/**
+ * Copy of `key` with the case of every ASCII letter swapped.
+ */
+static void swap_case(char* out, const char* key, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = key[i];
+        out[i] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ? (char)(c ^ 0x20) : c;
+    }
+}
+
+static void test_case_insensitive(void) {
+    static const char* headers[] = {
+        "Host",          "Accept",        "Accept-Encoding", "Access-Control-Allow-Origin", "Cache-Control",
+        "Connection",    "Content-Length", "Content-Type",   "Cookie",                      "ETag",
+        "If-None-Match", "Last-Modified", "Location",        "Strict-Transport-Security",   "User-Agent",
+        "Vary",          "X-Forwarded-For", "X-Request-Id",  "WWW-Authenticate",            "Upgrade",
+    };
+    enum { HEADERS = sizeof(headers) / sizeof(*headers) };
+
+    const uint32_t flags[] = {0, MAP_FLAG_SINGLE_WRITER, MAP_FLAG_COMBINING, MAP_FLAG_ADAPTIVE};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f] | MAP_FLAG_CASE_INSENSITIVE);
+        TEST_ASSERT_NOT_NULL(map);
+
+        // Past the inline slots halfway through, so both engines see every spelling
+        char swapped[64];
+        for (int i = 0; i < HEADERS; i++) {
+            size_t len = strlen(headers[i]);
+            swap_case(swapped, headers[i], len);
+
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, headers[i], len, &i));
+            TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, swapped, len, &i));
+
+            for (int j = 0; j <= i; j++) {
+                size_t other = strlen(headers[j]);
+                int value    = -1;
+                swap_case(swapped, headers[j], other);
+                TEST_ASSERT_EQUAL_INT(0, map_get(map, swapped, other, &value));
+                TEST_ASSERT_EQUAL_INT(j, value);
+            }
+        }
+
+        // Only letters fold
+        int value = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, "key[1]", 6, &value));
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "KEY{1}", 6, &value));
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, "KEY[1]", 6, &value));
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, "caf\xc3\xa9", 5, &value));
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "CAF\xc3\x89", 5, &value));
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, "CAF\xc3\xa9", 5, &value));
+
+        struct iovec parts[2] = {{"x-FORWARDED", 11}, {"-fOR", 4}};
+        TEST_ASSERT_EQUAL_INT(0, map_getv(map, parts, 2, &value));
+        TEST_ASSERT_EQUAL_INT(16, value);
+
+        if (flags[f] == 0) {
+            map_lookup_t lookup;
+            map_lookup_start(&lookup, map, "content-type", 12, &value);
+            map_lookup_run(&lookup, 1);
+            TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookup));
+            TEST_ASSERT_EQUAL_INT(7, value);
+        }
+
+        // Entries keep the spelling they were inserted with
+        map_iter_t* iter = map_iter_create(map);
+        char* iter_key   = NULL;
+        size_t iter_len;
+        while (map_iter_next(iter, &iter_key, &iter_len, &value) == 0) {
+            if (value == 3 && iter_len == 27) {
+                TEST_ASSERT_EQUAL_MEMORY("Access-Control-Allow-Origin", iter_key, 27);
+            }
+        }
+        map_iter_free(iter);
+
+        for (int i = 0; i < HEADERS; i++) {
+            size_t len = strlen(headers[i]);
+            swap_case(swapped, headers[i], len);
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, swapped, len, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+        }
+        TEST_ASSERT_EQUAL_size_t(2, map_count(map));
+
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+
+    // Colliding keys without capitals collide folded too: keyed and indexed
+    enum { FLOOD_KEYS = 40 };
+    static char candidates[4 * FLOOD_KEYS][9];
+    static char flood[FLOOD_KEYS][9];
+    colliding_keys(candidates, 4 * FLOOD_KEYS);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < 4 * FLOOD_KEYS && kept < FLOOD_KEYS; i++) {
+        bool capital = false;
+        for (size_t j = 0; j < 8; j++) {
+            capital |= candidates[i][j] >= 'A' && candidates[i][j] <= 'Z';
+        }
+        if (!capital) {
+            memcpy(flood[kept++], candidates[i], 9);
+        }
+    }
+    TEST_ASSERT_EQUAL_size_t(FLOOD_KEYS, kept);
+
+    map_t* folded = map_create_ex(sizeof(int), MAP_FLAG_CASE_INSENSITIVE);
+    map_t* exact  = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(folded);
+    TEST_ASSERT_NOT_NULL(exact);
+
+    char swapped[9];
+    for (int i = 0; i < FLOOD_KEYS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_put(folded, flood[i], 8, &i));
+        TEST_ASSERT_EQUAL_INT(0, map_put(exact, flood[i], 8, &i));
+
+        swap_case(swapped, flood[i], 8);
+        TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(folded, swapped, 8, &i));
+    }
+
+    map_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(folded, &stats));
+    TEST_ASSERT_EQUAL_INT(1, (int)stats.rekeys);
+
+    for (int i = 0; i < FLOOD_KEYS; i++) {
+        int value = -1;
+        swap_case(swapped, flood[i], 8);
+        TEST_ASSERT_EQUAL_INT(0, map_get(folded, swapped, 8, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+
+    // Maps that fold differently still find each other's keys
+    map_diff_ops_t ops = {0};
+    TEST_ASSERT_EQUAL_INT(0, map_diff(folded, exact, &ops));
+    TEST_ASSERT_EQUAL_INT(0, map_diff(exact, folded, &ops));
+
+    // Transactions stage one entry per folded key
+    map_txn_t* txn = map_txn_begin(folded);
+    TEST_ASSERT_NOT_NULL(txn);
+    int value = 99;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "Host", 4, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "HOST", 4, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_size_t(FLOOD_KEYS + 1, map_count(folded));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(folded));
+    TEST_ASSERT_EQUAL_INT(0, map_free(exact));
+}
+
+static void test_fixed_width_keys(void) {
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), MAP_FLAG_KEY_16 | MAP_FLAG_KEY_32));
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), MAP_FLAG_KEY_16 | MAP_FLAG_CASE_INSENSITIVE));
+
+    // Digests that share a prefix up to a zero byte, which strncmp would equate
+    enum { DIGESTS = 64 };
+    static uint8_t digests[DIGESTS][32];
+    for (int i = 0; i < DIGESTS; i++) {
+        memset(digests[i], 0xa5, 32);
+        digests[i][3]  = 0;
+        digests[i][15] = (uint8_t)i;
+        digests[i][31] = (uint8_t)(i * 7);
+    }
+
+    const uint32_t widths[] = {MAP_FLAG_KEY_16, MAP_FLAG_KEY_32};
+    const uint32_t flags[]  = {0, MAP_FLAG_SINGLE_WRITER, MAP_FLAG_COMBINING, MAP_FLAG_ADAPTIVE};
+    for (size_t w = 0; w < sizeof(widths) / sizeof(*widths); w++) {
+        size_t width = widths[w] == MAP_FLAG_KEY_16 ? 16 : 32;
+
+        for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+            map_t* map = map_create_ex(sizeof(int), widths[w] | flags[f]);
+            TEST_ASSERT_NOT_NULL(map);
+
+            // Past the inline slots halfway through, so both engines see every key
+            for (int i = 0; i < DIGESTS; i++) {
+                TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)digests[i], width, &i));
+                TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, (const char*)digests[i], width, &i));
+
+                for (int j = 0; j <= i; j += 7) {
+                    int value = -1;
+                    TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)digests[j], width, &value));
+                    TEST_ASSERT_EQUAL_INT(j, value);
+                }
+            }
+            TEST_ASSERT_EQUAL_size_t(DIGESTS, map_count(map));
+
+            // Only keys of the map's width are accepted
+            int value = -1;
+            TEST_ASSERT_EQUAL_INT(-EINVAL, map_put(map, (const char*)digests[0], width - 1, &value));
+            TEST_ASSERT_EQUAL_INT(-EINVAL, map_get(map, (const char*)digests[0], width - 1, &value));
+            TEST_ASSERT_EQUAL_INT(-EINVAL, map_remove(map, (const char*)digests[0], 8, &value));
+
+            struct iovec parts[3] = {{digests[9], 5}, {digests[9] + 5, width - 10}, {digests[9] + width - 5, 5}};
+            TEST_ASSERT_EQUAL_INT(0, map_getv(map, parts, 3, &value));
+            TEST_ASSERT_EQUAL_INT(9, value);
+            TEST_ASSERT_EQUAL_INT(-EINVAL, map_getv(map, parts, 2, &value));
+
+            if (flags[f] == 0) {
+                map_lookup_t lookup;
+                map_lookup_start(&lookup, map, (const char*)digests[42], width, &value);
+                map_lookup_run(&lookup, 1);
+                TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookup));
+                TEST_ASSERT_EQUAL_INT(42, value);
+            }
+
+            map_iter_t* iter = map_iter_create(map);
+            char* iter_key   = NULL;
+            size_t iter_len;
+            size_t seen = 0;
+            while (map_iter_next(iter, &iter_key, &iter_len, &value) == 0) {
+                TEST_ASSERT_EQUAL_size_t(width, iter_len);
+                TEST_ASSERT_EQUAL_MEMORY(digests[value], iter_key, width);
+                seen++;
+            }
+            map_iter_free(iter);
+            TEST_ASSERT_EQUAL_size_t(DIGESTS, seen);
+
+            for (int i = 0; i < DIGESTS; i += 2) {
+                TEST_ASSERT_EQUAL_INT(0, map_remove(map, (const char*)digests[i], width, &value));
+                TEST_ASSERT_EQUAL_INT(i, value);
+            }
+            for (int i = 0; i < DIGESTS; i++) {
+                TEST_ASSERT_EQUAL_INT(i % 2 ? 0 : -ENOENT, map_get(map, (const char*)digests[i], width, &value));
+            }
+
+            TEST_ASSERT_EQUAL_INT(0, map_free(map));
+        }
+    }
+
+    // Transactions check the width when staging
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_KEY_16);
+    TEST_ASSERT_NOT_NULL(map);
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    int value = 7;
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_txn_put(txn, (const char*)digests[0], 32, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, (const char*)digests[0], 16, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, (const char*)digests[1], 16, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_size_t(2, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static map_engine_t engine_of(const map_t* map) {
+    map_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+    return stats.engine;
+}
+
+static void test_dense_keys(void) {
+    TEST_ASSERT_NULL(map_create_ex(sizeof(int), MAP_FLAG_KEY_64 | MAP_FLAG_KEY_16));
+
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_KEY_64);
+    TEST_ASSERT_NOT_NULL(map);
+
+    // IDs handed out by a counter end up directly addressed
+    for (uint64_t id = 0; id < 1000; id++) {
+        int value = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+        TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    int value = -1;
+    for (uint64_t id = 0; id < 1000; id++) {
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)&id, sizeof(id), &value));
+        TEST_ASSERT_EQUAL_INT((int)id, value);
+    }
+
+    uint64_t missing = UINT64_MAX;
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, (const char*)&missing, sizeof(missing), &value));
+    missing = 1000;
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, (const char*)&missing, sizeof(missing), &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_get(map, (const char*)&missing, 4, &value));
+
+    map_lookup_t lookup;
+    uint64_t id = 777;
+    map_lookup_start(&lookup, map, (const char*)&id, sizeof(id), &value);
+    map_lookup_run(&lookup, 1);
+    TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookup));
+    TEST_ASSERT_EQUAL_INT(777, value);
+
+    // Iteration walks the occupancy bitmap, in key order
+    for (id = 0; id < 1000; id += 3) {
+        TEST_ASSERT_EQUAL_INT(0, map_remove(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    map_iter_t* iter = map_iter_create(map);
+    char* iter_key   = NULL;
+    size_t iter_len;
+    uint64_t previous = 0;
+    size_t seen       = 0;
+    while (map_iter_next(iter, &iter_key, &iter_len, &value) == 0) {
+        memcpy(&id, iter_key, sizeof(id));
+        TEST_ASSERT_EQUAL_size_t(sizeof(id), iter_len);
+        TEST_ASSERT_EQUAL_INT((int)id, value);
+        TEST_ASSERT_TRUE(id % 3 != 0 && (seen == 0 || id > previous));
+        previous = id;
+        seen++;
+    }
+    map_iter_free(iter);
+    TEST_ASSERT_EQUAL_size_t(666, seen);
+
+    // A key far outside the range sends the map back to hashing
+    id    = 1ULL << 40;
+    value = -2;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, engine_of(map));
+    for (id = 1; id < 1000; id += 3) {
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)&id, sizeof(id), &value));
+        TEST_ASSERT_EQUAL_INT((int)id, value);
+    }
+
+    // and the next growth finds the keys dense again
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, (const char*)&(uint64_t){1ULL << 40}, sizeof(id), &value));
+    for (id = 1000; id < 3000; id++) {
+        value = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+    TEST_ASSERT_EQUAL_size_t(2666, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // A range announced up front, then widened downwards by one key
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_set_key_range(NULL, 0, 1));
+    map = map_create_ex(sizeof(int), MAP_FLAG_KEY_64);
+    TEST_ASSERT_NOT_NULL(map);
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_set_key_range(map, 2, 1));
+    TEST_ASSERT_EQUAL_INT(-ERANGE, map_set_key_range(map, 0, UINT64_MAX));
+    TEST_ASSERT_EQUAL_INT(0, map_set_key_range(map, 5000, 5999));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    for (id = 5000; id < 6000; id++) {
+        value = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+
+    id    = 4990;
+    value = 4990;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    // Transactions and vector keys take the same slots
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    id    = 6500;
+    value = 6500;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, (const char*)&id, sizeof(id), &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    struct iovec parts[2] = {{&id, 3}, {(char*)&id + 3, 5}};
+    TEST_ASSERT_EQUAL_INT(0, map_getv(map, parts, 2, &value));
+    TEST_ASSERT_EQUAL_INT(6500, value);
+
+    for (id = 4990; id < 6000; id++) {
+        TEST_ASSERT_EQUAL_INT(id > 4990 && id < 5000 ? -ENOENT : 0, map_get(map, (const char*)&id, sizeof(id), &value));
+    }
+
+    // Thinned out past the announced range, the map goes back to hashing
+    for (id = 5000; id < 6000; id++) {
+        if (id % 20 != 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, (const char*)&id, sizeof(id), &value));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, engine_of(map));
+    TEST_ASSERT_EQUAL_size_t(52, map_count(map));
+    for (id = 5000; id < 6000; id += 20) {
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)&id, sizeof(id), &value));
+        TEST_ASSERT_EQUAL_INT((int)id, value);
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // A transaction that sends the map back to hashing sizes the table for
+    // everything it adds, so neither the commit nor the next put resizes again
+    map = map_create_ex(sizeof(int), MAP_FLAG_KEY_64);
+    TEST_ASSERT_NOT_NULL(map);
+    for (id = 0; id < 1000; id++) {
+        value = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, engine_of(map));
+
+    map_stats_t before;
+    map_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &before));
+    txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    for (int i = 0; i < 3000; i++) {
+        id    = 1000000 + (uint64_t)i * 1000;
+        value = i;
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    id    = 1000;
+    value = 1000;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &after));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, after.engine);
+    TEST_ASSERT_EQUAL_size_t(4001, after.count);
+    TEST_ASSERT_EQUAL_UINT64(before.resizes + 1, after.resizes);
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+
+    // Shared maps keep hashing
+    map = map_create_ex(sizeof(int), MAP_FLAG_KEY_64 | MAP_FLAG_COMBINING);
+    TEST_ASSERT_NOT_NULL(map);
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_set_key_range(map, 0, 99));
+    for (id = 0; id < 100; id++) {
+        value = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, (const char*)&id, sizeof(id), &value));
+    }
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_HASHED, engine_of(map));
+    id = 42;
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, (const char*)&id, sizeof(id), &value));
+    TEST_ASSERT_EQUAL_INT(42, value);
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_static_map(void) {
+    enum { ENTRIES = 1000 };
+    const size_t bytes = map_static_size(sizeof(int), ENTRIES);
+    TEST_ASSERT_TRUE(bytes > 0);
+    TEST_ASSERT_EQUAL_size_t(0, map_static_size(sizeof(int), SIZE_MAX));
+
+    // Any alignment will do; one byte short will not
+    char* buffer = malloc(bytes + 1);
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_NULL(map_init_static(buffer + 1, bytes - 1, sizeof(int), ENTRIES));
+    TEST_ASSERT_NULL(map_init_static(NULL, bytes, sizeof(int), ENTRIES));
+    TEST_ASSERT_NULL(map_init_static(buffer + 1, bytes, sizeof(int), 0));
+
+    map_t* map = map_init_static(buffer + 1, bytes, sizeof(int), ENTRIES);
+    TEST_ASSERT_NOT_NULL(map);
+    TEST_ASSERT_TRUE((char*)map >= buffer + 1 && (char*)map < buffer + 1 + bytes);
+
+    char key[32];
+    for (int i = 0; i < ENTRIES; i++) {
+        int len = snprintf(key, sizeof(key), "session:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &i));
+        TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, key, (size_t)len, &i));
+    }
+    int value = -1;
+    TEST_ASSERT_EQUAL_INT(-ENOSPC, map_put(map, "one more", 8, &value));
+    TEST_ASSERT_EQUAL_size_t(ENTRIES, map_count(map));
+
+    // Lookups never walk past the probe limit
+    map_stats_t before;
+    map_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &before));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_STATIC, before.engine);
+    for (int i = 0; i < ENTRIES; i++) {
+        int len = snprintf(key, sizeof(key), "session:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, key, (size_t)len, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "session:-1", 10, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_stats(map, &after));
+    TEST_ASSERT_TRUE(after.probes - before.probes <= (ENTRIES + 1) * (MAP_STATIC_PROBE_LIMIT + 1));
+
+    // Removal shifts entries back; freed slots take new keys
+    for (int i = 0; i < ENTRIES; i += 2) {
+        int len = snprintf(key, sizeof(key), "session:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, (size_t)len, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+    for (int i = 0; i < ENTRIES; i++) {
+        int len = snprintf(key, sizeof(key), "session:%d", i);
+        TEST_ASSERT_EQUAL_INT(i % 2 ? 0 : -ENOENT, map_get(map, key, (size_t)len, &value));
+    }
+
+    struct iovec parts[2] = {{"fresh:", 6}, {"key", 3}};
+    value = 7;
+    TEST_ASSERT_EQUAL_INT(0, map_putv(map, parts, 2, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "fresh:key", 9, &value));
+    TEST_ASSERT_EQUAL_INT(7, value);
+
+    map_lookup_t lookup;
+    map_lookup_start(&lookup, map, "session:999", 11, &value);
+    map_lookup_run(&lookup, 1);
+    TEST_ASSERT_EQUAL_INT(0, map_lookup_result(&lookup));
+    TEST_ASSERT_EQUAL_INT(999, value);
+
+    map_iter_t* iter = map_iter_create(map);
+    char* iter_key   = NULL;
+    size_t iter_len;
+    size_t seen = 0;
+    while (map_iter_next(iter, &iter_key, &iter_len, &value) == 0) {
+        TEST_ASSERT_TRUE(value == 7 || value % 2 == 1);
+        seen++;
+    }
+    map_iter_free(iter);
+    TEST_ASSERT_EQUAL_size_t(ENTRIES / 2 + 1, seen);
+
+    // Features that allocate per entry are refused
+    TEST_ASSERT_NULL(map_txn_begin(map));
+    TEST_ASSERT_NULL(map_changes_create(map, 16));
+    TEST_ASSERT_NULL(map_cache_create(map, 16));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_set_hooks(map, NULL));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    free(buffer);
+}
+
+static void test_embedded_map(void) {
+    struct {
+        int id;
+        map_storage_t storage;
+    } owner = {.id = 1};
+
+    TEST_ASSERT_NULL(map_init(NULL, sizeof(int), 0));
+    TEST_ASSERT_NULL(map_init(&owner.storage, sizeof(int), MAP_FLAG_SINGLE_WRITER | MAP_FLAG_CONCURRENT));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_destroy(&owner.storage));
+
+    // The map lives in the owner's storage, and grows past its inline slots
+    map_t* map = map_init(&owner.storage, sizeof(int), 0);
+    TEST_ASSERT_EQUAL_PTR(&owner.storage, map);
+
+    char key[32];
+    for (int i = 0; i < 1000; i++) {
+        int len = snprintf(key, sizeof(key), "member:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &i));
+    }
+
+    int value = -1;
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "member:500", 10, &value));
+    TEST_ASSERT_EQUAL_INT(500, value);
+    TEST_ASSERT_EQUAL_size_t(1000, map_count(map));
+
+    // Only map_destroy releases an embedded map, once
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_free(map));
+    TEST_ASSERT_EQUAL_INT(0, map_destroy(&owner.storage));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_destroy(&owner.storage));
+    TEST_ASSERT_EQUAL_INT(1, owner.id);
+
+    // The storage can hold a concurrent map next
+    map = map_init(&owner.storage, sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(map);
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "k", 1, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_destroy(&owner.storage));
+}
+
+static void test_compact(void) {
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_compact(NULL, 1));
+
+    map_t* single = map_create_ex(sizeof(int), MAP_FLAG_SINGLE_WRITER);
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_compact(single, 1));
+    map_free(single);
+
+    const uint32_t flags[] = {0, MAP_FLAG_CONCURRENT};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f]);
+        TEST_ASSERT_NOT_NULL(map);
+
+        // A purge leaves the survivors scattered
+        enum { ENTRIES = 20000 };
+        char key[32];
+        int value;
+        for (int i = 0; i < ENTRIES; i++) {
+            int len = snprintf(key, sizeof(key), "conn:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &i));
+        }
+        for (int i = 0; i < ENTRIES; i++) {
+            int len = snprintf(key, sizeof(key), "conn:%d", i);
+            if (i % 10 < 7) {
+                TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, (size_t)len, &value));
+            }
+        }
+
+        // An incremental pass, with writes and a resize in between
+        int calls = 0;
+        ssize_t result;
+        while ((result = map_compact(map, 500)) == -EAGAIN) {
+            int len = snprintf(key, sizeof(key), "late:%d", calls);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &calls));
+            calls++;
+        }
+        TEST_ASSERT_EQUAL_INT(0, result);
+        TEST_ASSERT_TRUE(calls >= ENTRIES * 3 / 10 / 500);
+
+        map_stats_t stats;
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_TRUE(stats.slabs > 0);
+
+        for (int i = 0; i < ENTRIES; i++) {
+            int len = snprintf(key, sizeof(key), "conn:%d", i);
+            TEST_ASSERT_EQUAL_INT(i % 10 < 7 ? -ENOENT : 0, map_get(map, key, (size_t)len, &value));
+            if (i % 10 >= 7) {
+                TEST_ASSERT_EQUAL_INT(i, value);
+            }
+        }
+        for (int i = 0; i < calls; i++) {
+            int len = snprintf(key, sizeof(key), "late:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_get(map, key, (size_t)len, &value));
+            TEST_ASSERT_EQUAL_INT(i, value);
+        }
+
+        // New entries mix with moved ones; a second pass moves everything again
+        TEST_ASSERT_EQUAL_INT(0, map_remove(map, "conn:9", 6, &value));
+        value = -1;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, "conn:9", 6, &value));
+        TEST_ASSERT_EQUAL_INT(0, map_compact(map, SIZE_MAX));
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, "conn:9", 6, &value));
+        TEST_ASSERT_EQUAL_INT(-1, value);
+
+        // Slabs go back to the OS as they empty
+        for (int i = 0; i < ENTRIES; i++) {
+            int len = snprintf(key, sizeof(key), "conn:%d", i);
+            map_remove(map, key, (size_t)len, &value);
+        }
+        for (int i = 0; i < calls; i++) {
+            int len = snprintf(key, sizeof(key), "late:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, (size_t)len, &value));
+        }
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_size_t(0, stats.count);
+        TEST_ASSERT_EQUAL_size_t(0, stats.slabs);
+
+        // The fill slab of a pass empties before the pass is over
+        for (int i = 0; i < 100; i++) {
+            int len = snprintf(key, sizeof(key), "gone:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &i));
+        }
+        TEST_ASSERT_EQUAL_INT(-EAGAIN, map_compact(map, 50));
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_size_t(1, stats.slabs);
+        for (int i = 0; i < 100; i++) {
+            int len = snprintf(key, sizeof(key), "gone:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, (size_t)len, &value));
+        }
+        TEST_ASSERT_EQUAL_INT(0, map_compact(map, SIZE_MAX));
+        TEST_ASSERT_EQUAL_INT(0, map_stats(map, &stats));
+        TEST_ASSERT_EQUAL_size_t(0, stats.slabs);
+
+        // A map freed with entries still in slabs
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, "kept", 4, &value));
+        TEST_ASSERT_EQUAL_INT(0, map_compact(map, 1));
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+}
+
+static void test_handles(void) {
+    map_handle_t handle;
+    int value = -1;
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_find_handle(NULL, "k", 1, &handle));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_handle_get(NULL, &value));
+
+    const uint32_t flags[] = {0, MAP_FLAG_CONCURRENT, MAP_FLAG_SINGLE_WRITER, MAP_FLAG_BACKGROUND_RESIZE};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+        map_t* map = map_create_ex(sizeof(int), flags[f]);
+        TEST_ASSERT_NOT_NULL(map);
+
+        int hot = 42;
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, "hot", 3, &hot));
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_find_handle(map, "cold", 4, &handle));
+        TEST_ASSERT_EQUAL_INT(0, map_find_handle(map, "hot", 3, &handle));
+
+        // Growing the table, past the inline slots and through several
+        // resizes, leaves the entry where it is
+        char key[32];
+        for (int i = 0; i < 5000; i++) {
+            int len = snprintf(key, sizeof(key), "fill:%d", i);
+            TEST_ASSERT_EQUAL_INT(0, map_put(map, key, (size_t)len, &i));
+        }
+        TEST_ASSERT_EQUAL_INT(0, map_handle_get(&handle, &value));
+        TEST_ASSERT_EQUAL_INT(42, value);
+
+        hot = 43;
+        TEST_ASSERT_EQUAL_INT(0, map_handle_put_value(&handle, &hot));
+        TEST_ASSERT_EQUAL_INT(0, map_get(map, "hot", 3, &value));
+        TEST_ASSERT_EQUAL_INT(43, value);
+
+        // Any removal makes every handle stale, without touching its entry
+        map_handle_t other;
+        TEST_ASSERT_EQUAL_INT(0, map_find_handle(map, "fill:7", 6, &other));
+        TEST_ASSERT_EQUAL_INT(0, map_remove(map, "fill:8", 6, &value));
+        TEST_ASSERT_EQUAL_INT(-ESTALE, map_handle_get(&handle, &value));
+        TEST_ASSERT_EQUAL_INT(-ESTALE, map_handle_put_value(&handle, &hot));
+        TEST_ASSERT_EQUAL_INT(-ESTALE, map_handle_remove(&other, &value));
+
+        // Found again, a handle removes its own entry
+        TEST_ASSERT_EQUAL_INT(0, map_find_handle(map, "fill:7", 6, &other));
+        TEST_ASSERT_EQUAL_INT(0, map_handle_remove(&other, &value));
+        TEST_ASSERT_EQUAL_INT(7, value);
+        TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "fill:7", 6, &value));
+        TEST_ASSERT_EQUAL_INT(-ESTALE, map_handle_remove(&other, &value));
+        TEST_ASSERT_EQUAL_size_t(5000 - 1, map_count(map));
+
+        // Compaction moves entries, so it invalidates handles too
+        if ((flags[f] & MAP_FLAG_SINGLE_WRITER) == 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_find_handle(map, "hot", 3, &handle));
+            TEST_ASSERT_EQUAL_INT(0, map_compact(map, SIZE_MAX));
+            TEST_ASSERT_EQUAL_INT(-ESTALE, map_handle_get(&handle, &value));
+            TEST_ASSERT_EQUAL_INT(0, map_find_handle(map, "hot", 3, &handle));
+            TEST_ASSERT_EQUAL_INT(0, map_handle_get(&handle, &value));
+            TEST_ASSERT_EQUAL_INT(43, value);
+        }
+
+        TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    }
+
+    // Small and direct-addressed maps hand out handles too
+    map_t* small = map_create(sizeof(int));
+    TEST_ASSERT_EQUAL_INT(0, map_put(small, "a", 1, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_find_handle(small, "a", 1, &handle));
+    TEST_ASSERT_EQUAL_INT(0, map_handle_remove(&handle, &value));
+    TEST_ASSERT_EQUAL_size_t(0, map_count(small));
+    map_free(small);
+
+    map_t* ids = map_create_ex(sizeof(int), MAP_FLAG_KEY_64);
+    TEST_ASSERT_EQUAL_INT(0, map_set_key_range(ids, 0, 999));
+    for (uint64_t id = 0; id < 1000; id++) {
+        int v = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(ids, (const char*)&id, sizeof(id), &v));
+    }
+    const uint64_t id = 500;
+    TEST_ASSERT_EQUAL_INT(0, map_find_handle(ids, (const char*)&id, sizeof(id), &handle));
+    TEST_ASSERT_EQUAL_INT(0, map_handle_remove(&handle, &value));
+    TEST_ASSERT_EQUAL_INT(500, value);
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(ids, (const char*)&id, sizeof(id), &value));
+    map_free(ids);
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_key_handling);
@@ -373,5 +2122,26 @@ int main(void) {
     RUN_TEST(test_resize_behavior);
     RUN_TEST(test_iterator);
     RUN_TEST(test_error_cases);
+    RUN_TEST(test_background_resize);
+    RUN_TEST(test_concurrent_writers);
+    RUN_TEST(test_single_writer);
+    RUN_TEST(test_single_writer_many_readers);
+    RUN_TEST(test_read_cache);
+    RUN_TEST(test_combining_writers);
+    RUN_TEST(test_diff);
+    RUN_TEST(test_interleaved_lookup);
+    RUN_TEST(test_small_map);
+    RUN_TEST(test_small_map_binary_keys);
+    RUN_TEST(test_adaptive);
+    RUN_TEST(test_hash_flooding);
+    RUN_TEST(test_indexed_buckets);
+    RUN_TEST(test_scattered_keys);
+    RUN_TEST(test_case_insensitive);
+    RUN_TEST(test_fixed_width_keys);
+    RUN_TEST(test_dense_keys);
+    RUN_TEST(test_static_map);
+    RUN_TEST(test_embedded_map);
+    RUN_TEST(test_compact);
+    RUN_TEST(test_handles);
     return UNITY_END();
 }
@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+typedef struct hook_counts {
+    int inserts;
+    int updates;
+    int removes;
+    int last_old;
+    int last_new;
+} hook_counts_t;
+
+static void on_insert(void* ctx, const char* key, size_t len, const void* value) {
+    (void)key;
+    (void)len;
+    hook_counts_t* counts = ctx;
+    counts->inserts++;
+    memcpy(&counts->last_new, value, sizeof(int));
+}
+
+static void on_update(void* ctx, const char* key, size_t len, const void* old_value, const void* new_value) {
+    (void)key;
+    (void)len;
+    hook_counts_t* counts = ctx;
+    counts->updates++;
+    memcpy(&counts->last_old, old_value, sizeof(int));
+    memcpy(&counts->last_new, new_value, sizeof(int));
+}
+
+static void on_remove(void* ctx, const char* key, size_t len, const void* value) {
+    (void)key;
+    (void)len;
+    hook_counts_t* counts = ctx;
+    counts->removes++;
+    memcpy(&counts->last_old, value, sizeof(int));
+}
+
+static void test_hooks(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    hook_counts_t counts = {0};
+    const map_hooks_t hooks = {
+        .on_insert = on_insert,
+        .on_update = on_update,
+        .on_remove = on_remove,
+        .ctx       = &counts,
+    };
+    TEST_ASSERT_EQUAL_INT(0, map_set_hooks(map, &hooks));
+
+    int value = 1;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "a", 2, &value));
+    TEST_ASSERT_EQUAL_INT(1, counts.inserts);
+    TEST_ASSERT_EQUAL_INT(1, counts.last_new);
+
+    // A failed put reports nothing
+    TEST_ASSERT_EQUAL_INT(-EEXIST, map_put(map, "a", 2, &value));
+    TEST_ASSERT_EQUAL_INT(1, counts.inserts);
+
+    // Transactions report overwrites as updates
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    value = 2;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "a", 2, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_INT(1, counts.updates);
+    TEST_ASSERT_EQUAL_INT(1, counts.last_old);
+    TEST_ASSERT_EQUAL_INT(2, counts.last_new);
+
+    int result = 0;
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, "a", 2, &result));
+    TEST_ASSERT_EQUAL_INT(1, counts.removes);
+    TEST_ASSERT_EQUAL_INT(2, counts.last_old);
+
+    // Clearing the hooks stops the callbacks
+    TEST_ASSERT_EQUAL_INT(0, map_set_hooks(map, NULL));
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "b", 2, &value));
+    TEST_ASSERT_EQUAL_INT(1, counts.inserts);
+
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_set_hooks(NULL, &hooks));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+typedef struct collected {
+    map_change_t changes[16];
+    int values[16];
+    char keys[16][8];
+    size_t count;
+} collected_t;
+
+static void collect(void* ctx, const map_change_t* change) {
+    collected_t* out = ctx;
+    out->changes[out->count] = *change;
+    memcpy(&out->values[out->count], change->value, sizeof(int));
+    memcpy(out->keys[out->count], change->key, change->len);
+    out->count++;
+}
+
+static void test_change_stream(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    map_changes_t* changes = map_changes_create(map, 3);
+    TEST_ASSERT_NOT_NULL(changes);
+
+    // Only one stream per map
+    TEST_ASSERT_NULL(map_changes_create(map, 4));
+
+    int value = 7;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "k1", 3, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_remove(map, "k1", 3, &value));
+
+    collected_t out = {0};
+    TEST_ASSERT_EQUAL_INT(1, map_changes_drain(changes, collect, &out, 1));
+    TEST_ASSERT_EQUAL_INT(1, map_changes_drain(changes, collect, &out, 16));
+    TEST_ASSERT_EQUAL_INT(0, map_changes_drain(changes, collect, &out, 16));
+
+    TEST_ASSERT_EQUAL_UINT64(1, out.changes[0].seq);
+    TEST_ASSERT_EQUAL_INT(MAP_CHANGE_INSERT, out.changes[0].kind);
+    TEST_ASSERT_EQUAL_STRING("k1", out.keys[0]);
+    TEST_ASSERT_EQUAL_INT(7, out.values[0]);
+    TEST_ASSERT_EQUAL_UINT64(2, out.changes[1].seq);
+    TEST_ASSERT_EQUAL_INT(MAP_CHANGE_REMOVE, out.changes[1].kind);
+
+    // Capacity rounds up to 4; overflow drops records and leaves a gap
+    for (int i = 0; i < 6; i++) {
+        char key[8] = {0};
+        key[0]      = (char)('a' + i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, 2, &i));
+    }
+
+    out.count = 0;
+    TEST_ASSERT_EQUAL_INT(4, map_changes_drain(changes, collect, &out, 16));
+    TEST_ASSERT_EQUAL_UINT64(6, out.changes[3].seq);
+
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "z", 2, &value));
+    out.count = 0;
+    TEST_ASSERT_EQUAL_INT(1, map_changes_drain(changes, collect, &out, 16));
+    TEST_ASSERT_EQUAL_UINT64(9, out.changes[0].seq);
+
+    TEST_ASSERT_EQUAL_INT(0, map_changes_free(changes));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_changes_drain(NULL, collect, &out, 1));
+
+    // The map may also go first
+    changes = map_changes_create(map, 4);
+    TEST_ASSERT_NOT_NULL(changes);
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    TEST_ASSERT_EQUAL_INT(0, map_changes_free(changes));
+}
+
+typedef struct stream_ctx {
+    map_t* map;
+    atomic_bool done;
+} stream_ctx_t;
+
+static void* stream_writer(void* arg) {
+    stream_ctx_t* ctx = arg;
+    for (int i = 0; i < 20000; i++) {
+        char key[16];
+        size_t len = (size_t)snprintf(key, sizeof(key), "w%d", i) + 1;
+        map_put(ctx->map, key, len, &i);
+    }
+    atomic_store(&ctx->done, true);
+    return NULL;
+}
+
+typedef struct ordered {
+    uint64_t last;
+    size_t seen;
+    bool monotonic;
+} ordered_t;
+
+static void check_order(void* arg, const map_change_t* change) {
+    ordered_t* order = arg;
+    if (change->seq <= order->last) {
+        order->monotonic = false;
+    }
+    order->last = change->seq;
+    order->seen++;
+}
+
+static void test_concurrent_consumer(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(map);
+
+    map_changes_t* changes = map_changes_create(map, 1024);
+    TEST_ASSERT_NOT_NULL(changes);
+
+    stream_ctx_t ctx = {.map = map};
+    atomic_init(&ctx.done, false);
+
+    pthread_t writer;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&writer, NULL, stream_writer, &ctx));
+
+    ordered_t order = {.monotonic = true};
+    while (!atomic_load(&ctx.done)) {
+        map_changes_drain(changes, check_order, &order, 256);
+    }
+    pthread_join(writer, NULL);
+    map_changes_drain(changes, check_order, &order, SIZE_MAX);
+
+    // Records may be dropped under pressure but never reordered
+    TEST_ASSERT_TRUE(order.monotonic);
+    TEST_ASSERT_TRUE(order.last <= 20000);
+    TEST_ASSERT_TRUE(order.seen > 0);
+
+    TEST_ASSERT_EQUAL_INT(0, map_changes_free(changes));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_hooks);
+    RUN_TEST(test_change_stream);
+    RUN_TEST(test_concurrent_consumer);
+    return UNITY_END();
+}
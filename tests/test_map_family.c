@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static void test_family_maps(void) {
+    TEST_ASSERT_NULL(map_create_in(NULL, sizeof(int), 0));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_family_free(NULL));
+
+    map_family_t* family = map_family_create();
+    TEST_ASSERT_NOT_NULL(family);
+
+    // The pools have no locks, so maps shared between threads are refused
+    TEST_ASSERT_NULL(map_create_in(family, sizeof(int), MAP_FLAG_CONCURRENT));
+    TEST_ASSERT_NULL(map_create_in(family, sizeof(int), MAP_FLAG_SINGLE_WRITER));
+    TEST_ASSERT_NULL(map_create_in(family, sizeof(int), MAP_FLAG_COMBINING));
+
+    // Many tiny maps, with keys of every length class
+    enum { MAPS = 2000, ATTRS = 6 };
+    static map_t* maps[MAPS];
+    char filler[100];
+    char key[160];
+    memset(filler, 'x', sizeof(filler));
+    for (int m = 0; m < MAPS; m++) {
+        maps[m] = map_create_in(family, sizeof(int), 0);
+        TEST_ASSERT_NOT_NULL(maps[m]);
+
+        for (int a = 0; a < ATTRS; a++) {
+            int len = snprintf(key, sizeof(key), "attr:%d:%.*s", a, (m * 7 + a) % 100, filler);
+            TEST_ASSERT_EQUAL_INT(0, map_put(maps[m], key, (size_t)len, &m));
+        }
+    }
+
+    for (int m = 0; m < MAPS; m++) {
+        TEST_ASSERT_EQUAL_size_t(ATTRS, map_count(maps[m]));
+    }
+
+    // Freed maps hand their memory back for the next ones
+    for (int m = 0; m < MAPS; m += 2) {
+        TEST_ASSERT_EQUAL_INT(0, map_free(maps[m]));
+        maps[m] = map_create_in(family, sizeof(int), 0);
+        TEST_ASSERT_NOT_NULL(maps[m]);
+        TEST_ASSERT_EQUAL_INT(0, map_put(maps[m], "fresh", 5, &m));
+    }
+
+    int value = -1;
+    TEST_ASSERT_EQUAL_INT(0, map_get(maps[1], "attr:0:xxxxxxx", 14, &value));
+    TEST_ASSERT_EQUAL_INT(1, value);
+    TEST_ASSERT_EQUAL_INT(0, map_get(maps[10], "fresh", 5, &value));
+    TEST_ASSERT_EQUAL_INT(10, value);
+
+    // One map outgrows the pooled block sizes and shrinks back
+    map_t* big = maps[3];
+    for (int i = 0; i < 20000; i++) {
+        int len = snprintf(key, sizeof(key), "big:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(big, key, (size_t)len, &i));
+    }
+    for (int i = 0; i < 20000; i++) {
+        int len = snprintf(key, sizeof(key), "big:%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_remove(big, key, (size_t)len, &value));
+        TEST_ASSERT_EQUAL_INT(i, value);
+    }
+    TEST_ASSERT_EQUAL_size_t(ATTRS, map_count(big));
+
+    // Direct addressing takes its arrays from the family too
+    map_t* ids = map_create_in(family, sizeof(int), MAP_FLAG_KEY_64);
+    TEST_ASSERT_NOT_NULL(ids);
+    for (uint64_t id = 0; id < 5000; id++) {
+        int v = (int)id;
+        TEST_ASSERT_EQUAL_INT(0, map_put(ids, (const char*)&id, sizeof(id), &v));
+    }
+    map_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, map_stats(ids, &stats));
+    TEST_ASSERT_EQUAL_INT(MAP_ENGINE_DIRECT, stats.engine);
+
+    // Transactions build their entries in the family
+    map_txn_t* txn = map_txn_begin(maps[5]);
+    TEST_ASSERT_NOT_NULL(txn);
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "txn", 3, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_abort(txn));
+    txn = map_txn_begin(maps[5]);
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "txn", 3, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_size_t(ATTRS + 1, map_count(maps[5]));
+
+    // The rest go with the family, without freeing them one by one
+    TEST_ASSERT_EQUAL_INT(0, map_family_free(family));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_family_maps);
+    return UNITY_END();
+}
@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+typedef struct session {
+    char token[24];
+    uint64_t user;
+    map_node_t by_token;
+    map_node_t by_user;
+} session_t;
+
+static const char* session_token(const map_node_t* node, size_t* len) {
+    const session_t* session = map_node_entry(node, const session_t, by_token);
+    *len                     = strlen(session->token);
+    return session->token;
+}
+
+static const char* session_user(const map_node_t* node, size_t* len) {
+    const session_t* session = map_node_entry(node, const session_t, by_user);
+    *len                     = sizeof(session->user);
+    return (const char*)&session->user;
+}
+
+static bool session_token_equal(const map_node_t* node, const char* key, size_t len) {
+    const session_t* session = map_node_entry(node, const session_t, by_token);
+    return strlen(session->token) == len && strncasecmp(session->token, key, len) == 0;
+}
+
+static void free_session(void* ctx, map_node_t* node) {
+    (*(size_t*)ctx)++;
+    free(map_node_entry(node, session_t, by_token));
+}
+
+static void test_intrusive_basic(void) {
+    TEST_ASSERT_NULL(map_intrusive_create(NULL));
+    TEST_ASSERT_NULL(map_intrusive_create(&(map_intrusive_ops_t){0}));
+
+    map_intrusive_t* tokens = map_intrusive_create(&(map_intrusive_ops_t){.key = session_token});
+    map_intrusive_t* users  = map_intrusive_create(&(map_intrusive_ops_t){.key = session_user});
+    TEST_ASSERT_NOT_NULL(tokens);
+    TEST_ASSERT_NOT_NULL(users);
+
+    // Enough sessions to grow the bucket array several times
+    enum { SESSIONS = 5000 };
+    session_t* sessions[SESSIONS];
+    for (size_t i = 0; i < SESSIONS; i++) {
+        sessions[i] = calloc(1, sizeof(session_t));
+        TEST_ASSERT_NOT_NULL(sessions[i]);
+        snprintf(sessions[i]->token, sizeof(sessions[i]->token), "tok-%zu", i * 7919);
+        sessions[i]->user = 1000 + i;
+
+        TEST_ASSERT_EQUAL_INT(0, map_intrusive_insert(tokens, &sessions[i]->by_token));
+        TEST_ASSERT_EQUAL_INT(0, map_intrusive_insert(users, &sessions[i]->by_user));
+    }
+    TEST_ASSERT_EQUAL_size_t(SESSIONS, map_intrusive_count(tokens));
+
+    // Lookups hand back the caller's own objects, through either map
+    char token[24];
+    for (size_t i = 0; i < SESSIONS; i++) {
+        snprintf(token, sizeof(token), "tok-%zu", i * 7919);
+        map_node_t* node = map_intrusive_find(tokens, token, strlen(token));
+        TEST_ASSERT_NOT_NULL(node);
+        TEST_ASSERT_EQUAL_PTR(sessions[i], map_node_entry(node, session_t, by_token));
+
+        uint64_t user = 1000 + i;
+        node          = map_intrusive_find(users, (const char*)&user, sizeof(user));
+        TEST_ASSERT_NOT_NULL(node);
+        TEST_ASSERT_EQUAL_PTR(sessions[i], map_node_entry(node, session_t, by_user));
+    }
+    TEST_ASSERT_NULL(map_intrusive_find(tokens, "tok-1", 5));
+    TEST_ASSERT_NULL(map_intrusive_find(tokens, NULL, 5));
+
+    // A second object with a taken key is refused
+    session_t duplicate = {.user = 1000};
+    strcpy(duplicate.token, "tok-0");
+    TEST_ASSERT_EQUAL_INT(-EEXIST, map_intrusive_insert(tokens, &duplicate.by_token));
+    TEST_ASSERT_EQUAL_INT(-EEXIST, map_intrusive_insert(users, &duplicate.by_user));
+
+    // Unlinking by node and removing by key both shrink the array back
+    for (size_t i = 0; i < SESSIONS - 10; i++) {
+        if (i % 2 == 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_intrusive_unlink(tokens, &sessions[i]->by_token));
+        } else {
+            snprintf(token, sizeof(token), "tok-%zu", i * 7919);
+            TEST_ASSERT_EQUAL_PTR(&sessions[i]->by_token, map_intrusive_remove(tokens, token, strlen(token)));
+        }
+
+        TEST_ASSERT_EQUAL_INT(0, map_intrusive_unlink(users, &sessions[i]->by_user));
+        free(sessions[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_intrusive_unlink(tokens, &duplicate.by_token));
+    TEST_ASSERT_NULL(map_intrusive_remove(tokens, "tok-0", 5));
+    TEST_ASSERT_EQUAL_size_t(10, map_intrusive_count(tokens));
+
+    for (size_t i = SESSIONS - 10; i < SESSIONS; i++) {
+        snprintf(token, sizeof(token), "tok-%zu", i * 7919);
+        TEST_ASSERT_EQUAL_PTR(&sessions[i]->by_token, map_intrusive_find(tokens, token, strlen(token)));
+    }
+
+    // Teardown: the owner frees its objects through foreach
+    size_t freed = 0;
+    TEST_ASSERT_EQUAL_INT(0, map_intrusive_free(users));
+    TEST_ASSERT_EQUAL_INT(0, map_intrusive_foreach(tokens, free_session, &freed));
+    TEST_ASSERT_EQUAL_size_t(10, freed);
+    TEST_ASSERT_EQUAL_INT(0, map_intrusive_free(tokens));
+}
+
+static void test_intrusive_equal(void) {
+    map_intrusive_t* map =
+        map_intrusive_create(&(map_intrusive_ops_t){.key = session_token, .equal = session_token_equal});
+    TEST_ASSERT_NOT_NULL(map);
+
+    // The compare callback decides equality among nodes of the same hash
+    session_t session = {0};
+    strcpy(session.token, "abc");
+    TEST_ASSERT_EQUAL_INT(0, map_intrusive_insert(map, &session.by_token));
+    TEST_ASSERT_EQUAL_PTR(&session.by_token, map_intrusive_find(map, "abc", 3));
+    TEST_ASSERT_NULL(map_intrusive_find(map, "abcd", 4));
+
+    session_t empty = {0};
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_intrusive_insert(map, &empty.by_token));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_intrusive_insert(map, NULL));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_intrusive_foreach(map, NULL, NULL));
+
+    TEST_ASSERT_EQUAL_PTR(&session.by_token, map_intrusive_remove(map, "abc", 3));
+    TEST_ASSERT_EQUAL_size_t(0, map_intrusive_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_intrusive_free(map));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_intrusive_free(NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_intrusive_basic);
+    RUN_TEST(test_intrusive_equal);
+    return UNITY_END();
+}
@@ -0,0 +1,177 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+typedef struct {
+    atomic_int hits[1000];
+} loop_state_t;
+
+static void mark_index(void* arg, size_t index) {
+    loop_state_t* state = arg;
+    atomic_fetch_add(&state->hits[index], 1);
+}
+
+static void test_parallel_for(void) {
+    map_pool_t* pool = map_pool_create(4);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    static loop_state_t state;
+    memset(&state, 0, sizeof(state));
+
+    // Every index runs exactly once, also when the loop is reused
+    for (int round = 0; round < 10; round++) {
+        TEST_ASSERT_EQUAL_INT(0, map_pool_parallel_for(pool, 1000, mark_index, &state));
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_INT(10, atomic_load(&state.hits[i]));
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, map_pool_parallel_for(pool, 0, mark_index, &state));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_pool_parallel_for(NULL, 1, mark_index, &state));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_pool_parallel_for(pool, 1, NULL, &state));
+
+    TEST_ASSERT_EQUAL_INT(0, map_pool_free(pool));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_pool_free(NULL));
+}
+
+typedef struct {
+    map_pool_t* pool;
+    atomic_int total;
+} nested_state_t;
+
+static void count_inner(void* arg, size_t index) {
+    nested_state_t* state = arg;
+    atomic_fetch_add(&state->total, (int)index);
+}
+
+static void run_inner(void* arg, size_t index) {
+    nested_state_t* state = arg;
+    (void)index;
+    map_pool_parallel_for(state->pool, 100, count_inner, state);
+}
+
+static void test_nested_parallel_for(void) {
+    nested_state_t state = {.pool = map_pool_create(3)};
+    TEST_ASSERT_NOT_NULL(state.pool);
+    atomic_init(&state.total, 0);
+
+    // Inner loops are pushed onto the workers' own deques and stolen from there
+    TEST_ASSERT_EQUAL_INT(0, map_pool_parallel_for(state.pool, 20, run_inner, &state));
+    TEST_ASSERT_EQUAL_INT(20 * 4950, atomic_load(&state.total));
+
+    TEST_ASSERT_EQUAL_INT(0, map_pool_free(state.pool));
+}
+
+typedef struct {
+    atomic_int submitted;
+} executor_state_t;
+
+static void* run_detached(void* arg) {
+    void** job = arg;
+    ((void (*)(void*))job[0])(job[1]);
+    free(job);
+    return NULL;
+}
+
+static int submit_thread(void* ctx, void (*task)(void* arg), void* arg) {
+    executor_state_t* executor = ctx;
+    void** job                 = malloc(2 * sizeof(void*));
+    if (job == NULL) {
+        return -1;
+    }
+
+    memcpy(&job[0], &task, sizeof(task));
+    job[1] = arg;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_detached, job) != 0) {
+        free(job);
+        return -1;
+    }
+
+    pthread_detach(thread);
+    atomic_fetch_add(&executor->submitted, 1);
+    return 0;
+}
+
+static void test_external_executor(void) {
+    executor_state_t executor_state;
+    atomic_init(&executor_state.submitted, 0);
+
+    map_executor_t executor = {.submit = submit_thread, .ctx = &executor_state};
+    map_pool_t* pool        = map_pool_create_external(&executor, 2);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    static loop_state_t state;
+    memset(&state, 0, sizeof(state));
+    TEST_ASSERT_EQUAL_INT(0, map_pool_parallel_for(pool, 1000, mark_index, &state));
+
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_INT(1, atomic_load(&state.hits[i]));
+    }
+    TEST_ASSERT_TRUE(atomic_load(&executor_state.submitted) > 0);
+
+    TEST_ASSERT_EQUAL_INT(0, map_pool_free(pool));
+    TEST_ASSERT_NULL(map_pool_create_external(NULL, 2));
+}
+
+static void sum_values(void* ctx, const char* key, size_t len, void* value) {
+    atomic_int* sum = ctx;
+    (void)key;
+    (void)len;
+
+    int* v = value;
+    atomic_fetch_add(sum, *v);
+    *v = -*v;
+}
+
+static void test_foreach_parallel(void) {
+    map_pool_t* pool = map_pool_create(4);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(map);
+
+    for (int i = 0; i < 3000; i++) {
+        char key[20];
+        sprintf(key, "key%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, strlen(key) + 1, &i));
+    }
+
+    atomic_int sum;
+    atomic_init(&sum, 0);
+    TEST_ASSERT_EQUAL_INT(0, map_foreach_parallel(map, pool, sum_values, &sum));
+    TEST_ASSERT_EQUAL_INT(2999 * 3000 / 2, atomic_load(&sum));
+
+    // Values were updated in place
+    int result = 0;
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "key7", 5, &result));
+    TEST_ASSERT_EQUAL_INT(-7, result);
+
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_foreach_parallel(map, NULL, sum_values, &sum));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+    TEST_ASSERT_EQUAL_INT(0, map_pool_free(pool));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parallel_for);
+    RUN_TEST(test_nested_parallel_for);
+    RUN_TEST(test_external_executor);
+    RUN_TEST(test_foreach_parallel);
+    return UNITY_END();
+}
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+#define REPL_KEYS (3000)
+
+static size_t repl_key(char* key, size_t size, int i) {
+    return (size_t)snprintf(key, size, "key:%d", i) + 1;
+}
+
+/**
+ * Runs in the child process: mirrors the primary until it hangs up, then
+ * checks the final contents. Keys divisible by three end up removed and every
+ * other key holds twice its index.
+ */
+static int repl_follower_main(int fd) {
+    map_t* map = map_create(sizeof(int));
+    if (map == NULL) {
+        return 1;
+    }
+
+    map_repl_t* repl = map_repl_follower_create(map, fd);
+    if (repl == NULL) {
+        return 2;
+    }
+
+    ssize_t result;
+    while ((result = map_repl_poll(repl)) >= 0) {
+    }
+    if (result != -ECONNRESET) {
+        return 3;
+    }
+
+    char key[32];
+    for (int i = 0; i < REPL_KEYS; i++) {
+        int value     = 0;
+        ssize_t found = map_get(map, key, repl_key(key, sizeof(key), i), &value);
+
+        if (i % 3 == 0 ? found != -ENOENT : found != 0 || value != i * 2) {
+            return 4;
+        }
+    }
+
+    if (map_count(map) != REPL_KEYS - (REPL_KEYS + 2) / 3) {
+        return 5;
+    }
+
+    map_repl_free(repl);
+    map_free(map);
+    return 0;
+}
+
+static void test_follower_process(void) {
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    pid_t pid = fork();
+    TEST_ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(repl_follower_main(fds[1]));
+    }
+    close(fds[1]);
+
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_CONCURRENT);
+    TEST_ASSERT_NOT_NULL(map);
+
+    // Some contents exist before replication starts and arrive as a snapshot
+    char key[32];
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, repl_key(key, sizeof(key), i), &i));
+    }
+
+    map_repl_t* repl = map_repl_primary_create(map, fds[0], 256);
+    TEST_ASSERT_NOT_NULL(repl);
+    TEST_ASSERT_EQUAL_INT(100, map_repl_flush(repl));
+    TEST_ASSERT_EQUAL_INT(0, map_repl_flush(repl));
+
+    // Small batches go out as deltas
+    for (int i = 100; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, repl_key(key, sizeof(key), i), &i));
+        if (i % 100 == 99) {
+            TEST_ASSERT_EQUAL_INT(100, map_repl_flush(repl));
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64(1000, map_repl_seq(repl));
+
+    // Too many changes between flushes overflow the stream and force a resync
+    for (int i = 1000; i < REPL_KEYS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, map_put(map, key, repl_key(key, sizeof(key), i), &i));
+    }
+    TEST_ASSERT_EQUAL_INT(REPL_KEYS, map_repl_flush(repl));
+
+    // Updates and removals, all within one batch
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    for (int i = 0; i < 300; i++) {
+        int value  = i * 2;
+        size_t len = repl_key(key, sizeof(key), i);
+        if (i % 3 == 0) {
+            TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, key, len));
+        } else if (i < 100) {
+            TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, key, len, &value));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_INT(166, map_repl_flush(repl));
+
+    for (int i = 100; i < REPL_KEYS; i++) {
+        int value  = i * 2;
+        size_t len = repl_key(key, sizeof(key), i);
+        if (i % 3 != 0) {
+            txn = map_txn_begin(map);
+            TEST_ASSERT_NOT_NULL(txn);
+            TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, key, len, &value));
+            TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+        } else if (i >= 300) {
+            TEST_ASSERT_EQUAL_INT(0, map_remove(map, key, len, &value));
+        }
+        if (i % 100 == 99) {
+            TEST_ASSERT_TRUE(map_repl_flush(repl) > 0);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_repl_flush(repl));
+
+    TEST_ASSERT_EQUAL_INT(0, map_repl_free(repl));
+    close(fds[0]);
+
+    int status = 0;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_protocol_errors(void) {
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    map_t* primary  = map_create(sizeof(int));
+    map_t* follower = map_create(sizeof(long long));
+    TEST_ASSERT_NOT_NULL(primary);
+    TEST_ASSERT_NOT_NULL(follower);
+
+    map_repl_t* out = map_repl_primary_create(primary, fds[0], 16);
+    map_repl_t* in  = map_repl_follower_create(follower, fds[1]);
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_NOT_NULL(in);
+
+    // A map has a single change stream
+    TEST_ASSERT_NULL(map_repl_primary_create(primary, fds[0], 16));
+
+    // Roles are not interchangeable
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_repl_flush(in));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_repl_poll(out));
+
+    // Value sizes must match
+    int value = 1;
+    TEST_ASSERT_EQUAL_INT(0, map_put(primary, "a", 2, &value));
+    TEST_ASSERT_EQUAL_INT(1, map_repl_flush(out));
+    TEST_ASSERT_EQUAL_INT(-EPROTO, map_repl_poll(in));
+
+    // A vanished follower surfaces as a send error, not a signal
+    close(fds[1]);
+    TEST_ASSERT_EQUAL_INT(0, map_put(primary, "b", 2, &value));
+    TEST_ASSERT_EQUAL_INT(-EPIPE, map_repl_flush(out));
+
+    TEST_ASSERT_EQUAL_INT(0, map_repl_free(out));
+    TEST_ASSERT_EQUAL_INT(0, map_repl_free(in));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_repl_free(NULL));
+    close(fds[0]);
+
+    // A record count the payload cannot hold is refused before any allocation
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    in = map_repl_follower_create(follower, fds[1]);
+    TEST_ASSERT_NOT_NULL(in);
+
+    struct {
+        uint32_t type;
+        uint32_t value_size;
+        uint64_t seq;
+        uint32_t count;
+        uint32_t bytes;
+    } header = {.type = 1, .value_size = sizeof(long long), .seq = 1, .count = UINT32_MAX, .bytes = 4};
+    TEST_ASSERT_EQUAL_INT(sizeof(header), write(fds[0], &header, sizeof(header)));
+    TEST_ASSERT_EQUAL_INT(-EPROTO, map_repl_poll(in));
+    TEST_ASSERT_EQUAL_size_t(0, map_count(follower));
+
+    TEST_ASSERT_EQUAL_INT(0, map_repl_free(in));
+    close(fds[0]);
+    close(fds[1]);
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(primary));
+    TEST_ASSERT_EQUAL_INT(0, map_free(follower));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_follower_process);
+    RUN_TEST(test_protocol_errors);
+    return UNITY_END();
+}
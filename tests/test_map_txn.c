@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "map.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static void test_commit(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    int value = 1;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "old", 4, &value));
+
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+
+    int forward = 10;
+    int reverse = 20;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "index:a", 8, &forward));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "reverse:a", 10, &reverse));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, "old", 4));
+
+    // Nothing is visible before commit
+    int result = 0;
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "index:a", 8, &result));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "old", 4, &result));
+
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "index:a", 8, &result));
+    TEST_ASSERT_EQUAL_INT(10, result);
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "reverse:a", 10, &result));
+    TEST_ASSERT_EQUAL_INT(20, result);
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "old", 4, &result));
+    TEST_ASSERT_EQUAL_INT(2, map_count(map));
+
+    // Puts overwrite existing keys, the last staged value wins
+    txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    forward = 11;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "index:a", 8, &forward));
+    forward = 12;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "index:a", 8, &forward));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "index:a", 8, &result));
+    TEST_ASSERT_EQUAL_INT(12, result);
+    TEST_ASSERT_EQUAL_INT(2, map_count(map));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static void test_rollback(void) {
+    map_t* map = map_create(sizeof(int));
+    TEST_ASSERT_NOT_NULL(map);
+
+    int value = 1;
+    TEST_ASSERT_EQUAL_INT(0, map_put(map, "keep", 5, &value));
+
+    // A failing remove leaves the map exactly as it was
+    map_txn_t* txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    value = 2;
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "keep", 5, &value));
+    for (int i = 0; i < 100; i++) {
+        char key[20];
+        sprintf(key, "new%d", i);
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, key, strlen(key) + 1, &i));
+    }
+    TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, "missing", 8));
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_txn_commit(txn));
+
+    int result = 0;
+    TEST_ASSERT_EQUAL_INT(1, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "keep", 5, &result));
+    TEST_ASSERT_EQUAL_INT(1, result);
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "new0", 5, &result));
+
+    // Removing a key put in the same transaction needs no map entry
+    txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, "temp", 5, &value));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, "temp", 5));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    TEST_ASSERT_EQUAL_INT(-ENOENT, map_get(map, "temp", 5, &result));
+
+    // Aborting discards everything
+    txn = map_txn_begin(map);
+    TEST_ASSERT_NOT_NULL(txn);
+    TEST_ASSERT_EQUAL_INT(0, map_txn_remove(txn, "keep", 5));
+    TEST_ASSERT_EQUAL_INT(0, map_txn_abort(txn));
+    TEST_ASSERT_EQUAL_INT(0, map_get(map, "keep", 5, &result));
+
+    TEST_ASSERT_NULL(map_txn_begin(NULL));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_txn_put(NULL, "a", 2, &value));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_txn_commit(NULL));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, map_txn_abort(NULL));
+
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+static atomic_bool committing;
+
+static void* pair_reader(void* arg) {
+    map_t* map = arg;
+    intptr_t torn = 0;
+
+    while (atomic_load(&committing)) {
+        if (map_count(map) % 2 != 0) {
+            torn++;
+        }
+    }
+
+    return (void*)torn;
+}
+
+static void test_readers_see_whole_groups(void) {
+    map_t* map = map_create_ex(sizeof(int), MAP_FLAG_SINGLE_WRITER);
+    TEST_ASSERT_NOT_NULL(map);
+
+    atomic_store(&committing, true);
+
+    pthread_t readers[2];
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&readers[i], NULL, pair_reader, map));
+    }
+
+    // Every transaction adds an entry and its reverse, so the count stays even
+    for (int i = 0; i < 2000; i++) {
+        char forward[20];
+        char reverse[20];
+        sprintf(forward, "fwd%d", i);
+        sprintf(reverse, "rev%d", i);
+
+        map_txn_t* txn = map_txn_begin(map);
+        TEST_ASSERT_NOT_NULL(txn);
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, forward, strlen(forward) + 1, &i));
+        TEST_ASSERT_EQUAL_INT(0, map_txn_put(txn, reverse, strlen(reverse) + 1, &i));
+        TEST_ASSERT_EQUAL_INT(0, map_txn_commit(txn));
+    }
+
+    atomic_store(&committing, false);
+    for (int i = 0; i < 2; i++) {
+        void* torn = NULL;
+        pthread_join(readers[i], &torn);
+        TEST_ASSERT_NULL(torn);
+    }
+
+    TEST_ASSERT_EQUAL_INT(4000, map_count(map));
+    TEST_ASSERT_EQUAL_INT(0, map_free(map));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_commit);
+    RUN_TEST(test_rollback);
+    RUN_TEST(test_readers_see_whole_groups);
+    return UNITY_END();
+}